@@ -9,23 +9,252 @@ extern "C"
 {
 #endif
 
+    // GPU stages of an evaluation with the Vulkan backend
+    enum FlopStage
+    {
+        // Conversion of both images to YyCxCz space
+        FLOP_STAGE_YYCXCZ,
+        // Horizontal CSF and feature filters
+        FLOP_STAGE_FILTER_X,
+        // Vertical CSF and feature filters, error computation, histogram and
+        // statistics
+        FLOP_STAGE_FILTER_Y,
+        // Color mapping of the error image, if an output path was supplied
+        FLOP_STAGE_COLOR_MAP,
+        // Copy of the color-mapped error image to host-visible memory
+        FLOP_STAGE_READBACK,
+        FLOP_STAGE_COUNT,
+    };
+
     struct FlopSummary
     {
         int width;
         int height;
         int milliseconds_elapsed;
+
+        // Per-stage wall time. Decoding of both images and encoding of the
+        // output image are reported from the threads that perform them.
+        float decode_milliseconds;
+        float upload_milliseconds;
+        float evaluate_milliseconds;
+        float encode_milliseconds;
+
+        // GPU time per stage, indexed by FlopStage and measured with timestamp
+        // queries. Banded evaluations report the sum over all bands. Zero with
+        // the CPU backend, or if the device queue doesn't support timestamps.
+        float stage_milliseconds[FLOP_STAGE_COUNT];
+
+        // Error statistics. Percentiles and the weighted median are resolved
+        // to 1/1024. The weighted median weighs each error by its magnitude
+        // (as reported by the reference FLIP implementation), so half of the
+        // total error lies below it.
+        float mean_error;
+        float max_error;
+        float weighted_median_error;
+        float p50_error;
+        float p95_error;
+        float p99_error;
+
+        // Nonzero if the pair exceeds a threshold of the gate set with
+        // flop_config_set_gate. Always zero if no gate is set.
+        int gate_failed;
+
+        // Number of pixels per error bucket. Bucket i counts errors e with
+        // floor(31 * e) == i.
+        uint32_t histogram[32];
     };
 
-    // Call to retrieve a C-string describing the last encountered error
+    struct FlopPair
+    {
+        char const* reference_path;
+        char const* test_path;
+        // Optional, may be NULL
+        char const* output_path;
+    };
+
+    enum FlopPixelFormat
+    {
+        // 8-bit sRGB-encoded RGBA, evaluated as an LDR image
+        FLOP_PIXEL_FORMAT_RGBA8,
+        // Linear 16-bit float RGBA, evaluated as an HDR image
+        FLOP_PIXEL_FORMAT_RGBA16F,
+        // Linear 32-bit float RGBA, evaluated as an HDR image
+        FLOP_PIXEL_FORMAT_RGBA32F,
+    };
+
+    // Image pixels in caller memory. The alpha channel is always honored.
+    struct FlopPixels
+    {
+        void const* data;
+        int width;
+        int height;
+        // Bytes between the starts of consecutive rows, or 0 if tightly packed
+        int stride;
+        FlopPixelFormat format;
+    };
+
+    struct FlopBatchSummary
+    {
+        int pair_count;
+        int failure_count;
+        // Number of pairs that failed the gate (see flop_config_set_gate)
+        int gate_failure_count;
+        int milliseconds_elapsed;
+        float pairs_per_second;
+    };
+
+    // Opaque handle to an analysis context. A context owns the source and
+    // intermediate images, command buffers and histogram storage needed to
+    // compare a pair of images. Distinct contexts may be used concurrently
+    // from separate threads; a single context must not.
+    typedef struct FlopContext FlopContext;
+
+    // Call to retrieve a C-string describing the last error encountered on the
+    // calling thread
     char const* flop_get_error();
 
     void flop_config_enable_validation();
 
+    // Returns a short human-readable name of a stage (e.g. "filter x")
+    char const* flop_stage_name(FlopStage stage);
+
+    enum FlopBackend
+    {
+        // Use Vulkan if a suitable device exists, and the CPU otherwise
+        FLOP_BACKEND_AUTO,
+        FLOP_BACKEND_VULKAN,
+        FLOP_BACKEND_CPU,
+    };
+
+    // Select the backend used for analysis. Must be called before flop_init.
+    // If left as FLOP_BACKEND_AUTO, the FLOP_BACKEND environment variable
+    // ("vulkan" or "cpu") is consulted. The CPU backend cannot present images,
+    // so initialization with instance extensions always requires Vulkan.
+    void flop_config_set_backend(FlopBackend backend);
+
+    // Returns the backend selected by flop_init
+    FlopBackend flop_get_backend();
+
+    enum FlopPrecision
+    {
+        // Store intermediate images as 32-bit floats
+        FLOP_PRECISION_FULL,
+        // Store intermediate images as 16-bit floats, halving the memory and
+        // bandwidth used by the filter passes at a small cost in accuracy
+        FLOP_PRECISION_HALF,
+    };
+
+    // Select the precision of intermediate images used by the Vulkan backend
+    // for subsequent evaluations. Defaults to FLOP_PRECISION_FULL. The CPU
+    // backend always uses 32-bit floats.
+    void flop_config_set_precision(FlopPrecision precision);
+
+    // Retain the fully filtered reference image between evaluations with the
+    // Vulkan backend, so that comparing one reference against many test
+    // images only converts and filters the test image (and skips decoding and
+    // uploading the reference) after the first pair. A reference is
+    // identified by its path, size and modification time, or by a hash of
+    // its pixels with flop_analyze_pixels, along with the exposure and
+    // tonemapper. Enabled by default. Does not apply to banded evaluations.
+    void flop_config_set_reference_cache(int enabled);
+
+    // Select the viewing condition of subsequent evaluations in pixels per
+    // degree of visual angle, from which the CSF and feature filters are
+    // computed. Values above 236 are clamped. Passing 0 (the default) restores
+    // the kernels of the reference FLIP implementation.
+    void flop_config_set_pixels_per_degree(float pixels_per_degree);
+
+    // Pixels per degree of a monitor resolution_x pixels wide, monitor_width
+    // wide and viewed from monitor_distance (in the same unit as its width)
+    float flop_pixels_per_degree(float monitor_distance,
+                                 float monitor_width,
+                                 int resolution_x);
+
+    enum FlopHistogramScale
+    {
+        // Bucket i counts errors e with floor(bucket_count * e) == i (or the
+        // last bucket, for e == 1)
+        FLOP_HISTOGRAM_LINEAR,
+        // Buckets are evenly spaced in log2(e), covering errors in [2^-16, 1].
+        // Smaller errors, including zero, are counted by the first bucket.
+        FLOP_HISTOGRAM_LOG,
+    };
+
+    // Accumulate an additional error histogram with bucket_count buckets (at
+    // most 4096) in subsequent evaluations, retrieved with
+    // flop_context_get_histogram. The fixed 32-bucket histogram of FlopSummary
+    // is always available. Disabled if bucket_count is 0 (the default).
+    void flop_config_set_histogram(int bucket_count, FlopHistogramScale scale);
+
+    // Error budget of a pair. A pair fails the gate if any of its mean error,
+    // error at the given percentile or max error exceeds the corresponding
+    // threshold. Negative thresholds are ignored.
+    struct FlopGate
+    {
+        float mean_error;
+        // Fraction of pixels in (0, 1], e.g. 0.95
+        float percentile;
+        float percentile_error;
+        float max_error;
+    };
+
+    // Evaluate subsequent pairs against a gate. The thresholds are checked on
+    // the device along with the error statistics, and the error image of a
+    // pair is only color mapped, read back and written to its output path if
+    // the pair fails the gate, so passing pairs cost no readback or encode.
+    // The outcome is reported by FlopSummary::gate_failed. Passing NULL (the
+    // default) disables the gate, and error images are always written.
+    void flop_config_set_gate(FlopGate const* gate);
+
+    // Limit the number of image rows the Vulkan backend evaluates at once.
+    // Taller images are evaluated in horizontal bands, so that device memory
+    // use is bounded by the band height rather than the image height. Results
+    // are identical to evaluating the image at once. If 0 (the default), the
+    // band height is derived from the size of device memory. Does not apply
+    // to images analyzed by the interactive viewer.
+    void flop_config_set_band_rows(int rows);
+
+    // Cache the results of pairs compared from files in a directory, created
+    // if needed, so that comparing a pair again skips decoding and evaluating
+    // it. Results are addressed by a hash of the contents of both files and
+    // of every setting that affects them (exposure, tonemapper, backend,
+    // precision, histogram and gate), and hold the summary and the
+    // configurable histogram, but no timings. If store_error_images is
+    // nonzero, error images are cached too; otherwise pairs with an output
+    // path are only served from the cache if the gate skips their error image.
+    // Passing NULL (the default) disables the cache. Independently of the
+    // cache, pairs of bit-identical files (or pixels, with flop_analyze_pixels)
+    // are resolved as a zero-error summary without any evaluation.
+    void flop_config_set_result_cache(char const* directory,
+                                      int store_error_images);
+
+    // Persist the pipelines compiled by the Vulkan backend in a directory,
+    // created if needed, so that later processes on the same device and
+    // driver version skip compiling them. Must be called before flop_init.
+    // Passing NULL (the default) uses the flop directory of the user cache
+    // directory (e.g. ~/.cache/flop), and an empty string disables it.
+    void flop_config_set_pipeline_cache(char const* directory);
+
     // Prepare the flop runtime for image analysis.
     // Returns 0 on success, 1 on failure.
     int flop_init(uint32_t instanceExtensionCount,
                   char const** requiredInstanceExtensions);
 
+    struct FlopInitSummary
+    {
+        int milliseconds_elapsed;
+        // Wall time spent creating pipelines, which is dominated by their
+        // compilation to device code unless the pipeline cache holds them
+        float pipeline_milliseconds;
+        // Nonzero if cached pipelines were loaded (see
+        // flop_config_set_pipeline_cache)
+        int pipeline_cache_loaded;
+    };
+
+    // Retrieve the timings of flop_init, which are zero before it is called.
+    // No pipelines are created with the CPU backend.
+    void flop_get_init_summary(FlopInitSummary* out_summary);
+
     // Compare the left and right LDR images, and write out a summary of the
     // analysis
     int flop_analyze(char const* image_left_path,
@@ -45,6 +274,110 @@ extern "C"
                          int tonemapper,
                          FlopSummary* out_summary);
 
+    // Create an analysis context, initializing the flop runtime if needed.
+    // Returns NULL on failure.
+    FlopContext* flop_context_create();
+
+    void flop_context_destroy(FlopContext* context);
+
+    // Equivalent to flop_analyze and flop_analyze_hdr, but evaluated with the
+    // resources owned by the supplied context. Passing a NULL context uses the
+    // process-wide default context.
+    int flop_context_analyze(FlopContext* context,
+                             char const* image_left_path,
+                             char const* image_right_path,
+                             char const* output_path,
+                             FlopSummary* out_summary);
+
+    int flop_context_analyze_hdr(FlopContext* context,
+                                 char const* image_left_path,
+                                 char const* image_right_path,
+                                 char const* output_path,
+                                 float exposure,
+                                 // 0: ACES, 1: Reinhard, 2: Hable
+                                 int tonemapper,
+                                 FlopSummary* out_summary);
+
+    // Compare a pair once per viewing condition, each given in pixels per
+    // degree (see flop_config_set_pixels_per_degree), e.g. for a desktop, a
+    // laptop and a TV. The images are decoded, uploaded and converted once,
+    // and only filtered and compared per condition, which is considerably
+    // cheaper than a separate evaluation per condition. One summary per
+    // condition is written to out_summaries (which may be NULL). If
+    // output_paths is not NULL, it holds an optional error image path per
+    // condition. The configurable histogram retrieved afterwards is the one
+    // of the last condition. Results are not stored in the result cache.
+    // Passing a NULL context uses the process-wide default context.
+    int flop_analyze_viewing_conditions(FlopContext* context,
+                                        char const* image_left_path,
+                                        char const* image_right_path,
+                                        float const* pixels_per_degree,
+                                        int condition_count,
+                                        char const* const* output_paths,
+                                        float exposure,
+                                        // 0: ACES, 1: Reinhard, 2: Hable
+                                        int tonemapper,
+                                        FlopSummary* out_summaries);
+
+    // Compare a pair of images already in memory, avoiding the encode and
+    // decode of an intermediate file. Pixels are copied straight from the
+    // supplied buffers to the upload staging buffers, and the buffers may be
+    // reused as soon as the call returns. If out_error_map is not NULL, the
+    // color-mapped error image is written to it as RGBA8 pixels with rows
+    // out_error_map_stride bytes apart (or tightly packed if 0). Exposure and
+    // tonemapper are applied to HDR formats only (see flop_analyze_hdr).
+    // Passing a NULL context uses the process-wide default context.
+    int flop_analyze_pixels(FlopContext* context,
+                            FlopPixels const* reference,
+                            FlopPixels const* test,
+                            float exposure,
+                            int tonemapper,
+                            uint8_t* out_error_map,
+                            int out_error_map_stride,
+                            FlopSummary* out_summary);
+
+    // Retrieve the configurable histogram (see flop_config_set_histogram) of
+    // the last pair evaluated by the context, or by the process-wide default
+    // context if context is NULL. Writes at most capacity buckets (none if
+    // capacity is negative) to each of the non-NULL outputs: the pixel count
+    // of each bucket, the cumulative distribution (the fraction of pixels in
+    // this and all preceding buckets), and the smallest error counted by each
+    // bucket. Returns the bucket count of the histogram, which is zero if it
+    // was disabled.
+    int flop_context_get_histogram(FlopContext* context,
+                                   uint32_t* out_counts,
+                                   float* out_cdf,
+                                   float* out_lower_edges,
+                                   int capacity);
+
+    // Compare a list of pairs, writing one summary per pair to out_summaries
+    // (which may be NULL). Device state and intermediate images are reused
+    // across pairs, and are only reallocated when the image extent changes.
+    // Exposure and tonemapper are applied to HDR inputs only (see
+    // flop_analyze_hdr). A failing pair is reported and skipped (its summary is
+    // zeroed) and the call returns 1 once all pairs have been processed.
+    // Passing a NULL context uses the process-wide default context.
+    int flop_analyze_batch(FlopContext* context,
+                           FlopPair const* pairs,
+                           int pair_count,
+                           float exposure,
+                           int tonemapper,
+                           FlopSummary* out_summaries,
+                           FlopBatchSummary* out_batch_summary);
+
+    // Like flop_analyze_batch, but reads pairs from a manifest file. Each
+    // non-empty line holds a reference path, a test path and an optional output
+    // path separated by tabs. Lines starting with '#' are ignored. At most
+    // summary_capacity summaries are written (none if it is negative);
+    // out_batch_summary->pair_count reports the number of pairs read.
+    int flop_analyze_manifest(FlopContext* context,
+                              char const* manifest_path,
+                              float exposure,
+                              int tonemapper,
+                              FlopSummary* out_summaries,
+                              int summary_capacity,
+                              FlopBatchSummary* out_batch_summary);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
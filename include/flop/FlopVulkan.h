@@ -0,0 +1,91 @@
+#pragma once
+
+// Interop with renderers that already hold the images to compare in Vulkan
+// memory. Requires the Vulkan headers; translation units using volk must
+// include volk.h before this header.
+#include <flop/Flop.h>
+#include <vulkan/vulkan.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Handles of the device used by the Vulkan backend, so that a renderer
+    // may create the images it compares on the same device. Commands that
+    // produce these images must retire before they are compared, e.g. by
+    // submitting them to the graphics queue beforehand, and the graphics queue
+    // must not be submitted to while a comparison is in flight.
+    struct FlopVulkanDevice
+    {
+        VkInstance instance;
+        VkPhysicalDevice physical_device;
+        VkDevice device;
+        // Queue that comparisons are submitted to. Unless the runtime was
+        // initialized with the instance extensions of a presentation engine,
+        // the family only guarantees compute and transfer support.
+        VkQueue graphics_queue;
+        uint32_t graphics_queue_family;
+        // Nonzero if the device can import memory with
+        // VK_KHR_external_memory_fd
+        int external_memory_fd;
+    };
+
+    // Retrieve the device of the Vulkan backend, initializing the flop
+    // runtime if needed. Returns 0 on success, 1 on failure (or if the CPU
+    // backend is in use).
+    int flop_get_vulkan_device(FlopVulkanDevice* out_device);
+
+    // A single-sampled 2D color image, with one mip level and array layer.
+    // sRGB formats with 8-bit channels are evaluated as LDR images, and
+    // 16-bit or 32-bit float formats as linear HDR images.
+    struct FlopVulkanImage
+    {
+        // An image created on the device returned by flop_get_vulkan_device
+        // with sampled usage, or VK_NULL_HANDLE to import memory_fd instead
+        VkImage image;
+
+        // Opaque file descriptor of memory exported by another device or
+        // instance (see VK_KHR_external_memory_fd), bound at offset 0 to an
+        // image created by the exporter with exactly the format, extent and
+        // usage below, optimal tiling and no flags. Ownership of the file
+        // descriptor passes to flop once the image is imported; if the import
+        // fails, flop_get_error reports which image it failed for, and its
+        // descriptor remains owned by the caller.
+        int memory_fd;
+        // Allocation size and memory type index the exporter allocated the
+        // memory with, both of which the import must repeat. Required when
+        // importing memory_fd.
+        VkDeviceSize memory_size;
+        uint32_t memory_type_index;
+        VkImageUsageFlags usage;
+        // Nonzero if the memory is a dedicated allocation of the image
+        int dedicated;
+
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+
+        // Layout of the image when the comparison is submitted. Shared images
+        // are returned to this layout once the comparison retires; imported
+        // images are released to VK_QUEUE_FAMILY_EXTERNAL in this layout.
+        VkImageLayout layout;
+    };
+
+    // Compare a pair of images in Vulkan memory without a host round-trip.
+    // The images are bound to the bindless descriptor set of the Vulkan
+    // backend for the duration of the call and read in place. Only the
+    // summary (and the configurable histogram) is read back; no error image
+    // is produced. Exposure and tonemapper are applied to HDR formats only
+    // (see flop_analyze_hdr). Passing a NULL context uses the process-wide
+    // default context.
+    int flop_analyze_vulkan_images(FlopContext* context,
+                                   FlopVulkanImage const* reference,
+                                   FlopVulkanImage const* test,
+                                   float exposure,
+                                   int tonemapper,
+                                   FlopSummary* out_summary);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
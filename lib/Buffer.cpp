@@ -1,10 +1,78 @@
 #include "Buffer.hpp"
 
+#include <vector>
+
 using namespace flop;
 
 uint32_t s_buffer_count;
+static std::vector<uint32_t> s_free_indices;
+
+// Must be called with g_descriptor_mutex held
+static uint32_t acquire_index()
+{
+    if (s_free_indices.empty())
+    {
+        return s_buffer_count++;
+    }
+    uint32_t index = s_free_indices.back();
+    s_free_indices.pop_back();
+    return index;
+}
+
+void UploadBatch::begin()
+{
+    VkFenceCreateInfo fence_info{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    vkCreateFence(g_device, &fence_info, nullptr, &fence_);
+
+    cb_ = g_command_buffers[0];
+    VkCommandBufferBeginInfo begin{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(cb_, &begin);
+}
+
+void UploadBatch::submit()
+{
+    // Make the copies visible to the kernels of later submissions
+    VkMemoryBarrier barrier{
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cb_,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,
+                         1,
+                         &barrier,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr);
+    vkEndCommandBuffer(cb_);
+    submit_and_wait(cb_, fence_);
+    vkDestroyFence(g_device, fence_, nullptr);
+
+    for (Staging const& staging : staging_)
+    {
+        vmaUnmapMemory(g_allocator, staging.allocation_);
+        vmaDestroyBuffer(g_allocator, staging.buffer_, staging.allocation_);
+    }
+    staging_.clear();
+    cb_    = VK_NULL_HANDLE;
+    fence_ = VK_NULL_HANDLE;
+}
 
 Buffer Buffer::create(void const* data, uint32_t size)
+{
+    UploadBatch batch;
+    batch.begin();
+    Buffer buffer = create(data, size, batch);
+    batch.submit();
+    return buffer;
+}
+
+Buffer Buffer::create(void const* data, uint32_t size, UploadBatch& batch)
 {
     Buffer buffer;
     buffer.size_ = size;
@@ -19,18 +87,18 @@ Buffer Buffer::create(void const* data, uint32_t size)
         .pQueueFamilyIndices   = &g_graphics_queue_index,
     };
 
-    VkBuffer staging;
-    VmaAllocation staging_allocation;
+    UploadBatch::Staging staging;
     VmaAllocationCreateInfo allocation_info{.usage = VMA_MEMORY_USAGE_CPU_TO_GPU};
     vmaCreateBuffer(g_allocator,
                     &buffer_info,
                     &allocation_info,
-                    &staging,
-                    &staging_allocation,
+                    &staging.buffer_,
+                    &staging.allocation_,
                     nullptr);
     void* dst;
-    vmaMapMemory(g_allocator, staging_allocation, &dst);
+    vmaMapMemory(g_allocator, staging.allocation_, &dst);
     std::memcpy(dst, data, size);
+    batch.staging_.push_back(staging);
 
     allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
     buffer_info.usage
@@ -42,30 +110,11 @@ Buffer Buffer::create(void const* data, uint32_t size)
                     &buffer.allocation_,
                     nullptr);
 
-    VkCommandBuffer cb = g_command_buffers[0];
-    VkCommandBufferBeginInfo begin{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
-    vkBeginCommandBuffer(cb, &begin);
-
     VkBufferCopy copy{.srcOffset = 0, .dstOffset = 0, .size = size};
-    vkCmdCopyBuffer(cb, staging, buffer.buffer_, 1, &copy);
-
-    vkEndCommandBuffer(cb);
-    VkSubmitInfo submit{
-        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount   = 0,
-        .commandBufferCount   = 1,
-        .pCommandBuffers      = &cb,
-        .signalSemaphoreCount = 0,
-    };
-    vkQueueSubmit(g_graphics_queue, 1, &submit, VK_NULL_HANDLE);
-    vkQueueWaitIdle(g_graphics_queue);
-
-    vmaUnmapMemory(g_allocator, staging_allocation);
-    vmaDestroyBuffer(g_allocator, staging, staging_allocation);
+    vkCmdCopyBuffer(batch.cb_, staging.buffer_, buffer.buffer_, 1, &copy);
 
-    buffer.index_ = s_buffer_count++;
+    std::lock_guard lock{g_descriptor_mutex};
+    buffer.index_ = acquire_index();
 
     VkDescriptorBufferInfo descriptor_info{
         .buffer = buffer.buffer_, .offset = 0, .range = size};
@@ -82,7 +131,8 @@ Buffer Buffer::create(void const* data, uint32_t size)
     return buffer;
 }
 
-Buffer Buffer::create(uint32_t size)
+// Allocates a storage buffer and binds it to the bindless descriptor set
+static Buffer create_storage(uint32_t size, VmaMemoryUsage usage)
 {
     Buffer buffer;
     buffer.size_ = size;
@@ -90,13 +140,14 @@ Buffer Buffer::create(uint32_t size)
     VkBufferCreateInfo buffer_info{
         .sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .size                  = size,
-        .usage                 = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                 | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         .sharingMode           = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 1,
         .pQueueFamilyIndices   = &g_graphics_queue_index,
     };
 
-    VmaAllocationCreateInfo allocation_info{.usage = VMA_MEMORY_USAGE_GPU_TO_CPU};
+    VmaAllocationCreateInfo allocation_info{.usage = usage};
     vmaCreateBuffer(g_allocator,
                     &buffer_info,
                     &allocation_info,
@@ -104,9 +155,8 @@ Buffer Buffer::create(uint32_t size)
                     &buffer.allocation_,
                     nullptr);
 
-    vmaMapMemory(g_allocator, buffer.allocation_, &buffer.data_);
-
-    buffer.index_ = s_buffer_count++;
+    std::lock_guard lock{g_descriptor_mutex};
+    buffer.index_ = acquire_index();
 
     VkDescriptorBufferInfo descriptor_info{
         .buffer = buffer.buffer_, .offset = 0, .range = size};
@@ -122,3 +172,33 @@ Buffer Buffer::create(uint32_t size)
 
     return buffer;
 }
+
+Buffer Buffer::create(uint32_t size)
+{
+    Buffer buffer = create_storage(size, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    vmaMapMemory(g_allocator, buffer.allocation_, &buffer.data_);
+    return buffer;
+}
+
+Buffer Buffer::create_scratch(uint32_t size)
+{
+    return create_storage(size, VMA_MEMORY_USAGE_GPU_ONLY);
+}
+
+void Buffer::reset()
+{
+    if (allocation_ != VK_NULL_HANDLE)
+    {
+        if (data_)
+        {
+            vmaUnmapMemory(g_allocator, allocation_);
+            data_ = nullptr;
+        }
+        vmaDestroyBuffer(g_allocator, buffer_, allocation_);
+        buffer_     = VK_NULL_HANDLE;
+        allocation_ = VK_NULL_HANDLE;
+
+        std::lock_guard lock{g_descriptor_mutex};
+        s_free_indices.push_back(index_);
+    }
+}
@@ -2,15 +2,51 @@
 
 #include "VkGlobals.hpp"
 
+// Records the uploads of several buffers (see Buffer::create) into a single
+// command buffer, which is submitted once with a single fence
+class UploadBatch
+{
+public:
+    // Begins recording into g_command_buffers[0]
+    void begin();
+
+    // Submits the recorded uploads and blocks until they retire, then frees
+    // their staging memory. Uploaded buffers may be read by any subsequent
+    // submission.
+    void submit();
+
+private:
+    friend class Buffer;
+
+    struct Staging
+    {
+        VkBuffer buffer_;
+        VmaAllocation allocation_;
+    };
+    std::vector<Staging> staging_;
+    VkCommandBuffer cb_ = VK_NULL_HANDLE;
+    VkFence fence_      = VK_NULL_HANDLE;
+};
+
 class Buffer
 {
 public:
     // Create a device local buffer and copy supplied data via staging memory
     static Buffer create(void const* data, uint32_t size);
 
+    // Create a device local buffer whose copy from staging memory is recorded
+    // into batch. The buffer may only be used once the batch is submitted.
+    static Buffer create(void const* data, uint32_t size, UploadBatch& batch);
+
     // Create a writable readback buffer
     static Buffer create(uint32_t size);
 
+    // Create a device local buffer that is only accessed by kernels (and
+    // transfer commands that clear it). Its initial contents are undefined.
+    static Buffer create_scratch(uint32_t size);
+
+    void reset();
+
     VkBuffer buffer_          = VK_NULL_HANDLE;
     VmaAllocation allocation_ = VK_NULL_HANDLE;
 
@@ -454,16 +454,20 @@ static float const s_viridis_data[]
        0.964894, 0.902323, 0.123941, 0.974417, 0.903590, 0.130215, 0.983868,
        0.904867, 0.136897, 0.993248, 0.906157, 0.143936};
 
-void upload_color_maps()
+void upload_color_maps(UploadBatch& batch)
 {
-    s_magma = Buffer::create(
-        reinterpret_cast<void const*>(s_magma_data), sizeof(s_magma_data));
-    s_inferno = Buffer::create(
-        reinterpret_cast<void const*>(s_inferno_data), sizeof(s_inferno_data));
-    s_plasma = Buffer::create(
-        reinterpret_cast<void const*>(s_plasma_data), sizeof(s_plasma_data));
-    s_viridis = Buffer::create(
-        reinterpret_cast<void const*>(s_viridis_data), sizeof(s_viridis_data));
+    s_magma   = Buffer::create(reinterpret_cast<void const*>(s_magma_data),
+                             sizeof(s_magma_data),
+                             batch);
+    s_inferno = Buffer::create(reinterpret_cast<void const*>(s_inferno_data),
+                               sizeof(s_inferno_data),
+                               batch);
+    s_plasma  = Buffer::create(reinterpret_cast<void const*>(s_plasma_data),
+                              sizeof(s_plasma_data),
+                              batch);
+    s_viridis = Buffer::create(reinterpret_cast<void const*>(s_viridis_data),
+                               sizeof(s_viridis_data),
+                               batch);
 }
 
 Buffer& get_color_map(ColorMap color_map)
@@ -484,3 +488,22 @@ Buffer& get_color_map(ColorMap color_map)
     }
     return s_viridis;
 }
+
+float const* get_color_map_data(ColorMap color_map)
+{
+    switch (color_map)
+    {
+        using enum ColorMap;
+    case Magma:
+        return s_magma_data;
+    case Inferno:
+        return s_inferno_data;
+    case Plasma:
+        return s_plasma_data;
+    case Viridis:
+        return s_viridis_data;
+    default:
+        break;
+    }
+    return s_viridis_data;
+}
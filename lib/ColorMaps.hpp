@@ -8,7 +8,13 @@ enum class ColorMap
     Plasma,
 };
 
-void upload_color_maps();
-
 class Buffer;
+class UploadBatch;
+
+// Records the uploads of every color map into batch
+void upload_color_maps(UploadBatch& batch);
+
 Buffer& get_color_map(ColorMap color_map);
+
+// Host copy of a color map: 256 tightly packed RGB triples
+float const* get_color_map_data(ColorMap color_map);
@@ -0,0 +1,621 @@
+#include "Cpu.hpp"
+
+#include "ColorMaps.hpp"
+#include "CpuFilter.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+extern "C"
+{
+    int stbi_write_png(char const* filename,
+                       int w,
+                       int h,
+                       int comp,
+                       const void* data,
+                       int stride_in_bytes);
+}
+
+namespace flop::cpu
+{
+// Number of rows handed to a worker at a time
+constexpr static int s_row_grain = 8;
+
+enum Plane
+{
+    CsfX,
+    CsfY,
+    CsfZ1,
+    CsfZ2,
+    Moment0,
+    Moment1,
+    Moment2,
+    PlaneCount,
+};
+
+static ThreadPool& thread_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+static float srgb_to_linear(float v)
+{
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+// Matches the hardware conversion performed when sampling an sRGB texture
+static float const* srgb_table()
+{
+    static float const* table = [] {
+        static float values[256];
+        for (int i = 0; i != 256; ++i)
+        {
+            values[i] = srgb_to_linear(i / 255.f);
+        }
+        return values;
+    }();
+    return table;
+}
+
+static float saturate(float v)
+{
+    return std::min(std::max(v, 0.f), 1.f);
+}
+
+// Tonemapping operators from Common.hlsli
+static void tonemap_rgb(float* rgb, int tonemap, float exposure)
+{
+    static float const aces[] = {0.6f * 0.6f * 2.51f,
+                                 0.6f * 0.03f,
+                                 0.6f * 0.6f * 2.43f,
+                                 0.6f * 0.59f,
+                                 0.14f};
+    static float const hable[] = {0.231683f, 0.013791f, 0.18f, 0.3f, 0.018f};
+
+    float c[3] = {exposure * rgb[0], exposure * rgb[1], exposure * rgb[2]};
+    if (tonemap == 2)
+    {
+        float lum = 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+        for (int i = 0; i != 3; ++i)
+        {
+            rgb[i] = saturate(c[i] / (1.f + lum));
+        }
+        return;
+    }
+
+    float const* k = tonemap == 1 ? aces : hable;
+    for (int i = 0; i != 3; ++i)
+    {
+        rgb[i] = saturate(((c[i] * c[i]) * k[0] + c[i] * k[1])
+                          / (c[i] * c[i] * k[2] + c[i] * k[3] + k[4]));
+    }
+}
+
+// Converts an IEEE 754 half-precision float, as sampled from an RGBA16F image
+static float half_to_float(uint16_t half)
+{
+    uint32_t sign     = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    float magnitude;
+    if (exponent == 0)
+    {
+        // Zero or subnormal
+        magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+    }
+    else if (exponent == 0x1f)
+    {
+        magnitude = mantissa == 0 ? INFINITY : NAN;
+    }
+    else
+    {
+        magnitude = std::ldexp(static_cast<float>(mantissa | 0x400),
+                               static_cast<int>(exponent) - 25);
+    }
+
+    uint32_t bits;
+    std::memcpy(&bits, &magnitude, sizeof(bits));
+    bits |= sign;
+    std::memcpy(&magnitude, &bits, sizeof(bits));
+    return magnitude;
+}
+
+// Converts a row of the source image to YyCxCz (YyCxCz.hlsl), and also
+// produces the normalized luminance consumed by the feature filter
+static void convert_row(ImageData const& image,
+                        int y,
+                        int tonemap,
+                        float exposure,
+                        float* Yy,
+                        float* Cx,
+                        float* Cz,
+                        float* luminance)
+{
+    float const* table = srgb_table();
+    bool handle_alpha  = image.channels_ == 4;
+    uint8_t const* row = static_cast<uint8_t const*>(image.data_)
+                         + static_cast<size_t>(y) * image.row_pitch();
+
+    for (int x = 0; x != image.width_; ++x)
+    {
+        float rgba[4];
+        if (image.hdr_ && image.half_)
+        {
+            uint16_t data[4];
+            std::memcpy(data, row + static_cast<size_t>(x) * 8, sizeof(data));
+            for (int c = 0; c != 4; ++c)
+            {
+                rgba[c] = half_to_float(data[c]);
+            }
+        }
+        else if (image.hdr_)
+        {
+            std::memcpy(rgba, row + static_cast<size_t>(x) * 16, sizeof(rgba));
+        }
+        else
+        {
+            uint8_t const* data = row + static_cast<size_t>(x) * 4;
+            rgba[0]             = table[data[0]];
+            rgba[1]             = table[data[1]];
+            rgba[2]             = table[data[2]];
+            rgba[3]             = data[3] / 255.f;
+        }
+
+        if (tonemap != 0)
+        {
+            tonemap_rgb(rgba, tonemap, exposure);
+        }
+
+        // rgb_to_linearized_Lab
+        float X = (0.4124564f * rgba[0] + 0.3575761f * rgba[1]
+                   + 0.1804375f * rgba[2])
+                  / 0.950489f;
+        float Y = 0.2126729f * rgba[0] + 0.7151522f * rgba[1]
+                  + 0.0721750f * rgba[2];
+        float Z = (0.0193339f * rgba[0] + 0.1191920f * rgba[1]
+                   + 0.9503041f * rgba[2])
+                  / 1.088840f;
+
+        Yy[x] = 116.f * Y - 16.f;
+        Cx[x] = 500.f * (X - Y);
+        Cz[x] = 200.f * (Y - Z);
+
+        if (handle_alpha)
+        {
+            Yy[x] *= rgba[3];
+        }
+
+        luminance[x] = Yy[x] * (1.f / 116.f) + 16.f / 116.f;
+    }
+}
+
+static float CIELAB_f(float v)
+{
+    constexpr float delta  = 0.2068966f;
+    constexpr float delta3 = delta * delta * delta;
+    if (v > delta3)
+    {
+        return std::pow(v, 0.3333333f);
+    }
+    return v / (3.f * delta * delta) + 0.1379310f;
+}
+
+// Converts the CSF-filtered YyCxCz channels to Hunt-adjusted CIELAB, per
+// the y pass of Filter.hlsl
+static void filtered_to_Lab(float const* csf, float* Lab)
+{
+    float Yy = csf[0];
+    float Cx = csf[1];
+    float Cz = csf[2] + csf[3];
+
+    float y = (Yy + 16.f) / 116.f;
+    float x = (y + Cx / 500.f) * 0.950489f;
+    float z = (y - Cz / 200.f) * 1.088840f;
+
+    // xyz_to_CIELAB does not renormalize by the illuminant
+    float f_y = CIELAB_f(y);
+    Lab[0]    = 116.f * f_y - 16.f;
+    Lab[1]    = 500.f * (CIELAB_f(x) - f_y);
+    Lab[2]    = 200.f * (f_y - CIELAB_f(z));
+
+    float scale = 0.01f * Lab[0];
+    Lab[1] *= scale;
+    Lab[2] *= scale;
+}
+
+static float remap_HyAB_error(float error)
+{
+    constexpr float max_HyAB_error = 41.2760963f;
+    constexpr float cutoff         = 0.4f * max_HyAB_error;
+    constexpr float bias           = 0.95f;
+
+    error = std::pow(error, 0.7f);
+    if (error < cutoff)
+    {
+        return error * (bias / cutoff);
+    }
+    return 0.05f * (error - cutoff) / (max_HyAB_error - cutoff) + bias;
+}
+
+void evaluate(ImageData const& reference,
+              ImageData const& test,
+              float exposure,
+              int tonemap,
+              FilterKernels const& kernels,
+              Workspace& workspace,
+              uint32_t* histogram)
+{
+    int const width  = reference.width_;
+    int const height = reference.height_;
+    size_t const plane_size = static_cast<size_t>(width) * height;
+
+    // The CSF and feature filters reproduce the shaders tap for tap,
+    // including which weight is applied at the center of each channel
+    int const radius       = kernels.radius_;
+    int const inner_radius = kernels.inner_radius_;
+    Taps const csf_x{kernels.sx_[0], kernels.sy_, inner_radius, false};
+    Taps const csf_y{kernels.sy_[0], kernels.sx_, inner_radius, false};
+    Taps const csf_z1{kernels.sz1_[0], kernels.sz1_, radius, false};
+    Taps const csf_z2{kernels.sz2_[0], kernels.sz2_, radius, false};
+    Taps const gaussian{kernels.gaussian_[0], kernels.gaussian_, radius, false};
+    Taps const edge{0.f, kernels.edge_, radius, true};
+    Taps const point{kernels.gaussian_[2], kernels.point_, radius, false};
+    Taps const edge_y{kernels.gaussian_[1], kernels.edge_, radius, true};
+
+    if (workspace.width_ != width || workspace.height_ != height)
+    {
+        workspace.width_  = width;
+        workspace.height_ = height;
+        workspace.planes_.resize(plane_size * PlaneCount * 2);
+        workspace.error_.resize(plane_size);
+    }
+
+    // Exposure and tonemapping are driven by the reference image, as in the
+    // GPU path
+    float exposure_scale = 1.f;
+    if (reference.hdr_)
+    {
+        exposure_scale = std::pow(2.f, exposure);
+    }
+    else
+    {
+        tonemap = 0;
+    }
+
+    ImageData const* images[2] = {&reference, &test};
+    auto plane = [&](int image, int index, int y) {
+        return workspace.planes_.data()
+               + (image * PlaneCount + index) * plane_size
+               + static_cast<size_t>(y) * width;
+    };
+
+    // Convert each row to YyCxCz and apply the horizontal CSF and feature
+    // filters
+    thread_pool().parallel_for(height, s_row_grain, [&](int begin, int end) {
+        std::vector<float> scratch(static_cast<size_t>(width) * 4);
+        float* Yy        = scratch.data();
+        float* Cx        = Yy + width;
+        float* Cz        = Cx + width;
+        float* luminance = Cz + width;
+
+        for (int y = begin; y != end; ++y)
+        {
+            for (int i = 0; i != 2; ++i)
+            {
+                convert_row(*images[i],
+                            y,
+                            tonemap,
+                            exposure_scale,
+                            Yy,
+                            Cx,
+                            Cz,
+                            luminance);
+
+                // The x pass reads .rgbb, so both z channels blur Cz
+                filter_row(Yy, Yy, plane(i, CsfX, y), width, csf_x);
+                filter_row(Cx, Cx, plane(i, CsfY, y), width, csf_y);
+                filter_row(Cz, Cz, plane(i, CsfZ1, y), width, csf_z1);
+                filter_row(Cz, Cz, plane(i, CsfZ2, y), width, csf_z2);
+
+                filter_row(luminance,
+                           luminance,
+                           plane(i, Moment0, y),
+                           width,
+                           gaussian);
+                filter_row(
+                    luminance, luminance, plane(i, Moment1, y), width, edge);
+                filter_row(
+                    luminance, luminance, plane(i, Moment2, y), width, point);
+            }
+        }
+    });
+
+    std::fill(histogram, histogram + 32, 0u);
+    std::mutex histogram_mutex;
+
+    // Apply the vertical filters, then compare colors and features per pixel
+    thread_pool().parallel_for(height, s_row_grain, [&](int begin, int end) {
+        // Per image: four CSF channels, then x and y edge and point responses
+        std::vector<float> scratch(static_cast<size_t>(width) * 16);
+        uint32_t local_histogram[32] = {};
+
+        float const* rows[2][PlaneCount][2 * s_max_filter_radius - 1];
+
+        for (int y = begin; y != end; ++y)
+        {
+            for (int i = 0; i != 2; ++i)
+            {
+                for (int p = 0; p != PlaneCount; ++p)
+                {
+                    for (int j = 0; j != 2 * radius - 1; ++j)
+                    {
+                        int row
+                            = std::clamp(y + j - (radius - 1), 0, height - 1);
+                        rows[i][p][j] = plane(i, p, row);
+                    }
+                }
+
+                float* out = scratch.data() + i * 8 * width;
+                int const inner_offset = radius - inner_radius;
+
+                filter_column(plane(i, CsfX, y),
+                              rows[i][CsfX] + inner_offset,
+                              out,
+                              width,
+                              csf_x);
+                filter_column(plane(i, CsfY, y),
+                              rows[i][CsfY] + inner_offset,
+                              out + width,
+                              width,
+                              csf_y);
+                filter_column(plane(i, CsfZ1, y),
+                              rows[i][CsfZ1],
+                              out + 2 * width,
+                              width,
+                              csf_z1);
+                // The y pass reads .z for both z channel neighborhoods, so
+                // only the center tap of the second channel is its own
+                filter_column(plane(i, CsfZ2, y),
+                              rows[i][CsfZ1],
+                              out + 3 * width,
+                              width,
+                              csf_z2);
+
+                // x derivatives blurred in y, then y derivatives of the
+                // blurred luminance
+                filter_column(plane(i, Moment1, y),
+                              rows[i][Moment1],
+                              out + 4 * width,
+                              width,
+                              gaussian);
+                filter_column(plane(i, Moment2, y),
+                              rows[i][Moment2],
+                              out + 5 * width,
+                              width,
+                              gaussian);
+                filter_column(plane(i, Moment0, y),
+                              rows[i][Moment0],
+                              out + 6 * width,
+                              width,
+                              edge_y);
+                filter_column(plane(i, Moment0, y),
+                              rows[i][Moment0],
+                              out + 7 * width,
+                              width,
+                              point);
+            }
+
+            float* error
+                = workspace.error_.data() + static_cast<size_t>(y) * width;
+            for (int x = 0; x != width; ++x)
+            {
+                float Lab[2][3];
+                float features[2][2];
+                for (int i = 0; i != 2; ++i)
+                {
+                    float const* out = scratch.data() + i * 8 * width + x;
+                    float csf[4]
+                        = {out[0], out[width], out[2 * width], out[3 * width]};
+                    filtered_to_Lab(csf, Lab[i]);
+
+                    float edge_x  = out[4 * width];
+                    float point_x = out[5 * width];
+                    float edge_y  = out[6 * width];
+                    float point_y = out[7 * width];
+                    features[i][0]
+                        = std::sqrt(edge_x * edge_x + edge_y * edge_y);
+                    features[i][1]
+                        = std::sqrt(point_x * point_x + point_y * point_y);
+                }
+
+                // HyAB distance
+                float a_delta     = Lab[0][1] - Lab[1][1];
+                float b_delta     = Lab[0][2] - Lab[1][2];
+                float color_error = remap_HyAB_error(
+                    std::abs(Lab[0][0] - Lab[1][0])
+                    + std::sqrt(a_delta * a_delta + b_delta * b_delta));
+
+                float feature_delta
+                    = std::max(std::abs(features[1][0] - features[0][0]),
+                               std::abs(features[1][1] - features[0][1]));
+                float feature_error
+                    = std::pow(feature_delta / std::sqrt(2.f), 0.5f);
+
+                float flip_error = std::pow(color_error, 1.f - feature_error);
+                error[x]         = flip_error;
+
+                // Histogram accumulated by Filter.hlsl
+                float clamped
+                    = flip_error > 0.f ? std::min(flip_error, 1.f) : 0.f;
+                ++local_histogram[static_cast<int>(clamped * 31.f)];
+            }
+        }
+
+        std::lock_guard lock{histogram_mutex};
+        for (int i = 0; i != 32; ++i)
+        {
+            histogram[i] += local_histogram[i];
+        }
+    });
+}
+
+// Bin count of Statistics.hlsli
+constexpr static int s_statistics_bin_count = 1024;
+
+// Returns the error at which the cumulative weight of the bins reaches target,
+// assuming errors are uniformly distributed within each bin
+static float resolve(double const* weights, double target)
+{
+    double before = 0.0;
+    for (int i = 0; i != s_statistics_bin_count; ++i)
+    {
+        double after = before + weights[i];
+        if (before < target && target <= after)
+        {
+            double fraction = (target - before) / weights[i];
+            return static_cast<float>((i + fraction) / s_statistics_bin_count);
+        }
+        before = after;
+    }
+    return 0.f;
+}
+
+// exceeds in Statistics.hlsl
+static bool exceeds(float error, float threshold)
+{
+    return threshold >= 0.f && error > threshold;
+}
+
+// histogram_bucket in Statistics.hlsli
+static int
+histogram_bucket(float error, int bucket_count, FlopHistogramScale scale)
+{
+    float position = error;
+    if (scale == FLOP_HISTOGRAM_LOG)
+    {
+        position = std::max(
+            std::log2(std::max(error, 1e-30f)) / 16.f + 1.f, 0.f);
+    }
+    return std::min(static_cast<int>(position * bucket_count),
+                    bucket_count - 1);
+}
+
+void resolve_statistics(Workspace const& workspace,
+                        int32_t histogram_buckets,
+                        FlopHistogramScale histogram_scale,
+                        FlopGate const& gate,
+                        FlopSummary& summary,
+                        std::vector<uint32_t>& histogram_counts,
+                        std::vector<float>& histogram_cdf)
+{
+    std::vector<double> counts(s_statistics_bin_count);
+    std::vector<double> weights(s_statistics_bin_count);
+    histogram_counts.assign(histogram_buckets, 0u);
+    double sum = 0.0;
+    float max  = 0.f;
+    for (float error : workspace.error_)
+    {
+        float clamped = error > 0.f ? std::min(error, 1.f) : 0.f;
+        int bin       = std::min(
+            static_cast<int>(clamped * s_statistics_bin_count),
+            s_statistics_bin_count - 1);
+        counts[bin] += 1.0;
+        sum += clamped;
+        max = std::max(max, clamped);
+
+        if (histogram_buckets != 0)
+        {
+            ++histogram_counts[histogram_bucket(
+                clamped, histogram_buckets, histogram_scale)];
+        }
+    }
+
+    histogram_cdf.resize(histogram_buckets);
+    uint64_t cumulative = 0;
+    for (int i = 0; i != histogram_buckets; ++i)
+    {
+        cumulative += histogram_counts[i];
+        histogram_cdf[i]
+            = workspace.error_.empty()
+                  ? 0.f
+                  : static_cast<float>(cumulative) / workspace.error_.size();
+    }
+
+    double total_weight = 0.0;
+    for (int i = 0; i != s_statistics_bin_count; ++i)
+    {
+        weights[i] = counts[i] * (i + 0.5) / s_statistics_bin_count;
+        total_weight += weights[i];
+    }
+
+    double count = static_cast<double>(workspace.error_.size());
+    summary.mean_error
+        = count == 0.0 ? 0.f : static_cast<float>(sum / count);
+    summary.max_error = max;
+    summary.weighted_median_error
+        = resolve(weights.data(), 0.5 * total_weight);
+    summary.p50_error = resolve(counts.data(), 0.5 * count);
+    summary.p95_error = resolve(counts.data(), 0.95 * count);
+    summary.p99_error = resolve(counts.data(), 0.99 * count);
+
+    float percentile_error = resolve(counts.data(), gate.percentile * count);
+    summary.gate_failed    = exceeds(summary.mean_error, gate.mean_error)
+                          || exceeds(percentile_error, gate.percentile_error)
+                          || exceeds(summary.max_error, gate.max_error);
+}
+
+// ErrorColorMap.hlsl, followed by the UNORM conversion of the output image
+static void map_pixel(float error, float const* color_map, uint8_t* out)
+{
+    float u        = error * 255.f + 0.5f;
+    float floor_u  = std::floor(u);
+    int left_index = static_cast<int>(std::clamp(floor_u, 0.f, 255.f));
+    int right_index
+        = std::clamp(static_cast<int>(std::ceil(u)), left_index, 255);
+    float t = u - floor_u;
+
+    for (int c = 0; c != 3; ++c)
+    {
+        float left  = color_map[left_index * 3 + c];
+        float right = color_map[right_index * 3 + c];
+        float value = left + (right - left) * t;
+        out[c]      = static_cast<uint8_t>(saturate(value) * 255.f + 0.5f);
+    }
+    out[3] = 255;
+}
+
+void map_error(Workspace const& workspace, uint8_t* pixels, size_t stride)
+{
+    int const width        = workspace.width_;
+    int const height       = workspace.height_;
+    float const* color_map = get_color_map_data(ColorMap::Magma);
+
+    thread_pool().parallel_for(height, s_row_grain, [&](int begin, int end) {
+        for (int y = begin; y != end; ++y)
+        {
+            float const* error = workspace.error_.data()
+                                 + static_cast<size_t>(y) * width;
+            uint8_t* row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x != width; ++x)
+            {
+                map_pixel(error[x], color_map, row + x * 4);
+            }
+        }
+    });
+}
+
+void write_error_map(Workspace const& workspace, char const* path)
+{
+    int const width  = workspace.width_;
+    int const height = workspace.height_;
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    map_error(workspace, pixels.data(), static_cast<size_t>(width) * 4);
+    stbi_write_png(path, width, height, 4, pixels.data(), width * 4);
+}
+} // namespace flop::cpu
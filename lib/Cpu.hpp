@@ -0,0 +1,60 @@
+#pragma once
+
+#include "FilterKernels.hpp"
+#include "Image.hpp"
+
+#include <flop/Flop.h>
+
+#include <cstdint>
+#include <vector>
+
+// CPU implementation of the analysis pipeline, used when no Vulkan device is
+// available (or when requested explicitly). Each stage mirrors its compute
+// shader, including the exact filter weights (see FilterKernels.hpp), so
+// results track the GPU path up to floating point rounding.
+namespace flop::cpu
+{
+// Host storage retained between evaluations of the same extent
+struct Workspace
+{
+    int32_t width_  = 0;
+    int32_t height_ = 0;
+
+    // Per image, the four CSF channels filtered in x followed by the three
+    // feature moments filtered in x (see Filter.hlsl)
+    std::vector<float> planes_;
+
+    // Final FLIP error, one float per pixel
+    std::vector<float> error_;
+};
+
+// Evaluates a pair of decoded images with matching extents, writing the error
+// map to workspace.error_ and its 32-bucket histogram to histogram. The CSF
+// and feature filters apply kernels.
+void evaluate(ImageData const& reference,
+              ImageData const& test,
+              float exposure,
+              int tonemap,
+              FilterKernels const& kernels,
+              Workspace& workspace,
+              uint32_t* histogram);
+
+// Resolves the error statistics of the last evaluation into summary, and
+// checks them against the gate, as Statistics.hlsl does. If histogram_buckets
+// is nonzero, the configurable histogram and its cumulative distribution are
+// written to histogram_counts and histogram_cdf.
+void resolve_statistics(Workspace const& workspace,
+                        int32_t histogram_buckets,
+                        FlopHistogramScale histogram_scale,
+                        FlopGate const& gate,
+                        FlopSummary& summary,
+                        std::vector<uint32_t>& histogram_counts,
+                        std::vector<float>& histogram_cdf);
+
+// Color maps the error in workspace to RGBA8 pixels, with rows stride bytes
+// apart
+void map_error(Workspace const& workspace, uint8_t* pixels, size_t stride);
+
+// Color maps the error in workspace and writes it as a PNG
+void write_error_map(Workspace const& workspace, char const* path);
+} // namespace flop::cpu
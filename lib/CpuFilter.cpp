@@ -0,0 +1,268 @@
+#include "CpuFilter.hpp"
+
+#include <algorithm>
+
+// AVX2 kernels are compiled for every x64 build and selected at runtime, so
+// the library still runs on hosts without AVX2. NEON is baseline on AArch64.
+#if defined(__x86_64__) || defined(_M_X64)
+#    define FLOP_CPU_AVX2
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#        include <intrin.h>
+#        define FLOP_TARGET_AVX2
+#    else
+#        define FLOP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#    endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#    define FLOP_CPU_NEON
+#    include <arm_neon.h>
+#endif
+
+namespace flop::cpu
+{
+using RowFn    = void (*)(float const*, float const*, float*, int, Taps const&);
+using ColumnFn = void (*)(float const*,
+                          float const* const*,
+                          float*,
+                          int,
+                          Taps const&);
+
+static void filter_row_range(float const* center,
+                             float const* in,
+                             float* out,
+                             int begin,
+                             int end,
+                             int width,
+                             Taps const& taps)
+{
+    for (int x = begin; x < end; ++x)
+    {
+        float acc = center[x] * taps.center;
+        for (int i = 1; i != taps.radius; ++i)
+        {
+            float left  = in[std::max(x - i, 0)];
+            float right = in[std::min(x + i, width - 1)];
+            acc += taps.weights[i] * (taps.odd ? right - left : left + right);
+        }
+        out[x] = acc;
+    }
+}
+
+static void filter_column_range(float const* center,
+                                float const* const* rows,
+                                float* out,
+                                int begin,
+                                int end,
+                                Taps const& taps)
+{
+    int const mid = taps.radius - 1;
+    for (int x = begin; x < end; ++x)
+    {
+        float acc = center[x] * taps.center;
+        for (int i = 1; i != taps.radius; ++i)
+        {
+            float left  = rows[mid - i][x];
+            float right = rows[mid + i][x];
+            acc += taps.weights[i] * (taps.odd ? right - left : left + right);
+        }
+        out[x] = acc;
+    }
+}
+
+[[maybe_unused]] static void filter_row_scalar(float const* center,
+                                               float const* in,
+                                               float* out,
+                                               int width,
+                                               Taps const& taps)
+{
+    filter_row_range(center, in, out, 0, width, width, taps);
+}
+
+[[maybe_unused]] static void
+filter_column_scalar(float const* center,
+                     float const* const* rows,
+                     float* out,
+                     int width,
+                     Taps const& taps)
+{
+    filter_column_range(center, rows, out, 0, width, taps);
+}
+
+#ifdef FLOP_CPU_AVX2
+static bool has_avx2()
+{
+#    if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool fma     = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx     = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#    else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#    endif
+}
+
+FLOP_TARGET_AVX2 static void filter_row_avx2(float const* center,
+                                             float const* in,
+                                             float* out,
+                                             int width,
+                                             Taps const& taps)
+{
+    // Lanes whose taps all fall inside the row are vectorized; the clamped
+    // borders are handled by the scalar path
+    int const reach = taps.radius - 1;
+    int x           = reach;
+    for (; x + reach + 8 <= width; x += 8)
+    {
+        __m256 acc = _mm256_mul_ps(_mm256_loadu_ps(center + x),
+                                   _mm256_set1_ps(taps.center));
+        for (int i = 1; i != taps.radius; ++i)
+        {
+            __m256 left  = _mm256_loadu_ps(in + x - i);
+            __m256 right = _mm256_loadu_ps(in + x + i);
+            __m256 sum   = taps.odd ? _mm256_sub_ps(right, left)
+                                    : _mm256_add_ps(left, right);
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(taps.weights[i]), sum, acc);
+        }
+        _mm256_storeu_ps(out + x, acc);
+    }
+
+    filter_row_range(center, in, out, 0, std::min(reach, width), width, taps);
+    filter_row_range(
+        center, in, out, std::max(x, reach), width, width, taps);
+}
+
+FLOP_TARGET_AVX2 static void filter_column_avx2(float const* center,
+                                                float const* const* rows,
+                                                float* out,
+                                                int width,
+                                                Taps const& taps)
+{
+    int const mid = taps.radius - 1;
+    int x         = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256 acc = _mm256_mul_ps(_mm256_loadu_ps(center + x),
+                                   _mm256_set1_ps(taps.center));
+        for (int i = 1; i != taps.radius; ++i)
+        {
+            __m256 left  = _mm256_loadu_ps(rows[mid - i] + x);
+            __m256 right = _mm256_loadu_ps(rows[mid + i] + x);
+            __m256 sum   = taps.odd ? _mm256_sub_ps(right, left)
+                                    : _mm256_add_ps(left, right);
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(taps.weights[i]), sum, acc);
+        }
+        _mm256_storeu_ps(out + x, acc);
+    }
+
+    filter_column_range(center, rows, out, x, width, taps);
+}
+#endif
+
+#ifdef FLOP_CPU_NEON
+static void filter_row_neon(float const* center,
+                            float const* in,
+                            float* out,
+                            int width,
+                            Taps const& taps)
+{
+    int const reach = taps.radius - 1;
+    int x           = reach;
+    for (; x + reach + 4 <= width; x += 4)
+    {
+        float32x4_t acc = vmulq_n_f32(vld1q_f32(center + x), taps.center);
+        for (int i = 1; i != taps.radius; ++i)
+        {
+            float32x4_t left  = vld1q_f32(in + x - i);
+            float32x4_t right = vld1q_f32(in + x + i);
+            float32x4_t sum
+                = taps.odd ? vsubq_f32(right, left) : vaddq_f32(left, right);
+            acc = vfmaq_n_f32(acc, sum, taps.weights[i]);
+        }
+        vst1q_f32(out + x, acc);
+    }
+
+    filter_row_range(center, in, out, 0, std::min(reach, width), width, taps);
+    filter_row_range(
+        center, in, out, std::max(x, reach), width, width, taps);
+}
+
+static void filter_column_neon(float const* center,
+                               float const* const* rows,
+                               float* out,
+                               int width,
+                               Taps const& taps)
+{
+    int const mid = taps.radius - 1;
+    int x         = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        float32x4_t acc = vmulq_n_f32(vld1q_f32(center + x), taps.center);
+        for (int i = 1; i != taps.radius; ++i)
+        {
+            float32x4_t left  = vld1q_f32(rows[mid - i] + x);
+            float32x4_t right = vld1q_f32(rows[mid + i] + x);
+            float32x4_t sum
+                = taps.odd ? vsubq_f32(right, left) : vaddq_f32(left, right);
+            acc = vfmaq_n_f32(acc, sum, taps.weights[i]);
+        }
+        vst1q_f32(out + x, acc);
+    }
+
+    filter_column_range(center, rows, out, x, width, taps);
+}
+#endif
+
+struct Filters
+{
+    RowFn row;
+    ColumnFn column;
+    char const* name;
+};
+
+static Filters select_filters()
+{
+#ifdef FLOP_CPU_AVX2
+    if (has_avx2())
+    {
+        return {filter_row_avx2, filter_column_avx2, "AVX2"};
+    }
+#endif
+#ifdef FLOP_CPU_NEON
+    return {filter_row_neon, filter_column_neon, "NEON"};
+#else
+    return {filter_row_scalar, filter_column_scalar, "scalar"};
+#endif
+}
+
+static Filters const s_filters = select_filters();
+
+void filter_row(float const* center,
+                float const* in,
+                float* out,
+                int width,
+                Taps const& taps)
+{
+    s_filters.row(center, in, out, width, taps);
+}
+
+void filter_column(float const* center,
+                   float const* const* rows,
+                   float* out,
+                   int width,
+                   Taps const& taps)
+{
+    s_filters.column(center, rows, out, width, taps);
+}
+
+char const* simd_name()
+{
+    return s_filters.name;
+}
+} // namespace flop::cpu
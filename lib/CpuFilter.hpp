@@ -0,0 +1,38 @@
+#pragma once
+
+// Separable 1D filters used by the CPU backend. Both directions clamp samples
+// to the image edge, matching the clamped loads of the compute kernels.
+namespace flop::cpu
+{
+// A filter symmetric about its center. Even filters weight the sum of the
+// left and right taps, odd filters weight the right tap minus the left tap.
+struct Taps
+{
+    float center;
+    // weights[i] for i in [1, radius) weights the taps at distance i
+    float const* weights;
+    int radius;
+    bool odd;
+};
+
+// out[x] = taps.center * center[x]
+//          + sum_i weights[i] * (in[x + i] +/- in[x - i])
+// The center tap is read from a separate row so that a channel may be blurred
+// with neighbors drawn from another channel, as the CSF kernel does.
+void filter_row(float const* center,
+                float const* in,
+                float* out,
+                int width,
+                Taps const& taps);
+
+// rows[radius - 1 + i] is the input row at vertical offset i (already clamped
+// to the image), for i in (-radius, radius).
+void filter_column(float const* center,
+                   float const* const* rows,
+                   float* out,
+                   int width,
+                   Taps const& taps);
+
+// Name of the instruction set selected at runtime
+char const* simd_name();
+} // namespace flop::cpu
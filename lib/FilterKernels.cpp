@@ -0,0 +1,214 @@
+#include "FilterKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace flop
+{
+constexpr static double s_pi = 3.14159265358979323846;
+
+// Pixels per degree of the default viewing condition: a 0.7 m wide 4k monitor
+// (3840 pixels) viewed from 0.7 m resolves 67 pixels per degree. The feature
+// kernels of the reference implementation were computed for that value, and
+// its CSF kernels for 66.
+constexpr static double s_default_csf_ppd     = 66.0;
+constexpr static double s_default_feature_ppd = 67.0;
+
+// The CSFs are approximated by Gaussians
+//     g(x) = a * sqrt(pi / b) * exp(-pi^2 / b * x^2)
+// one each for the Yy and Cx CSFs, and two for the Cz CSF. The Yy and Cx
+// kernels are normalized, so their amplitude doesn't matter.
+constexpr static double s_b_sy  = 0.0047;
+constexpr static double s_b_sx  = 0.0053;
+constexpr static double s_a1_sz = 34.1;
+constexpr static double s_b1_sz = 0.04;
+constexpr static double s_a2_sz = 13.5;
+constexpr static double s_b2_sz = 0.025;
+
+// Width of the edge detection filter of the human visual system, from highest
+// to lowest amplitude, in degrees (from "Estimates of edge detection filters
+// in human vision")
+constexpr static double s_feature_width = 0.082;
+
+// Three standard deviations of the CSF Gaussian with parameter b
+static int32_t csf_radius(double b, double ppd)
+{
+    double sigma = std::sqrt(b / 2.0 / (s_pi * s_pi));
+    return static_cast<int32_t>(std::ceil(sigma * 3.0 * ppd));
+}
+
+// Samples a CSF Gaussian at taps [0, radius], spaced 1 / ppd degrees apart.
+// The two Gaussians of the Cz CSF are summed after filtering, so each is
+// scaled by the square root of its amplitude instead.
+static std::vector<double>
+csf_weights(double a, double b, double ppd, int32_t radius, bool root)
+{
+    double amplitude = a * std::sqrt(s_pi / b);
+    if (root)
+    {
+        amplitude = std::sqrt(amplitude);
+    }
+
+    std::vector<double> weights(radius + 1);
+    for (int32_t i = 0; i <= radius; ++i)
+    {
+        double d   = i / ppd;
+        weights[i] = amplitude * std::exp(-s_pi * s_pi / b * d * d);
+    }
+    return weights;
+}
+
+// Sum of a kernel symmetric about its center tap
+static double symmetric_sum(std::vector<double> const& weights)
+{
+    double sum = 0.0;
+    for (size_t i = 1; i < weights.size(); ++i)
+    {
+        sum += weights[i];
+    }
+    return 2.0 * sum + weights[0];
+}
+
+// Normalizes the Gaussian, first and second derivative kernels. The first
+// derivative is normalized by the sum of its magnitudes, and the positive and
+// negative lobes of the second derivative separately.
+static void normalize_features(std::vector<double> (&weights)[3])
+{
+    double sum        = symmetric_sum(weights[0]);
+    double sum_dx     = 0.0;
+    double sum_ddx[2] = {0.0, 0.0};
+    for (size_t i = 0; i != weights[0].size(); ++i)
+    {
+        sum_dx += std::abs(weights[1][i]);
+        sum_ddx[weights[2][i] > 0.0 ? 0 : 1] += std::abs(weights[2][i]);
+    }
+
+    // The first derivative is antisymmetric, and both of its halves are
+    // accounted for by summing magnitudes of one half. The second derivative
+    // is symmetric about its center tap.
+    double center = weights[2][0];
+    if (center > 0.0)
+    {
+        sum_ddx[0] = 2.0 * (sum_ddx[0] - center) + center;
+        sum_ddx[1] *= 2.0;
+    }
+    else
+    {
+        sum_ddx[0] *= 2.0;
+        sum_ddx[1] = 2.0 * (sum_ddx[1] + center) - center;
+    }
+
+    for (size_t i = 0; i != weights[0].size(); ++i)
+    {
+        weights[0][i] /= sum;
+        weights[1][i] /= sum_dx;
+        weights[2][i] /= weights[2][i] > 0.0 ? sum_ddx[0] : sum_ddx[1];
+    }
+}
+
+// Copies taps [0, radius) of weights, scaled by scale
+static void store_taps(std::vector<double> const& weights,
+                       int32_t radius,
+                       double scale,
+                       float* out)
+{
+    for (int32_t i = 0; i != radius; ++i)
+    {
+        out[i] = static_cast<float>(weights[i] * scale);
+    }
+}
+
+float clamp_pixels_per_degree(float pixels_per_degree)
+{
+    if (!(pixels_per_degree > 0.f))
+    {
+        return 0.f;
+    }
+    return std::min(pixels_per_degree, s_max_pixels_per_degree);
+}
+
+FilterKernels compute_filter_kernels(float pixels_per_degree)
+{
+    double csf_ppd     = s_default_csf_ppd;
+    double feature_ppd = s_default_feature_ppd;
+    if (pixels_per_degree != 0.f)
+    {
+        csf_ppd = std::clamp(pixels_per_degree, 1.f, s_max_pixels_per_degree);
+        feature_ppd = csf_ppd;
+    }
+
+    FilterKernels kernels;
+    kernels.pixels_per_degree_ = pixels_per_degree;
+
+    // The Cz CSF is the widest, and both of its Gaussians share its radius
+    int32_t sy_radius = csf_radius(s_b_sy, csf_ppd);
+    int32_t sx_radius = csf_radius(s_b_sx, csf_ppd);
+    int32_t sz_radius = csf_radius(s_b1_sz, csf_ppd);
+    std::vector<double> sy
+        = csf_weights(1.0, s_b_sy, csf_ppd, sy_radius, false);
+    std::vector<double> sx
+        = csf_weights(1.0, s_b_sx, csf_ppd, sx_radius, false);
+    std::vector<double> sz1
+        = csf_weights(s_a1_sz, s_b1_sz, csf_ppd, sz_radius, true);
+    std::vector<double> sz2
+        = csf_weights(s_a2_sz, s_b2_sz, csf_ppd, sz_radius, true);
+    double sz_sum1 = symmetric_sum(sz1);
+    double sz_sum2 = symmetric_sum(sz2);
+    double sz_norm = 1.0 / std::sqrt(sz_sum1 * sz_sum1 + sz_sum2 * sz_sum2);
+
+    // Gaussian of three standard deviations, where the standard deviation is
+    // half the width of the edge detection filter
+    double std_dev      = 0.5 * s_feature_width * feature_ppd;
+    auto feature_radius = static_cast<int32_t>(std::ceil(std_dev * 3.0));
+    double b            = 0.5 / (std_dev * std_dev);
+    std::vector<double> features[3];
+    for (int32_t i = 0; i <= feature_radius; ++i)
+    {
+        double weight = std::exp(-i * i * b);
+        features[0].push_back(weight);
+        features[1].push_back(-i * weight);
+        features[2].push_back((i * i * b * 2.0 - 1.0) * weight);
+    }
+    normalize_features(features);
+
+    // Kernels are normalized over all of their taps, but the outermost tap is
+    // not applied
+    kernels.inner_radius_
+        = std::min(std::max(sy_radius, sx_radius), s_max_filter_radius);
+    kernels.radius_
+        = std::min(std::max(sz_radius, feature_radius), s_max_filter_radius);
+    store_taps(sy,
+               std::min(sy_radius, kernels.inner_radius_),
+               1.0 / symmetric_sum(sy),
+               kernels.sy_);
+    store_taps(sx,
+               std::min(sx_radius, kernels.inner_radius_),
+               1.0 / symmetric_sum(sx),
+               kernels.sx_);
+    int32_t taps = std::min(sz_radius, kernels.radius_);
+    store_taps(sz1, taps, sz_norm, kernels.sz1_);
+    store_taps(sz2, taps, sz_norm, kernels.sz2_);
+    taps = std::min(feature_radius, kernels.radius_);
+    store_taps(features[0], taps, 1.0, kernels.gaussian_);
+    store_taps(features[1], taps, 1.0, kernels.edge_);
+    store_taps(features[2], taps, 1.0, kernels.point_);
+    return kernels;
+}
+
+void pack_filter_kernels(FilterKernels const& kernels, float* out)
+{
+    for (int32_t i = 0; i != s_max_filter_radius; ++i)
+    {
+        float* tap = out + i * 8;
+        tap[0]     = kernels.sy_[i];
+        tap[1]     = kernels.sx_[i];
+        tap[2]     = kernels.sz1_[i];
+        tap[3]     = kernels.sz2_[i];
+        tap[4]     = kernels.gaussian_[i];
+        tap[5]     = kernels.edge_[i];
+        tap[6]     = kernels.point_[i];
+        tap[7]     = 0.f;
+    }
+}
+} // namespace flop
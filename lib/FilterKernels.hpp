@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+// Weights of the separable CSF and feature filters, computed for a viewing
+// condition given in pixels per degree as described in the FLIP paper. These
+// were previously baked into the shaders by shaders/flip_kernels.js.
+namespace flop
+{
+// Largest kernel radius supported by the filter kernels, which load an apron
+// of this many pixels on either side of each group (see Filter.hlsl)
+constexpr static int32_t s_max_filter_radius = 32;
+
+// Largest number of pixels per degree whose kernels fit in
+// s_max_filter_radius taps (bounded by the widest CSF Gaussian)
+constexpr static float s_max_pixels_per_degree = 236.f;
+
+struct FilterKernels
+{
+    // Pixels per degree the kernels were computed for, or 0 for the default
+    // viewing condition
+    float pixels_per_degree_ = -1.f;
+
+    // Taps [0, inner_radius_) of the Yy and Cx kernels, and taps
+    // [0, radius_) of the remaining kernels, are applied. Tap i weights the
+    // pixels at distance i on either side.
+    int32_t radius_       = 0;
+    int32_t inner_radius_ = 0;
+
+    // CSF kernels of the Yy, Cx and Cz channels. The Cz CSF is the sum of two
+    // Gaussians.
+    float sy_[s_max_filter_radius]  = {};
+    float sx_[s_max_filter_radius]  = {};
+    float sz1_[s_max_filter_radius] = {};
+    float sz2_[s_max_filter_radius] = {};
+
+    // Feature kernels: a Gaussian, and its first (edge) and second (point)
+    // derivatives. The first derivative is odd, so its left half is applied
+    // with flipped signs.
+    float gaussian_[s_max_filter_radius] = {};
+    float edge_[s_max_filter_radius]     = {};
+    float point_[s_max_filter_radius]    = {};
+};
+
+// Size of the kernels as read by Filter.hlsl: per tap, the four CSF weights
+// followed by the three feature weights and a padding float
+constexpr static uint32_t s_filter_kernels_size = s_max_filter_radius * 8 * 4;
+
+// Returns the pixels per degree the kernels of a requested viewing condition
+// are computed for: 0 (the default viewing condition) if it isn't positive, or
+// at most s_max_pixels_per_degree
+float clamp_pixels_per_degree(float pixels_per_degree);
+
+// Computes the kernels for the supplied pixels per degree, clamped to
+// (0, s_max_pixels_per_degree]. If 0, the kernels of the default viewing
+// condition are computed: the CSF at 66 and the feature kernels at 67 pixels
+// per degree, which reproduces the weights flop has always used.
+FilterKernels compute_filter_kernels(float pixels_per_degree);
+
+// Writes kernels in the layout read by Filter.hlsl to out, which holds
+// s_filter_kernels_size bytes
+void pack_filter_kernels(FilterKernels const& kernels, float* out);
+} // namespace flop
@@ -4,33 +4,61 @@
 #include <chrono>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
 #include <vector>
 #include <volk.h>
 
 #include "ColorMaps.hpp"
 #include "FlopContext.hpp"
+#include "PipelineCache.hpp"
 #include "VkGlobals.hpp"
 
-#include <CSFFilterX_spv.h>
-#include <CSFFilterY_spv.h>
-#include <ColorCompare_spv.h>
 #include <ErrorColorMap_spv.h>
-#include <FeatureFilterX_spv.h>
-#include <FeatureFilterY_spv.h>
-#include <Summarize_spv.h>
+#include <FilterXHalf_spv.h>
+#include <FilterX_spv.h>
+#include <FilterYHalf_spv.h>
+#include <FilterY_spv.h>
+#include <Statistics_spv.h>
+#include <YyCxCzHalf_spv.h>
 #include <YyCxCz_spv.h>
 
-static char const* s_error = "";
+// Contexts may be driven from several threads, so the last error is tracked
+// per thread
+static thread_local char const* s_error = "";
 #ifdef NDEBUG
 static bool s_validation_enabled = false;
 #else
 static bool s_validation_enabled = true;
 #endif
 
+static std::mutex s_init_mutex;
 static bool s_initialized;
-
+static int s_init_result;
+static FlopInitSummary s_init_summary;
+static FlopBackend s_requested_backend = FLOP_BACKEND_AUTO;
+
+// Filter pipelines, keyed by the kernel radius and inner radius they are
+// specialized for
+static std::mutex s_filter_pipelines_mutex;
+static std::map<std::tuple<int32_t, int32_t, bool>, FilterPipelines>
+    s_filter_pipelines;
+// YyCxCz kernels writing full and half-precision intermediates
+static Kernel s_yycxcz[2];
+static std::once_flag s_yycxcz_half_once;
+// Set once flop_init has created (and persisted) the initial pipelines
+static bool s_pipelines_created;
+
+static int init_vulkan(uint32_t instanceExtensionCount,
+                       char const** requiredInstanceExtensions);
 static int create_device(char const* preferred_device, bool swapchain);
 static void create_kernels();
 
@@ -79,15 +107,141 @@ void flop_config_enable_validation()
     s_validation_enabled = true;
 }
 
+void flop_config_set_backend(FlopBackend backend)
+{
+    s_requested_backend = backend;
+}
+
+void flop_config_set_precision(FlopPrecision precision)
+{
+    g_precision = precision;
+}
+
+void flop_config_set_reference_cache(int enabled)
+{
+    g_reference_cache = enabled != 0;
+}
+
+void flop_config_set_histogram(int bucket_count, FlopHistogramScale scale)
+{
+    g_histogram_buckets = std::clamp(bucket_count, 0, 4096);
+    g_histogram_scale   = scale;
+}
+
+void flop_config_set_gate(FlopGate const* gate)
+{
+    g_gate_enabled = gate != nullptr;
+    g_gate         = gate ? *gate : FlopGate{-1.f, 0.f, -1.f, -1.f};
+}
+
+void flop_config_set_band_rows(int rows)
+{
+    g_band_rows = std::max(rows, 0);
+}
+
+void flop_config_set_pixels_per_degree(float pixels_per_degree)
+{
+    g_pixels_per_degree = clamp_pixels_per_degree(pixels_per_degree);
+}
+
+float flop_pixels_per_degree(float monitor_distance,
+                             float monitor_width,
+                             int resolution_x)
+{
+    constexpr float pi = 3.14159265f;
+    return monitor_distance * resolution_x / monitor_width * pi / 180.f;
+}
+
+void flop_config_set_result_cache(char const* directory, int store_error_images)
+{
+    g_result_cache_directory    = directory ? directory : "";
+    g_result_cache_error_images = store_error_images != 0;
+    if (directory)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+    }
+}
+
+void flop_config_set_pipeline_cache(char const* directory)
+{
+    g_pipeline_cache_directory  = directory ? directory : "";
+    g_pipeline_cache_configured = directory != nullptr;
+}
+
+void flop_get_init_summary(FlopInitSummary* out_summary)
+{
+    std::lock_guard lock{s_init_mutex};
+    *out_summary = s_init_summary;
+}
+
+FlopBackend flop_get_backend()
+{
+    return g_backend;
+}
+
+static FlopBackend requested_backend()
+{
+    if (s_requested_backend != FLOP_BACKEND_AUTO)
+    {
+        return s_requested_backend;
+    }
+
+    char const* backend = std::getenv("FLOP_BACKEND");
+    if (backend && std::strcmp(backend, "cpu") == 0)
+    {
+        return FLOP_BACKEND_CPU;
+    }
+    else if (backend && std::strcmp(backend, "vulkan") == 0)
+    {
+        return FLOP_BACKEND_VULKAN;
+    }
+    return FLOP_BACKEND_AUTO;
+}
+
 int flop_init(uint32_t instanceExtensionCount,
               char const** requiredInstanceExtensions)
 {
+    std::lock_guard lock{s_init_mutex};
     if (s_initialized)
     {
-        return 0;
+        return s_init_result;
     }
     s_initialized = true;
 
+    auto start_time = std::chrono::high_resolution_clock::now();
+    auto elapsed    = [&] {
+        std::chrono::duration<float, std::milli> delta
+            = std::chrono::high_resolution_clock::now() - start_time;
+        return static_cast<int>(delta.count());
+    };
+
+    FlopBackend backend = requested_backend();
+    if (backend != FLOP_BACKEND_CPU)
+    {
+        s_init_result
+            = init_vulkan(instanceExtensionCount, requiredInstanceExtensions);
+
+        // Presentation requires a device, so only headless use falls back
+        if (s_init_result == 0 || backend == FLOP_BACKEND_VULKAN
+            || instanceExtensionCount != 0)
+        {
+            s_init_summary.milliseconds_elapsed = elapsed();
+            return s_init_result;
+        }
+        std::printf("%s Falling back to the CPU backend.\n", s_error);
+    }
+
+    g_backend = FLOP_BACKEND_CPU;
+    g_context.init();
+    s_init_result                       = 0;
+    s_init_summary.milliseconds_elapsed = elapsed();
+    return 0;
+}
+
+static int init_vulkan(uint32_t instanceExtensionCount,
+                       char const** requiredInstanceExtensions)
+{
     if (volkInitialize() != VK_SUCCESS)
     {
         s_error = "Failed to initialize Vulkan loader.";
@@ -154,12 +308,38 @@ int flop_init(uint32_t instanceExtensionCount,
         return 1;
     }
 
-    create_kernels();
-
-    g_error_histogram = Buffer::create(sizeof(uint32_t) * 32);
+    if (!g_pipeline_cache_configured)
+    {
+        g_pipeline_cache_directory = default_pipeline_cache_directory();
+    }
+    s_init_summary.pipeline_cache_loaded = load_pipeline_cache();
+
+    // Pipelines are created while the default context is initialized and
+    // the color maps are uploaded, whose transfers share a single submission
+    std::future<void> kernels = std::async(std::launch::async, [] {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        create_kernels();
+        std::chrono::duration<float, std::milli> delta
+            = std::chrono::high_resolution_clock::now() - start_time;
+        s_init_summary.pipeline_milliseconds = delta.count();
+    });
+
+    if (g_context.init())
+    {
+        kernels.get();
+        s_error = g_context.error_message_;
+        return 1;
+    }
 
-    upload_color_maps();
+    UploadBatch batch;
+    batch.begin();
+    upload_color_maps(batch);
+    batch.submit();
+    kernels.get();
+    store_pipeline_cache();
+    s_pipelines_created = true;
 
+    g_backend = FLOP_BACKEND_VULKAN;
     return 0;
 }
 
@@ -220,28 +400,82 @@ static int create_device(char const* preferred_device, bool swapchain)
 
     std::cout << "Using device: " << g_physical_device_props.deviceName << '\n';
 
-    // For now, keep things simple with a single device queue
+    // Leave most of the largest device-local heap to other contexts and the
+    // presentation engine. Bands and the images retained by the image pool
+    // have separate budgets, so pooled images never crowd out a band.
+    VkPhysicalDeviceMemoryProperties memory_props;
+    vkGetPhysicalDeviceMemoryProperties(g_physical_device, &memory_props);
+    for (uint32_t i = 0; i != memory_props.memoryHeapCount; ++i)
+    {
+        VkMemoryHeap const& heap = memory_props.memoryHeaps[i];
+        if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            g_band_budget = std::max(g_band_budget, heap.size / 4);
+            g_image_pool_budget = std::max(g_image_pool_budget, heap.size / 8);
+        }
+    }
+
+    // Evaluation only dispatches compute work. Devices that present (to the
+    // viewer) evaluate on a graphics queue, while headless devices accept any
+    // compute-capable family, preferring one with graphics support so that an
+    // async compute family remains for uploads. Uploads use a queue of another
+    // compute-capable family, preferring a compute-only family, which
+    // typically maps to the async compute engine.
     std::vector<VkQueueFamilyProperties> queueFamilies
         = vk_enumerate<VkQueueFamilyProperties>(
             vkGetPhysicalDeviceQueueFamilyProperties, g_physical_device);
 
+    VkQueueFlags required_flags
+        = swapchain ? VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT
+                    : VK_QUEUE_COMPUTE_BIT;
+    g_graphics_queue_index = ~0u;
+    g_compute_queue_index  = ~0u;
     for (uint32_t i = 0; i != queueFamilies.size(); ++i)
     {
-        if (queueFamilies[i].queueCount > 0)
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if (queueFamilies[i].queueCount == 0
+            || (flags & required_flags) != required_flags)
         {
-            if (g_graphics_queue_index == -0u
-                && queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
-            {
-                g_graphics_queue_index = i;
-            }
-            else if (g_compute_queue_index == -0u
-                     && queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
-            {
-                g_compute_queue_index = i;
-            }
+            continue;
+        }
+        if (g_graphics_queue_index == ~0u || flags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            g_graphics_queue_index = i;
+        }
+        if (flags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            break;
+        }
+    }
+    if (g_graphics_queue_index == ~0u)
+    {
+        s_error = swapchain ? "No graphics queue available."
+                            : "No compute queue available.";
+        return 1;
+    }
+    for (uint32_t i = 0; i != queueFamilies.size(); ++i)
+    {
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if (i == g_graphics_queue_index || queueFamilies[i].queueCount == 0
+            || !(flags & VK_QUEUE_COMPUTE_BIT))
+        {
+            continue;
+        }
+        if (g_compute_queue_index == ~0u || !(flags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            g_compute_queue_index = i;
+        }
+        if (!(flags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            break;
         }
     }
 
+    // Stage timings are only measured if the evaluation queue supports
+    // timestamps
+    g_timestamp_valid_bits
+        = queueFamilies[g_graphics_queue_index].timestampValidBits;
+
     float queue_priority = 1.f;
     VkDeviceQueueCreateInfo queue_infos[]
         = {{
@@ -257,34 +491,53 @@ static int create_device(char const* preferred_device, bool swapchain)
                .pQueuePriorities = &queue_priority,
            }};
 
-    char const* device_exts[] = {
+    std::vector<char const*> device_exts = {
         "VK_EXT_descriptor_indexing",
         "VK_KHR_timeline_semaphore",
         "VK_EXT_shader_subgroup_ballot",
         "VK_EXT_shader_subgroup_vote",
-        VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
-        "VK_KHR_swapchain",
     };
+    if (swapchain)
+    {
+        device_exts.push_back("VK_KHR_swapchain");
+    }
+
+    // Images exported by other devices or instances may only be imported if
+    // the device supports opaque file descriptors
+    std::vector<VkExtensionProperties> supported_exts
+        = vk_enumerate<VkExtensionProperties>(
+            vkEnumerateDeviceExtensionProperties, g_physical_device, nullptr);
+    for (VkExtensionProperties const& ext : supported_exts)
+    {
+        if (std::strcmp(ext.extensionName,
+                        VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME)
+            == 0)
+        {
+            g_external_memory_fd_supported = true;
+            device_exts.push_back(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME);
+        }
+    }
+
+    // Kernels are compiled once per precision with the formats of their
+    // storage images, so half precision only depends on R16F storage images
+    // (RGBA16F storage is mandatory)
+    VkFormatProperties half_error_props;
+    vkGetPhysicalDeviceFormatProperties(
+        g_physical_device, VK_FORMAT_R16_SFLOAT, &half_error_props);
+    g_half_precision_supported = half_error_props.optimalTilingFeatures
+                                 & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
 
     VkPhysicalDeviceFeatures features{
         .robustBufferAccess                      = VK_TRUE,
         .textureCompressionBC                    = VK_TRUE,
-        .vertexPipelineStoresAndAtomics          = VK_TRUE,
-        .fragmentStoresAndAtomics                = VK_TRUE,
         .shaderUniformBufferArrayDynamicIndexing = VK_TRUE,
         .shaderSampledImageArrayDynamicIndexing  = VK_TRUE,
         .shaderStorageBufferArrayDynamicIndexing = VK_TRUE,
         .shaderStorageImageArrayDynamicIndexing  = VK_TRUE,
         .shaderResourceResidency                 = VK_TRUE,
     };
-    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering{
-        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
-        .dynamicRendering = VK_TRUE,
-    };
-
     VkPhysicalDeviceVulkan12Features features2{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
-        .pNext = &dynamic_rendering,
         .descriptorIndexing                            = VK_TRUE,
         .shaderSampledImageArrayNonUniformIndexing     = VK_TRUE,
         .shaderStorageImageArrayNonUniformIndexing     = VK_TRUE,
@@ -295,18 +548,18 @@ static int create_device(char const* preferred_device, bool swapchain)
         .descriptorBindingPartiallyBound               = VK_TRUE,
         .descriptorBindingVariableDescriptorCount      = VK_TRUE,
         .runtimeDescriptorArray                        = VK_TRUE,
+        .timelineSemaphore                             = VK_TRUE,
     };
 
     VkDeviceCreateInfo device_info{
         .sType                = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext                = &features2,
-        .queueCreateInfoCount = g_compute_queue_index == -0u ? 1u : 2u,
+        .queueCreateInfoCount = g_compute_queue_index == ~0u ? 1u : 2u,
         .pQueueCreateInfos    = queue_infos,
         .enabledLayerCount    = 0,
         .ppEnabledLayerNames  = nullptr,
-        .enabledExtensionCount
-        = sizeof(device_exts) / sizeof(char const*) - (swapchain ? 0 : 1),
-        .ppEnabledExtensionNames = device_exts,
+        .enabledExtensionCount   = static_cast<uint32_t>(device_exts.size()),
+        .ppEnabledExtensionNames = device_exts.data(),
         .pEnabledFeatures        = &features};
 
     if (vkCreateDevice(g_physical_device, &device_info, nullptr, &g_device)
@@ -319,10 +572,13 @@ static int create_device(char const* preferred_device, bool swapchain)
 
     vkGetDeviceQueue(g_device, g_graphics_queue_index, 0, &g_graphics_queue);
 
-    if (g_compute_queue_index != -0u)
+    g_compute_queue = VK_NULL_HANDLE;
+    if (g_compute_queue_index != ~0u)
     {
         vkGetDeviceQueue(g_device, g_compute_queue_index, 0, &g_compute_queue);
     }
+    g_shared_queue_families[0] = g_graphics_queue_index;
+    g_shared_queue_families[1] = g_compute_queue_index;
 
     VmaVulkanFunctions vulkan_functions{
         .vkGetInstanceProcAddr = vkGetInstanceProcAddr,
@@ -478,24 +734,91 @@ static int create_device(char const* preferred_device, bool swapchain)
     return 0;
 }
 
-void create_kernels()
+FilterPipelines const& flop::filter_pipelines(FilterKernels const& kernels,
+                                              bool half)
+{
+    std::lock_guard lock{s_filter_pipelines_mutex};
+    auto key = std::make_tuple(kernels.radius_, kernels.inner_radius_, half);
+    auto it  = s_filter_pipelines.find(key);
+    if (it != s_filter_pipelines.end())
+    {
+        return it->second;
+    }
+
+    // See the kernel_radius and inner_radius constants of Filter.hlsl
+    int32_t radii[] = {kernels.radius_, kernels.inner_radius_};
+    VkSpecializationMapEntry entries[] = {
+        {.constantID = 0, .offset = 0, .size = sizeof(int32_t)},
+        {.constantID = 1, .offset = sizeof(int32_t), .size = sizeof(int32_t)},
+    };
+    VkSpecializationInfo specialization{
+        .mapEntryCount = 2,
+        .pMapEntries   = entries,
+        .dataSize      = sizeof(radii),
+        .pData         = radii,
+    };
+
+    uint8_t const* x_data = half ? FilterXHalf_spv_data : FilterX_spv_data;
+    unsigned x_size       = half ? FilterXHalf_spv_size : FilterX_spv_size;
+    uint8_t const* y_data = half ? FilterYHalf_spv_data : FilterY_spv_data;
+    unsigned y_size       = half ? FilterYHalf_spv_size : FilterY_spv_size;
+
+    // Both passes are compiled concurrently
+    FilterPipelines& pipelines = s_filter_pipelines[key];
+    std::future<Kernel> y      = std::async(std::launch::async, [&] {
+        return Kernel::create(y_data, y_size, 1, 64, true, &specialization);
+    });
+    pipelines.x_ = Kernel::create(x_data, x_size, 64, 1, true, &specialization);
+    pipelines.y_ = y.get();
+
+    // Pipelines created after initialization (for another viewing condition)
+    // are persisted as they are created. Those created by flop_init are
+    // persisted once all of them are.
+    if (s_pipelines_created)
+    {
+        store_pipeline_cache();
+    }
+    return pipelines;
+}
+
+Kernel const& flop::yycxcz_pipeline(bool half)
 {
-    g_yycxcz.init(YyCxCz_spv_data, YyCxCz_spv_size, 4 * 9);
-    g_csf_filter_x
-        = Kernel::create(CSFFilterX_spv_data, CSFFilterX_spv_size, 64, 1, false);
-    g_csf_filter_y
-        = Kernel::create(CSFFilterY_spv_data, CSFFilterY_spv_size, 1, 64, false);
-    g_color_compare = Kernel::create(
-        ColorCompare_spv_data, ColorCompare_spv_size, 8, 8, true);
-    g_error_color_map.init(ErrorColorMap_spv_data, ErrorColorMap_spv_size, 4 * 7);
+    if (!half)
+    {
+        return s_yycxcz[0];
+    }
 
-    g_feature_filter_x = Kernel::create(
-        FeatureFilterX_spv_data, FeatureFilterX_spv_size, 64, 1, true);
-    g_feature_filter_y = Kernel::create(
-        FeatureFilterY_spv_data, FeatureFilterY_spv_size, 1, 64, true);
+    std::call_once(s_yycxcz_half_once, [] {
+        s_yycxcz[1] = Kernel::create(
+            YyCxCzHalf_spv_data, YyCxCzHalf_spv_size, 8, 8, true);
+        store_pipeline_cache();
+    });
+    return s_yycxcz[1];
+}
 
-    g_summarize
-        = Kernel::create(Summarize_spv_data, Summarize_spv_size, 8, 8, false);
+void create_kernels()
+{
+    Kernel::create_layouts();
+
+    // Drivers compile pipelines on the calling thread, so each pipeline is
+    // created on a thread of its own
+    std::future<void> yycxcz = std::async(std::launch::async, [] {
+        s_yycxcz[0]
+            = Kernel::create(YyCxCz_spv_data, YyCxCz_spv_size, 8, 8, true);
+    });
+    std::future<void> error_color_map = std::async(std::launch::async, [] {
+        g_error_color_map = Kernel::create(
+            ErrorColorMap_spv_data, ErrorColorMap_spv_size, 8, 8, true);
+    });
+    std::future<void> statistics = std::async(std::launch::async, [] {
+        g_statistics = Kernel::create(
+            Statistics_spv_data, Statistics_spv_size, 256, 1, true);
+    });
+    // Pipelines for other pixels per degree are created on first use
+    filter_pipelines(compute_filter_kernels(0.f), false);
+    yycxcz.get();
+    error_color_map.get();
+    statistics.get();
 }
 
 char const* flop_get_error()
@@ -503,483 +826,404 @@ char const* flop_get_error()
     return s_error;
 }
 
-void flop_init_reference(char const* reference_path)
+char const* flop_stage_name(FlopStage stage)
 {
-    std::filesystem::path reference_ext
-        = std::filesystem::path{reference_path}.extension();
+    switch (stage)
+    {
+    case FLOP_STAGE_YYCXCZ:
+        return "yycxcz";
+    case FLOP_STAGE_FILTER_X:
+        return "filter x";
+    case FLOP_STAGE_FILTER_Y:
+        return "filter y";
+    case FLOP_STAGE_COLOR_MAP:
+        return "color map";
+    case FLOP_STAGE_READBACK:
+        return "readback";
+    default:
+        return "unknown";
+    }
+}
 
-    if (reference_ext == ".exr")
+int flop_analyze(char const* reference_path,
+                 char const* test_path,
+                 char const* output_path,
+                 FlopSummary* out_summary)
+{
+    if (flop_init(0, nullptr))
     {
-        g_reference.source_ = Image::create_from_exr(reference_path);
+        return 1;
     }
-    else if (reference_ext == ".png" || reference_ext == ".jpg"
-             || reference_ext == ".jpeg" || reference_ext == ".bmp")
+    return flop_context_analyze(
+        &g_context, reference_path, test_path, output_path, out_summary);
+}
+
+int flop_analyze_hdr(char const* reference_path,
+                     char const* test_path,
+                     char const* output_path,
+                     float exposure,
+                     int tonemapper,
+                     FlopSummary* out_summary)
+{
+    if (flop_init(0, nullptr))
     {
-        g_reference.source_ = Image::create_from_non_exr(reference_path);
+        return 1;
+    }
+    return flop_context_analyze_hdr(&g_context,
+                                    reference_path,
+                                    test_path,
+                                    output_path,
+                                    exposure,
+                                    tonemapper,
+                                    out_summary);
+}
+
+FlopContext* flop_context_create()
+{
+    if (flop_init(0, nullptr))
+    {
+        return nullptr;
     }
-    else
+
+    FlopContext* context = new FlopContext{};
+    if (context->init())
     {
-        std::printf(
-            "Reference image %s has unrecognized extension\n", reference_path);
+        s_error = context->error_message_;
+        context->destroy();
+        delete context;
+        return nullptr;
     }
+    return context;
 }
 
-void flop_init_test(char const* test_path)
+void flop_context_destroy(FlopContext* context)
 {
-    std::filesystem::path test_ext = std::filesystem::path{test_path}.extension();
+    if (context && context != &g_context)
+    {
+        context->destroy();
+        delete context;
+    }
+}
 
-    if (test_ext == ".exr")
+int flop_context_analyze(FlopContext* context,
+                         char const* reference_path,
+                         char const* test_path,
+                         char const* output_path,
+                         FlopSummary* out_summary)
+{
+    if (flop_init(0, nullptr))
     {
-        g_test.source_ = Image::create_from_exr(test_path);
+        return 1;
     }
-    else if (test_ext == ".png" || test_ext == ".jpg" || test_ext == ".jpeg"
-             || test_ext == ".bmp")
+
+    if (!context)
     {
-        g_test.source_ = Image::create_from_non_exr(test_path);
+        context = &g_context;
     }
-    else
+
+    if (context->analyze(
+            reference_path, test_path, output_path, 1.f, 0, out_summary, false))
     {
-        std::printf("Test image %s has unrecognized extension\n", test_path);
+        s_error = context->error_message_;
+        return 1;
     }
+    return 0;
 }
 
-void flop_reset(bool bypass)
+int flop_context_analyze_hdr(FlopContext* context,
+                             char const* reference_path,
+                             char const* test_path,
+                             char const* output_path,
+                             float exposure,
+                             int tonemapper,
+                             FlopSummary* out_summary)
 {
-    vkDeviceWaitIdle(g_device);
-    if (bypass)
+    if (flop_init(0, nullptr))
+    {
+        return 1;
+    }
+
+    if (!context)
     {
-        Image::reset_count(2);
+        context = &g_context;
     }
-    else
+
+    if (context->analyze(reference_path,
+                         test_path,
+                         output_path,
+                         exposure,
+                         tonemapper + 1,
+                         out_summary,
+                         false))
     {
-        Image::reset_count();
-        g_reference.source_.reset();
-        g_test.source_.reset();
+        s_error = context->error_message_;
+        return 1;
     }
-    g_reference.yycxcz_.reset();
-    g_reference.yycxcz_blur_x_.reset();
-    g_reference.yycxcz_blurred_.reset();
-    g_reference.feature_blur_x_.reset();
-    g_test.yycxcz_.reset();
-    g_test.yycxcz_blur_x_.reset();
-    g_test.yycxcz_blurred_.reset();
-    g_test.feature_blur_x_.reset();
-    g_error.reset();
-    g_error_color.reset();
-    g_error_readback.reset();
+    return 0;
 }
 
-int flop_analyze_impl(char const* reference_path,
-                      char const* test_path,
-                      char const* output_path,
-                      float exposure,
-                      int tonemap,
-                      FlopSummary* out_summary,
-                      bool bypass_initialization)
+int flop_analyze_viewing_conditions(FlopContext* context,
+                                    char const* reference_path,
+                                    char const* test_path,
+                                    float const* pixels_per_degree,
+                                    int condition_count,
+                                    char const* const* output_paths,
+                                    float exposure,
+                                    int tonemapper,
+                                    FlopSummary* out_summaries)
 {
-    if (!std::filesystem::exists(reference_path))
+    if (flop_init(0, nullptr))
     {
-        s_error = "Invalid reference path.";
         return 1;
     }
+    if (!context)
+    {
+        context = &g_context;
+    }
 
-    if (!std::filesystem::exists(test_path))
+    if (context->analyze_viewing_conditions(reference_path,
+                                            test_path,
+                                            pixels_per_degree,
+                                            condition_count,
+                                            output_paths,
+                                            exposure,
+                                            tonemapper + 1,
+                                            out_summaries))
     {
-        s_error = "Invalid test path.";
+        s_error = context->error_message_;
         return 1;
     }
+    return 0;
+}
 
-    auto start_time = std::chrono::high_resolution_clock::now();
-
-    if (g_reference.source_.image_ != VK_NULL_HANDLE)
+int flop_analyze_pixels(FlopContext* context,
+                        FlopPixels const* reference,
+                        FlopPixels const* test,
+                        float exposure,
+                        int tonemapper,
+                        uint8_t* out_error_map,
+                        int out_error_map_stride,
+                        FlopSummary* out_summary)
+{
+    if (flop_init(0, nullptr))
     {
-        flop_reset(bypass_initialization);
+        return 1;
+    }
+    if (!context)
+    {
+        context = &g_context;
     }
 
-    if (!bypass_initialization)
+    if (context->analyze_pixels(*reference,
+                                *test,
+                                out_error_map,
+                                static_cast<size_t>(
+                                    std::max(out_error_map_stride, 0)),
+                                exposure,
+                                tonemapper + 1,
+                                out_summary))
     {
-        flop_init_reference(reference_path);
-        flop_init_test(test_path);
+        s_error = context->error_message_;
+        return 1;
     }
+    return 0;
+}
 
-    // Validate that the images have the same dimensions
-    if (g_reference.source_.width_ != g_test.source_.width_
-        || g_reference.source_.height_ != g_test.source_.height_)
+int flop_get_vulkan_device(FlopVulkanDevice* out_device)
+{
+    if (flop_init(0, nullptr))
     {
-        s_error = "Reference and test images do not have matching extents.";
         return 1;
     }
-    if (out_summary)
-    {
-        out_summary->width  = g_reference.source_.width_;
-        out_summary->height = g_reference.source_.height_;
-    }
-
-    g_reference.yycxcz_ = Image::create(
-        g_reference.source_, VK_FORMAT_R32G32B32A32_SFLOAT, true);
-    g_reference.yycxcz_blur_x_ = Image::create(g_reference.source_);
-    g_reference.yycxcz_blurred_
-        = Image::create(g_reference.source_, VK_FORMAT_R32G32B32A32_SFLOAT);
-    g_reference.feature_blur_x_ = Image::create(g_reference.source_);
-    g_test.yycxcz_
-        = Image::create(g_test.source_, VK_FORMAT_R32G32B32A32_SFLOAT, true);
-    g_test.yycxcz_blur_x_ = Image::create(g_test.source_);
-    g_test.yycxcz_blurred_
-        = Image::create(g_test.source_, VK_FORMAT_R32G32B32A32_SFLOAT);
-    g_test.feature_blur_x_ = Image::create(g_test.source_);
-
-    g_error = Image::create(g_reference.source_, VK_FORMAT_R32_SFLOAT);
-    if (output_path)
-    {
-        g_error_color
-            = Image::create(g_reference.source_, VK_FORMAT_R8G8B8A8_UNORM, true);
-        g_error_readback = Image::create_readback(
-            g_reference.source_, VK_FORMAT_R8G8B8A8_UNORM);
-    }
-
-    VkCommandBufferBeginInfo begin{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
-    VkCommandBuffer cb = g_command_buffers[1];
-    vkBeginCommandBuffer(cb, &begin);
-
-    // Transfer storage images to a writable state
-    VkImageSubresourceRange transfer_range{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                                           .baseMipLevel   = 0,
-                                           .levelCount     = 1,
-                                           .baseArrayLayer = 0,
-                                           .layerCount     = 1};
-    VkImageMemoryBarrier transfers[11] = {
-        g_reference.yycxcz_.start_barrier(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
-        g_test.yycxcz_.start_barrier(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
-        g_reference.yycxcz_blur_x_.start_barrier(),
-        g_reference.yycxcz_blurred_.start_barrier(),
-        g_reference.feature_blur_x_.start_barrier(),
-        g_test.yycxcz_blur_x_.start_barrier(),
-        g_test.yycxcz_blurred_.start_barrier(),
-        g_test.feature_blur_x_.start_barrier(),
-        g_error.start_barrier(),
-        (output_path ? g_error_color.start_barrier() : VkImageMemoryBarrier{}),
-        (output_path ? g_error_readback.readback_barrier()
-                     : VkImageMemoryBarrier{})};
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         2,
-                         transfers);
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         output_path ? 9 : 7,
-                         transfers + 2);
-
-    // Transform input images to YyCxCz space
-
-    struct
-    {
-        uint32_t extent[2];
-        float uv_offset[2];
-        float uv_scale;
-        uint32_t input;
-        uint32_t tonemap;
-        float exposure;
-        uint32_t handle_alpha;
-    } data;
-    data.extent[0]    = g_reference.source_.width_;
-    data.extent[1]    = g_reference.source_.height_;
-    data.uv_offset[0] = 0.f;
-    data.uv_offset[1] = 0.f;
-    data.uv_scale     = 1.f;
-    data.input        = g_reference.source_.index_;
-    if (g_reference.source_.hdr_)
-    {
-        data.tonemap  = tonemap;
-        data.exposure = std::powf(2.f, exposure);
-    }
-    else
-    {
-        data.tonemap  = 0;
-        data.exposure = 1.f;
-    }
-    if (g_reference.source_.channels_ == 4)
-    {
-        data.handle_alpha = 1;
-    }
-    else
-    {
-        data.handle_alpha = 0;
-    }
-    g_yycxcz.render(cb, g_reference.yycxcz_, &data);
-    data.input = g_test.source_.index_;
-    if (g_test.source_.channels_ == 4)
-    {
-        data.handle_alpha = 1;
-    }
-    else
-    {
-        data.handle_alpha = 0;
-    }
-    g_yycxcz.render(cb, g_test.yycxcz_, &data);
-
-    VkEventCreateInfo event_info{.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO,
-                                 .flags = VK_EVENT_CREATE_DEVICE_ONLY_BIT_KHR};
-
-    transfers[0]
-        = g_reference.yycxcz_.raw_barrier(VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
-    transfers[1]
-        = g_test.yycxcz_.raw_barrier(VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
-
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         2,
-                         transfers);
-
-    // Convolve input images in YyCxCz space with feature-detection kernels
-    g_feature_filter_x.dispatch(cb,
-                                g_reference.yycxcz_,
-                                g_test.yycxcz_,
-                                g_reference.feature_blur_x_,
-                                g_test.feature_blur_x_);
-
-    // Apply a separable Gaussian filter based on the contrast sensitivity
-    // functions
-    g_csf_filter_x.dispatch(cb, g_reference.yycxcz_, g_reference.yycxcz_blur_x_);
-    g_csf_filter_x.dispatch(cb, g_test.yycxcz_, g_test.yycxcz_blur_x_);
-
-    transfers[0] = g_reference.yycxcz_blur_x_.raw_barrier();
-    transfers[1] = g_test.yycxcz_blur_x_.raw_barrier();
-    transfers[2] = g_reference.feature_blur_x_.raw_barrier();
-    transfers[3] = g_test.feature_blur_x_.raw_barrier();
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         4,
-                         transfers);
-
-    g_csf_filter_y.dispatch(
-        cb, g_reference.yycxcz_blur_x_, g_reference.yycxcz_blurred_);
-    g_csf_filter_y.dispatch(cb, g_test.yycxcz_blur_x_, g_test.yycxcz_blurred_);
-
-    transfers[0] = g_reference.yycxcz_blurred_.raw_barrier();
-    transfers[1] = g_test.yycxcz_blurred_.raw_barrier();
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         2,
-                         transfers);
-
-    // Use the modified HyAB color difference metric to compute the color-based
-    // error
-    g_color_compare.dispatch(
-        cb, g_reference.yycxcz_blurred_, g_test.yycxcz_blurred_, g_error);
-
-    transfers[0] = g_error.waw_barrier();
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         1,
-                         transfers);
-
-    // Finalize feature detection convolution in the y direction and use feature
-    // differences to amplify color error
-    g_feature_filter_y.dispatch(
-        cb, g_reference.feature_blur_x_, g_test.feature_blur_x_, g_error);
-
-    transfers[0] = g_error.raw_barrier();
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         1,
-                         transfers);
-
-    // Compute a histogram of the final error map
-    g_summarize.dispatch(cb, g_error, g_error_histogram);
-
-    if (output_path)
-    {
-        // Transfer monochromatic error channel via color map
-
-        transfers[0] = g_error.rar_barrier();
-        vkCmdPipelineBarrier(cb,
-                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                             0,
-                             0,
-                             nullptr,
-                             0,
-                             nullptr,
-                             1,
-                             transfers);
-
-        struct
-        {
-            uint32_t extent[2];
-            float uv_offset[2];
-            float uv_scale;
-            uint32_t input;
-            uint32_t color_map;
-        } data;
-        data.extent[0]    = g_reference.source_.width_;
-        data.extent[1]    = g_reference.source_.height_;
-        data.uv_offset[0] = 0.f;
-        data.uv_offset[1] = 0.f;
-        data.uv_scale     = 1.f;
-        data.input        = g_error.index_;
-        data.color_map    = get_color_map(ColorMap::Magma).index_;
-        g_error_color_map.render(cb, g_error_color, &data);
-
-        transfers[0]               = g_error_color.blit_barrier();
-        transfers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        vkCmdPipelineBarrier(cb,
-                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             0,
-                             0,
-                             nullptr,
-                             0,
-                             nullptr,
-                             1,
-                             transfers);
-
-        // Issue readback and transition host image to general layout
-        g_error_color.readback(cb, g_error_readback);
-        transfers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        transfers[0].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        transfers[0].oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        transfers[0].newLayout     = VK_IMAGE_LAYOUT_GENERAL;
-        transfers[0].image         = g_error_readback.image_;
-        vkCmdPipelineBarrier(cb,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             0,
-                             0,
-                             nullptr,
-                             0,
-                             nullptr,
-                             1,
-                             transfers);
-    }
-
-    transfers[0] = g_reference.yycxcz_.sample_barrier();
-    transfers[1] = g_test.yycxcz_.sample_barrier();
-    transfers[2] = g_reference.source_.sample_barrier();
-    transfers[3] = g_test.source_.sample_barrier();
-    transfers[4] = g_reference.yycxcz_blurred_.sample_barrier();
-    transfers[5] = g_test.yycxcz_blurred_.sample_barrier();
-    transfers[6] = g_error.sample_barrier(
-        output_path ? VK_ACCESS_MEMORY_READ_BIT : VK_ACCESS_MEMORY_WRITE_BIT);
-    transfers[7] = g_reference.yycxcz_blur_x_.sample_barrier();
-    vkCmdPipelineBarrier(cb,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                         0,
-                         0,
-                         nullptr,
-                         0,
-                         nullptr,
-                         8,
-                         transfers);
-
-    vkEndCommandBuffer(cb);
-    VkSubmitInfo submit{
-        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount   = 0,
-        .commandBufferCount   = 1,
-        .pCommandBuffers      = &cb,
-        .signalSemaphoreCount = 0,
+    if (g_backend != FLOP_BACKEND_VULKAN)
+    {
+        s_error = "The Vulkan backend is not in use.";
+        return 1;
+    }
+
+    *out_device = {
+        .instance              = g_instance,
+        .physical_device       = g_physical_device,
+        .device                = g_device,
+        .graphics_queue        = g_graphics_queue,
+        .graphics_queue_family = g_graphics_queue_index,
+        .external_memory_fd    = g_external_memory_fd_supported ? 1 : 0,
     };
-    vkQueueSubmit(g_graphics_queue, 1, &submit, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(g_device);
+    return 0;
+}
 
-    if (output_path)
+int flop_analyze_vulkan_images(FlopContext* context,
+                               FlopVulkanImage const* reference,
+                               FlopVulkanImage const* test,
+                               float exposure,
+                               int tonemapper,
+                               FlopSummary* out_summary)
+{
+    if (flop_init(0, nullptr))
     {
-        g_error_readback.write(output_path);
+        return 1;
+    }
+    if (!context)
+    {
+        context = &g_context;
     }
 
-    auto end_time = std::chrono::high_resolution_clock::now();
+    if (context->analyze_external(
+            *reference, *test, exposure, tonemapper + 1, out_summary))
+    {
+        s_error = context->error_message_;
+        return 1;
+    }
+    return 0;
+}
 
-    auto delta = end_time - start_time;
-    int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(delta).count();
-    if (out_summary)
+int flop_context_get_histogram(FlopContext* context,
+                               uint32_t* out_counts,
+                               float* out_cdf,
+                               float* out_lower_edges,
+                               int capacity)
+{
+    if (!context)
     {
-        out_summary->milliseconds_elapsed = elapsed;
+        context = &g_context;
     }
 
-    std::cout << "Evaluation time: " << elapsed << "ms\n"
-              << "Error histogram: \n[";
+    int bucket_count = context->histogram_buckets_;
+    int count        = std::clamp(capacity, 0, bucket_count);
+    if (out_counts)
+    {
+        std::copy_n(context->histogram_counts_.data(), count, out_counts);
+    }
+    if (out_cdf)
+    {
+        std::copy_n(context->histogram_cdf_.data(), count, out_cdf);
+    }
+    if (out_lower_edges)
+    {
+        for (int i = 0; i != count; ++i)
+        {
+            float position = static_cast<float>(i) / bucket_count;
+            if (context->histogram_scale_ == FLOP_HISTOGRAM_LINEAR)
+            {
+                out_lower_edges[i] = position;
+            }
+            else
+            {
+                out_lower_edges[i]
+                    = i == 0 ? 0.f : std::exp2(16.f * (position - 1.f));
+            }
+        }
+    }
+    return bucket_count;
+}
 
-    uint32_t histogram[32];
-    std::memcpy(histogram, g_error_histogram.data_, sizeof(uint32_t) * 32);
-    std::printf("%i", histogram[0]);
-    uint32_t sample_count = histogram[0];
-    for (uint32_t i = 1; i != 32u; ++i)
+int flop_analyze_batch(FlopContext* context,
+                       FlopPair const* pairs,
+                       int pair_count,
+                       float exposure,
+                       int tonemapper,
+                       FlopSummary* out_summaries,
+                       FlopBatchSummary* out_batch_summary)
+{
+    if (flop_init(0, nullptr))
     {
-        std::printf(", %i", histogram[i]);
+        return 1;
+    }
+    if (!context)
+    {
+        context = &g_context;
     }
-    std::printf("]\n");
 
+    if (context->analyze_batch(pairs,
+                               pair_count,
+                               exposure,
+                               tonemapper + 1,
+                               out_summaries,
+                               out_batch_summary))
+    {
+        s_error = context->error_message_;
+        return 1;
+    }
     return 0;
 }
 
-int flop_analyze(char const* reference_path,
-                 char const* test_path,
-                 char const* output_path,
-                 FlopSummary* out_summary)
+int flop_analyze_manifest(FlopContext* context,
+                          char const* manifest_path,
+                          float exposure,
+                          int tonemapper,
+                          FlopSummary* out_summaries,
+                          int summary_capacity,
+                          FlopBatchSummary* out_batch_summary)
 {
-    flop_init(0, nullptr);
-    return flop_analyze_impl(
-        reference_path, test_path, output_path, 1.f, 0, out_summary, false);
-}
+    std::ifstream manifest{manifest_path};
+    if (!manifest)
+    {
+        s_error = "Unable to open manifest.";
+        return 1;
+    }
 
-int flop_analyze_hdr(char const* reference_path,
-                     char const* test_path,
-                     char const* output_path,
-                     float exposure,
-                     int tonemapper,
-                     FlopSummary* out_summary)
-{
-    flop_init(0, nullptr);
-    return flop_analyze_impl(reference_path,
-                             test_path,
-                             output_path,
-                             exposure,
-                             tonemapper + 1,
-                             out_summary,
-                             false);
+    // Parse all entries up front so the FlopPair array can point into stable
+    // storage
+    std::vector<std::string> paths;
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        size_t first  = line.find('\t');
+        size_t second = first == std::string::npos
+                            ? std::string::npos
+                            : line.find('\t', first + 1);
+        if (first == std::string::npos)
+        {
+            s_error = "Manifest entry is missing a test path.";
+            return 1;
+        }
+        paths.push_back(line.substr(0, first));
+        paths.push_back(line.substr(first + 1, second - first - 1));
+        paths.push_back(
+            second == std::string::npos ? "" : line.substr(second + 1));
+    }
+
+    std::vector<FlopPair> pairs(paths.size() / 3);
+    for (size_t i = 0; i != pairs.size(); ++i)
+    {
+        pairs[i].reference_path = paths[i * 3].c_str();
+        pairs[i].test_path      = paths[i * 3 + 1].c_str();
+        pairs[i].output_path
+            = paths[i * 3 + 2].empty() ? nullptr : paths[i * 3 + 2].c_str();
+    }
+
+    int pair_count   = static_cast<int>(pairs.size());
+    summary_capacity = std::clamp(summary_capacity, 0, pair_count);
+    if (!out_summaries || summary_capacity == pair_count)
+    {
+        return flop_analyze_batch(context,
+                                  pairs.data(),
+                                  pair_count,
+                                  exposure,
+                                  tonemapper,
+                                  out_summaries,
+                                  out_batch_summary);
+    }
+
+    std::vector<FlopSummary> summaries(pairs.size());
+    int result = flop_analyze_batch(context,
+                                    pairs.data(),
+                                    pair_count,
+                                    exposure,
+                                    tonemapper,
+                                    summaries.data(),
+                                    out_batch_summary);
+    std::copy(summaries.begin(),
+              summaries.begin() + summary_capacity,
+              out_summaries);
+    return result;
 }
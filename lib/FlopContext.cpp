@@ -0,0 +1,2501 @@
+#include "FlopContext.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <vector>
+
+#include "ColorMaps.hpp"
+#include "ResultCache.hpp"
+#include "VkGlobals.hpp"
+
+// Forward declare STBI calls to avoid including a massive header
+extern "C"
+{
+    int stbi_write_png(char const* filename,
+                       int w,
+                       int h,
+                       int comp,
+                       const void* data,
+                       int stride_in_bytes);
+}
+
+using namespace flop;
+
+// Bands shorter than this are dominated by the apron and dispatch overhead
+constexpr static int32_t s_min_band_rows = 256;
+
+// Device memory per pixel of a band: both sources (at most RGBA32F), four
+// RGBA32F intermediates per source, and the R32F error, RGBA8 color-mapped
+// error and readback images
+constexpr static VkDeviceSize s_band_bytes_per_pixel = 2 * (16 + 4 * 16) + 3 * 4;
+
+// Maximum bucket count of the configurable histogram
+constexpr static uint32_t s_max_histogram_buckets = 4096;
+
+// Size of the statistics scratch buffer: the error sum, max and padding,
+// followed by STATISTICS_BIN_COUNT bins and the configurable histogram (see
+// Statistics.hlsli)
+constexpr static uint32_t s_statistics_scratch_size
+    = (4 + 1024 + s_max_histogram_buckets) * 4;
+
+// Statistics resolved by Statistics.hlsl, followed by the counts and
+// cumulative distribution of the configurable histogram
+struct ErrorStatistics
+{
+    float mean;
+    float max;
+    float weighted_median;
+    float p50;
+    float p95;
+    float p99;
+    float gate_percentile;
+    uint32_t gate_failed;
+};
+constexpr static uint32_t s_statistics_size
+    = sizeof(ErrorStatistics) + 2 * s_max_histogram_buckets * 4;
+
+// One timestamp before the first stage, and one after every stage
+constexpr static uint32_t s_timestamp_count = FLOP_STAGE_COUNT + 1;
+
+static float
+milliseconds_since(std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<float, std::milli> delta
+        = std::chrono::high_resolution_clock::now() - start;
+    return delta.count();
+}
+
+static bool half_precision()
+{
+    return g_precision == FLOP_PRECISION_HALF && g_half_precision_supported;
+}
+
+// Bump whenever a change to the pipeline changes its results, so that results
+// cached by earlier versions are no longer found
+constexpr static uint32_t s_result_version = 1;
+
+// Hashes the contents of both files of a pair, along with every parameter that
+// affects its result
+static uint64_t
+result_key(PairFingerprint const& fingerprint, float exposure, int tonemap)
+{
+    uint32_t parameters[] = {
+        s_result_version,
+        std::bit_cast<uint32_t>(exposure),
+        static_cast<uint32_t>(tonemap),
+        static_cast<uint32_t>(g_backend),
+        half_precision(),
+        static_cast<uint32_t>(g_histogram_buckets),
+        static_cast<uint32_t>(g_histogram_scale),
+        g_gate_enabled,
+        std::bit_cast<uint32_t>(g_gate.mean_error),
+        std::bit_cast<uint32_t>(g_gate.percentile),
+        std::bit_cast<uint32_t>(g_gate.percentile_error),
+        std::bit_cast<uint32_t>(g_gate.max_error),
+        std::bit_cast<uint32_t>(g_pixels_per_degree),
+    };
+    uint64_t hashes[] = {fingerprint.reference_hash_, fingerprint.test_hash_};
+    uint64_t hash     = hash_bytes(hashes, sizeof(hashes));
+    return hash_bytes(parameters, sizeof(parameters), hash);
+}
+
+// Decodes the reference image on a worker while the test image is decoded on
+// the calling thread. A cached reference is not decoded at all.
+//
+// Neither image is decoded if the result of the pair is found in the result
+// cache (in which case its error image is copied to output_path), or if both
+// files are bit-identical, in which case only the extent of the reference is
+// read from its header. The result cache is only consulted if lookup_result is
+// set.
+static DecodedPair decode_pair(char const* reference_path,
+                               char const* test_path,
+                               char const* output_path,
+                               float exposure,
+                               int tonemap,
+                               bool reference_cached,
+                               bool lookup_result = true)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    DecodedPair decoded;
+    bool use_cache = lookup_result && !g_result_cache_directory.empty();
+    decoded.fingerprint_
+        = fingerprint_pair(reference_path, test_path, use_cache);
+    if (use_cache && decoded.fingerprint_.valid_
+        && !decoded.fingerprint_.identical_)
+    {
+        decoded.result_key_
+            = result_key(decoded.fingerprint_, exposure, tonemap);
+        CachedResult& result = decoded.cached_result_;
+        if (load_result(decoded.result_key_, result))
+        {
+            // With a gate, only failing pairs have an error image
+            bool needs_image
+                = output_path
+                  && (!g_gate_enabled || result.summary_.gate_failed);
+            decoded.result_cached_
+                = !needs_image
+                  || load_error_image(decoded.result_key_, output_path);
+        }
+        if (decoded.result_cached_)
+        {
+            decoded.milliseconds_ = milliseconds_since(start_time);
+            return decoded;
+        }
+    }
+
+    // A bit-identical pair is resolved from its extent alone (see
+    // FlopContext::resolve_early). Images whose header can't be read are
+    // decoded, so that the regular evaluation reports the failure.
+    if (decoded.fingerprint_.identical_
+        && Image::read_extent(reference_path,
+                              decoded.identical_width_,
+                              decoded.identical_height_))
+    {
+        decoded.reference_cached_ = reference_cached;
+        decoded.milliseconds_     = milliseconds_since(start_time);
+        return decoded;
+    }
+
+    std::future<ImageData> reference;
+    if (!reference_cached)
+    {
+        reference
+            = std::async(std::launch::async, Image::decode, reference_path);
+    }
+
+    if (!decoded.fingerprint_.identical_)
+    {
+        decoded.test_ = Image::decode(test_path);
+    }
+    if (reference_cached)
+    {
+        decoded.reference_cached_ = true;
+    }
+    else
+    {
+        decoded.reference_ = reference.get();
+    }
+    decoded.milliseconds_ = milliseconds_since(start_time);
+    return decoded;
+}
+
+// A reference file is identified by its path, size and modification time. The
+// key is empty if the file can't be queried.
+static ReferenceKey
+reference_key(char const* path, float exposure, int tonemap)
+{
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    if (error)
+    {
+        return {};
+    }
+    auto time = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        return {};
+    }
+    int64_t ticks = time.time_since_epoch().count();
+
+    uint64_t hash = hash_bytes(&size, sizeof(size));
+    return {.path_     = path,
+            .hash_     = hash_bytes(&ticks, sizeof(ticks), hash),
+            .exposure_ = exposure,
+            .tonemap_  = tonemap};
+}
+
+// Pixels in caller memory are identified by a hash of their contents
+static ReferenceKey
+reference_key(ImageData const& data, float exposure, int tonemap)
+{
+    int32_t header[] = {data.width_, data.height_, data.hdr_, data.half_};
+    uint64_t hash    = hash_bytes(header, sizeof(header));
+
+    auto rows       = static_cast<uint8_t const*>(data.data_);
+    size_t row_size = data.pixel_size() * data.width_;
+    for (int32_t y = 0; y != data.height_; ++y)
+    {
+        hash = hash_bytes(rows + data.row_pitch() * y, row_size, hash);
+    }
+    // A zero hash would make the key empty
+    return {.hash_     = hash | 1,
+            .exposure_ = exposure,
+            .tonemap_  = tonemap};
+}
+
+// Returns the number of rows evaluated per band for images of the supplied
+// extent, or 0 if the image should be evaluated at once. Bands are evaluated
+// with an apron of the supplied number of rows above and below, which covers
+// the rows read by the vertical filters (the radius of the filter kernels).
+static int32_t band_rows(int32_t width, int32_t height, int32_t apron)
+{
+    int64_t rows = g_band_rows;
+    if (rows == 0)
+    {
+        rows = g_band_budget / (s_band_bytes_per_pixel * std::max(width, 1));
+        rows = std::max<int64_t>(rows, s_min_band_rows);
+    }
+
+    // Band images, including their apron, may not exceed the maximum image
+    // dimension either
+    int64_t max_rows
+        = g_physical_device_props.limits.maxImageDimension2D - 2 * apron;
+    rows = std::min(rows, max_rows);
+
+    return height > rows ? static_cast<int32_t>(rows) : 0;
+}
+
+// Records the end of a stage, or the start of the first if stage is -1
+static void write_timestamp(VkCommandBuffer cb, VkQueryPool pool, int stage)
+{
+    if (pool != VK_NULL_HANDLE)
+    {
+        vkCmdWriteTimestamp(cb,
+                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            pool,
+                            static_cast<uint32_t>(stage + 1));
+    }
+}
+
+// Describes pixels in caller memory as borrowed image data. Returns 1 if the
+// pixels are invalid.
+static int borrow_pixels(FlopPixels const& pixels, ImageData& data)
+{
+    data.data_     = const_cast<void*>(pixels.data);
+    data.width_    = pixels.width;
+    data.height_   = pixels.height;
+    data.channels_ = 4;
+    data.stride_   = static_cast<size_t>(std::max(pixels.stride, 0));
+    data.hdr_      = pixels.format != FLOP_PIXEL_FORMAT_RGBA8;
+    data.half_     = pixels.format == FLOP_PIXEL_FORMAT_RGBA16F;
+    data.owned_    = false;
+
+    bool valid = pixels.data && pixels.width > 0 && pixels.height > 0
+                 && pixels.format >= FLOP_PIXEL_FORMAT_RGBA8
+                 && pixels.format <= FLOP_PIXEL_FORMAT_RGBA32F
+                 && (data.stride_ == 0
+                     || data.stride_ >= data.pixel_size() * data.width_);
+    if (!valid)
+    {
+        data = {};
+        return 1;
+    }
+    return 0;
+}
+
+// Returns true if both images hold the same pixels in the same format
+static bool pixels_identical(ImageData const& reference, ImageData const& test)
+{
+    if (reference.width_ != test.width_ || reference.height_ != test.height_
+        || reference.hdr_ != test.hdr_ || reference.half_ != test.half_)
+    {
+        return false;
+    }
+
+    auto reference_rows = static_cast<uint8_t const*>(reference.data_);
+    auto test_rows      = static_cast<uint8_t const*>(test.data_);
+    size_t row_size     = reference.pixel_size() * reference.width_;
+    for (int32_t y = 0; y != reference.height_; ++y)
+    {
+        if (std::memcmp(reference_rows + reference.row_pitch() * y,
+                        test_rows + test.row_pitch() * y,
+                        row_size)
+            != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies the color-mapped error image in a readback image to the output
+static void write_output(Image& readback, ErrorOutput const& output)
+{
+    if (output.path_)
+    {
+        readback.write(output.path_);
+    }
+    else
+    {
+        readback.read(output.pixels_, readback.height_, output.stride_);
+    }
+}
+
+int FlopContext::init()
+{
+    if (g_backend == FLOP_BACKEND_CPU)
+    {
+        return 0;
+    }
+
+    VkCommandPoolCreateInfo command_pool_info{
+        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = g_graphics_queue_index,
+    };
+    if (vkCreateCommandPool(g_device, &command_pool_info, nullptr, &command_pool_)
+        != VK_SUCCESS)
+    {
+        error_message_ = "Failed to create Vulkan command pool.";
+        return 1;
+    }
+
+    VkCommandBufferAllocateInfo command_buffer_info{
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool        = command_pool_,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1};
+    if (vkAllocateCommandBuffers(g_device, &command_buffer_info, &command_buffer_)
+        != VK_SUCCESS)
+    {
+        error_message_ = "Failed to allocate Vulkan command buffers.";
+        return 1;
+    }
+
+    VkFenceCreateInfo fence_info{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    if (vkCreateFence(g_device, &fence_info, nullptr, &fence_) != VK_SUCCESS)
+    {
+        error_message_ = "Failed to create Vulkan fence.";
+        return 1;
+    }
+
+    if (upload_ring_.init(command_pool_))
+    {
+        error_message_ = "Failed to create the upload staging ring.";
+        return 1;
+    }
+
+    VkSemaphoreTypeCreateInfo timeline_info{
+        .sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue  = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timeline_info,
+    };
+    if (vkCreateSemaphore(g_device, &semaphore_info, nullptr, &timeline_)
+        != VK_SUCCESS)
+    {
+        error_message_ = "Failed to create Vulkan timeline semaphore.";
+        return 1;
+    }
+
+    if (g_compute_queue != VK_NULL_HANDLE)
+    {
+        VkCommandPoolCreateInfo upload_pool_info{
+            .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = g_compute_queue_index,
+        };
+        if (vkCreateCommandPool(
+                g_device, &upload_pool_info, nullptr, &upload_command_pool_)
+            != VK_SUCCESS)
+        {
+            error_message_ = "Failed to create Vulkan command pool.";
+            return 1;
+        }
+
+        VkCommandBufferAllocateInfo upload_buffer_info{
+            .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool        = upload_command_pool_,
+            .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1};
+        if (vkAllocateCommandBuffers(
+                g_device, &upload_buffer_info, &upload_command_buffer_)
+            != VK_SUCCESS)
+        {
+            error_message_ = "Failed to allocate Vulkan command buffers.";
+            return 1;
+        }
+
+        if (vkCreateSemaphore(
+                g_device, &semaphore_info, nullptr, &upload_timeline_)
+            != VK_SUCCESS)
+        {
+            error_message_ = "Failed to create Vulkan timeline semaphore.";
+            return 1;
+        }
+    }
+
+    if (g_timestamp_valid_bits != 0)
+    {
+        VkQueryPoolCreateInfo query_pool_info{
+            .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = s_timestamp_count,
+        };
+        if (vkCreateQueryPool(g_device, &query_pool_info, nullptr, &timestamps_)
+            != VK_SUCCESS)
+        {
+            error_message_ = "Failed to create Vulkan timestamp query pool.";
+            return 1;
+        }
+    }
+
+    error_histogram_ = Buffer::create(sizeof(uint32_t) * 32);
+    error_statistics_scratch_
+        = Buffer::create_scratch(s_statistics_scratch_size);
+    error_statistics_ = Buffer::create(s_statistics_size);
+    filter_kernel_weights_ = Buffer::create(s_filter_kernels_size);
+
+    return 0;
+}
+
+void FlopContext::destroy()
+{
+    if (command_pool_ == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    reset(false);
+    upload_ring_.destroy();
+    if (upload_command_pool_ != VK_NULL_HANDLE)
+    {
+        release_staged_sources();
+        vkDestroySemaphore(g_device, upload_timeline_, nullptr);
+        vkDestroyCommandPool(g_device, upload_command_pool_, nullptr);
+        upload_timeline_       = VK_NULL_HANDLE;
+        upload_timeline_value_ = 0;
+        upload_command_buffer_ = VK_NULL_HANDLE;
+        upload_command_pool_   = VK_NULL_HANDLE;
+    }
+    error_histogram_.reset();
+    error_statistics_scratch_.reset();
+    error_statistics_.reset();
+    filter_kernel_weights_.reset();
+    filter_kernels_ = {};
+    if (timestamps_ != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(g_device, timestamps_, nullptr);
+        timestamps_ = VK_NULL_HANDLE;
+    }
+    vkDestroySemaphore(g_device, timeline_, nullptr);
+    vkDestroyFence(g_device, fence_, nullptr);
+    vkDestroyCommandPool(g_device, command_pool_, nullptr);
+    timeline_       = VK_NULL_HANDLE;
+    fence_          = VK_NULL_HANDLE;
+    command_buffer_ = VK_NULL_HANDLE;
+    command_pool_   = VK_NULL_HANDLE;
+}
+
+void FlopContext::load_reference(char const* reference_path)
+{
+    release_reference();
+    ImageData data     = Image::decode(reference_path);
+    reference_.source_ = Image::create_from_data(data, upload_ring_);
+    data.reset();
+}
+
+void FlopContext::load_test(char const* test_path)
+{
+    ImageData data = Image::decode(test_path);
+    test_.source_  = Image::create_from_data(data, upload_ring_);
+    data.reset();
+}
+
+void FlopContext::upload_sources(DecodedPair& decoded, FlopSummary& summary)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // Staged images are already uploaded, or will be by the time the
+    // evaluation waiting on the upload timeline starts
+    Image staged_reference;
+    Image staged_test;
+    float staged_milliseconds = 0.f;
+    if (decoded.upload_value_ != 0)
+    {
+        staged_reference    = staged_.reference_;
+        staged_test         = staged_.test_;
+        staged_milliseconds = staged_.milliseconds_;
+        staged_.reference_  = {};
+        staged_.test_       = {};
+    }
+
+    if (!decoded.reference_cached_)
+    {
+        release_reference();
+        reference_.source_
+            = staged_reference.image_ != VK_NULL_HANDLE
+                  ? staged_reference
+                  : Image::create_from_data(decoded.reference_, upload_ring_);
+        reference_key_ = decoded.reference_key_;
+    }
+    test_.source_.reset();
+    test_.source_ = staged_test.image_ != VK_NULL_HANDLE
+                        ? staged_test
+                        : Image::create_from_data(decoded.test_, upload_ring_);
+    decoded.reference_.reset();
+    decoded.test_.reset();
+
+    summary.upload_milliseconds
+        = milliseconds_since(start_time) + staged_milliseconds;
+}
+
+void FlopContext::stage_sources(DecodedPair& decoded)
+{
+    bool stage_reference = !decoded.reference_cached_;
+    if (upload_command_buffer_ == VK_NULL_HANDLE || decoded.result_cached_
+        || decoded.fingerprint_.identical_ || !decoded.test_.data_
+        || (stage_reference && !decoded.reference_.data_))
+    {
+        return;
+    }
+    if (stage_reference
+        && band_rows(decoded.reference_.width_,
+                     decoded.reference_.height_,
+                     filter_kernels_.radius_)
+               != 0)
+    {
+        return;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // The previous upload was adopted by an evaluation that has since
+    // retired, so this doesn't block in practice
+    release_staged_sources();
+
+    VkCommandBufferBeginInfo begin{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(upload_command_buffer_, &begin);
+    if (stage_reference)
+    {
+        ImageData const& data = decoded.reference_;
+        staged_.reference_    = Image::create_for_data(data, data.height_);
+        staged_.staging_[0]   = staged_.reference_.record_upload(
+            data, 0, data.height_, upload_command_buffer_);
+    }
+    ImageData const& test = decoded.test_;
+    staged_.test_         = Image::create_for_data(test, test.height_);
+    staged_.staging_[1]   = staged_.test_.record_upload(
+        test, 0, test.height_, upload_command_buffer_);
+    vkEndCommandBuffer(upload_command_buffer_);
+
+    decoded.upload_value_ = ++upload_timeline_value_;
+    submit_and_signal(upload_command_buffer_,
+                      upload_timeline_,
+                      decoded.upload_value_,
+                      VK_NULL_HANDLE,
+                      0,
+                      g_compute_queue);
+    staged_.milliseconds_ = milliseconds_since(start_time);
+}
+
+void FlopContext::release_staged_sources()
+{
+    if (upload_timeline_value_ != 0)
+    {
+        wait_timeline(upload_timeline_, upload_timeline_value_);
+    }
+    staged_.reference_.reset();
+    staged_.test_.reset();
+    staged_.staging_[0].reset();
+    staged_.staging_[1].reset();
+    staged_.milliseconds_ = 0.f;
+}
+
+void FlopContext::release_reference()
+{
+    reference_.source_.reset();
+    reference_.features_.reset();
+    reference_key_      = {};
+    reference_filtered_ = false;
+}
+
+bool FlopContext::reference_cached(ReferenceKey const& key) const
+{
+    return g_reference_cache && g_backend == FLOP_BACKEND_VULKAN
+           && reference_filtered_ && !key.empty() && key == reference_key_;
+}
+
+void FlopContext::reload_reference(DecodedPair& decoded)
+{
+    if (!decoded.reference_cached_ || reference_cached(decoded.reference_key_))
+    {
+        return;
+    }
+
+    // Borrowed pixels are still available, but a file must be decoded
+    if (!decoded.reference_.data_)
+    {
+        auto start_time    = std::chrono::high_resolution_clock::now();
+        decoded.reference_ = Image::decode(decoded.reference_key_.path_.c_str());
+        decoded.milliseconds_ += milliseconds_since(start_time);
+    }
+    decoded.reference_cached_ = false;
+}
+
+FilterKernels const&
+FlopContext::update_filter_kernels(float pixels_per_degree)
+{
+    if (filter_kernels_.radius_ != 0
+        && filter_kernels_.pixels_per_degree_ == pixels_per_degree)
+    {
+        return filter_kernels_;
+    }
+
+    filter_kernels_ = compute_filter_kernels(pixels_per_degree);
+    // A reference filtered with other kernels can't be reused
+    reference_filtered_ = false;
+    if (filter_kernel_weights_.data_)
+    {
+        pack_filter_kernels(filter_kernels_,
+                            static_cast<float*>(filter_kernel_weights_.data_));
+        vmaFlushAllocation(
+            g_allocator, filter_kernel_weights_.allocation_, 0, VK_WHOLE_SIZE);
+    }
+    return filter_kernels_;
+}
+
+void FlopContext::reset(bool keep_sources)
+{
+    // Submissions made by this context are retired before analyze returns, so
+    // there is no need to idle the device here. Callers that sample these
+    // images from their own command buffers (e.g. the viewer) must synchronize
+    // with that work before resetting.
+    if (!keep_sources)
+    {
+        release_reference();
+        test_.source_.reset();
+    }
+    reference_.yycxcz_.reset();
+    reference_.yycxcz_blur_x_.reset();
+    reference_.yycxcz_blurred_.reset();
+    reference_.feature_blur_x_.reset();
+    reference_.features_.reset();
+    reference_filtered_ = false;
+    test_.yycxcz_.reset();
+    test_.yycxcz_blur_x_.reset();
+    test_.yycxcz_blurred_.reset();
+    test_.feature_blur_x_.reset();
+    error_.reset();
+    error_color_.reset();
+    error_readback_[0].reset();
+    error_readback_[1].reset();
+}
+
+bool FlopContext::intermediates_match() const
+{
+    VkFormat error_format
+        = half_precision() ? VK_FORMAT_R16_SFLOAT : VK_FORMAT_R32_SFLOAT;
+    return error_.width_ == reference_.source_.width_
+           && error_.height_ == reference_.source_.height_
+           && error_.format_ == error_format;
+}
+
+void FlopContext::create_intermediates(int readback_count)
+{
+    Image const& source = reference_.source_;
+
+    // Intermediates are fully overwritten by every evaluation, so they are
+    // only recreated when the extent of the source images (or the requested
+    // precision) changes. Released images return to the image pool, so
+    // alternating between resolutions (or between contexts) does not
+    // reallocate either.
+    if (!intermediates_match())
+    {
+        reset(true);
+
+        bool half       = half_precision();
+        VkFormat format = half ? VK_FORMAT_R16G16B16A16_SFLOAT
+                               : VK_FORMAT_R32G32B32A32_SFLOAT;
+        VkFormat error_format
+            = half ? VK_FORMAT_R16_SFLOAT : VK_FORMAT_R32_SFLOAT;
+
+        reference_.yycxcz_         = Image::create(source, format);
+        reference_.yycxcz_blur_x_  = Image::create(source, format);
+        reference_.yycxcz_blurred_ = Image::create(source, format);
+        reference_.feature_blur_x_ = Image::create(source, format);
+        test_.yycxcz_              = Image::create(source, format);
+        test_.yycxcz_blur_x_       = Image::create(source, format);
+        test_.yycxcz_blurred_      = Image::create(source, format);
+        test_.feature_blur_x_      = Image::create(source, format);
+
+        error_ = Image::create(source, error_format);
+    }
+
+    // The fully filtered reference is only retained if it can be identified
+    // by later evaluations
+    if (g_reference_cache && !reference_key_.empty()
+        && reference_.features_.image_ == VK_NULL_HANDLE)
+    {
+        reference_.features_
+            = Image::create(source, reference_.yycxcz_blurred_.format_);
+    }
+
+    if (readback_count > 0 && error_color_.image_ == VK_NULL_HANDLE)
+    {
+        error_color_ = Image::create(source, VK_FORMAT_R8G8B8A8_UNORM);
+    }
+    for (int i = 0; i != readback_count; ++i)
+    {
+        if (error_readback_[i].image_ == VK_NULL_HANDLE)
+        {
+            error_readback_[i]
+                = Image::create_readback(source, VK_FORMAT_R8G8B8A8_UNORM);
+        }
+    }
+}
+
+int FlopContext::analyze(char const* reference_path,
+                         char const* test_path,
+                         char const* output_path,
+                         float exposure,
+                         int tonemap,
+                         FlopSummary* out_summary,
+                         bool bypass_initialization)
+{
+    if (!bypass_initialization && !std::filesystem::exists(reference_path))
+    {
+        error_message_ = "Invalid reference path.";
+        return 1;
+    }
+
+    if (!bypass_initialization && !std::filesystem::exists(test_path))
+    {
+        error_message_ = "Invalid test path.";
+        return 1;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    ErrorOutput output{.path_ = output_path};
+    FlopSummary summary{};
+    uint32_t* histogram = summary.histogram;
+    if (bypass_initialization)
+    {
+        update_filter_kernels(g_pixels_per_degree);
+        if (analyze_loaded(output, exposure, tonemap, summary, histogram))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        ReferenceKey key    = reference_key(reference_path, exposure, tonemap);
+        DecodedPair decoded = decode_pair(reference_path,
+                                          test_path,
+                                          output_path,
+                                          exposure,
+                                          tonemap,
+                                          reference_cached(key));
+        decoded.reference_key_ = std::move(key);
+        if (!resolve_early(decoded, output, summary))
+        {
+            if (analyze_decoded(
+                    decoded, output, exposure, tonemap, summary, histogram))
+            {
+                return 1;
+            }
+            if (decoded.result_key_ != 0)
+            {
+                store_result(
+                    decoded.result_key_, cached_result(summary), output_path);
+            }
+        }
+    }
+
+    summary.milliseconds_elapsed
+        = static_cast<int>(milliseconds_since(start_time));
+    if (out_summary)
+    {
+        *out_summary = summary;
+    }
+
+    if (log_summary_)
+    {
+        print_summary(summary);
+    }
+
+    return 0;
+}
+
+int FlopContext::analyze_pixels(FlopPixels const& reference,
+                                FlopPixels const& test,
+                                uint8_t* error_map,
+                                size_t error_map_stride,
+                                float exposure,
+                                int tonemap,
+                                FlopSummary* out_summary)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    DecodedPair decoded;
+    if (borrow_pixels(reference, decoded.reference_))
+    {
+        error_message_ = "Invalid reference pixels.";
+        return 1;
+    }
+    if (borrow_pixels(test, decoded.test_))
+    {
+        error_message_ = "Invalid test pixels.";
+        return 1;
+    }
+    if (g_reference_cache && g_backend == FLOP_BACKEND_VULKAN)
+    {
+        decoded.reference_key_
+            = reference_key(decoded.reference_, exposure, tonemap);
+        decoded.reference_cached_ = reference_cached(decoded.reference_key_);
+    }
+
+    ErrorOutput output{
+        .pixels_ = error_map,
+        .stride_ = error_map_stride != 0
+                       ? error_map_stride
+                       : static_cast<size_t>(reference.width) * 4};
+    FlopSummary summary{};
+    uint32_t* histogram = summary.histogram;
+    if (pixels_identical(decoded.reference_, decoded.test_))
+    {
+        resolve_identical(reference.width, reference.height, output, summary);
+    }
+    else if (analyze_decoded(
+                 decoded, output, exposure, tonemap, summary, histogram))
+    {
+        return 1;
+    }
+
+    summary.milliseconds_elapsed
+        = static_cast<int>(milliseconds_since(start_time));
+    if (out_summary)
+    {
+        *out_summary = summary;
+    }
+
+    if (log_summary_)
+    {
+        print_summary(summary);
+    }
+
+    return 0;
+}
+
+int FlopContext::analyze_viewing_conditions(
+    char const* reference_path,
+    char const* test_path,
+    float const* pixels_per_degree,
+    int count,
+    char const* const* output_paths,
+    float exposure,
+    int tonemap,
+    FlopSummary* out_summaries)
+{
+    if (!std::filesystem::exists(reference_path))
+    {
+        error_message_ = "Invalid reference path.";
+        return 1;
+    }
+
+    if (!std::filesystem::exists(test_path))
+    {
+        error_message_ = "Invalid test path.";
+        return 1;
+    }
+
+    if (count <= 0 || !pixels_per_degree)
+    {
+        error_message_ = "No viewing conditions supplied.";
+        return 1;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // Results are cached per viewing condition of the global configuration
+    // only, so the result cache is bypassed
+    ReferenceKey key    = reference_key(reference_path, exposure, tonemap);
+    DecodedPair decoded = decode_pair(reference_path,
+                                      test_path,
+                                      nullptr,
+                                      exposure,
+                                      tonemap,
+                                      reference_cached(key),
+                                      false);
+    decoded.reference_key_ = std::move(key);
+
+    std::vector<FlopSummary> summaries(count);
+    bool banded = false;
+    int result  = 0;
+    for (int i = 0; i != count && result == 0; ++i)
+    {
+        ErrorOutput output{.path_ = output_paths ? output_paths[i] : nullptr};
+        FlopSummary& summary = summaries[i];
+        uint32_t* histogram  = summary.histogram;
+
+        float condition = clamp_pixels_per_degree(pixels_per_degree[i]);
+        FilterKernels const& kernels = update_filter_kernels(condition);
+
+        if (decoded.fingerprint_.identical_ && i != 0)
+        {
+            resolve_identical(
+                summaries[0].width, summaries[0].height, output, summary);
+            continue;
+        }
+        if (i == 0 && resolve_early(decoded, output, summary))
+        {
+            continue;
+        }
+
+        if (g_backend == FLOP_BACKEND_CPU)
+        {
+            // The decoded pair is retained for the remaining conditions
+            if (i == 0)
+            {
+                summary.decode_milliseconds = decoded.milliseconds_;
+                result = validate_decoded(decoded, summary);
+            }
+            if (result == 0)
+            {
+                evaluate_cpu(decoded,
+                             output,
+                             exposure,
+                             tonemap,
+                             kernels,
+                             summary,
+                             histogram);
+            }
+            continue;
+        }
+
+        // Images too tall to evaluate at once are evaluated in bands, which
+        // don't retain the converted sources, so the pair is decoded again
+        // for every viewing condition
+        if (i == 0)
+        {
+            reload_reference(decoded);
+            banded = !decoded.reference_cached_
+                     && band_rows(decoded.reference_.width_,
+                                  decoded.reference_.height_,
+                                  kernels.radius_)
+                            != 0;
+        }
+        if (banded)
+        {
+            if (i != 0)
+            {
+                decoded = decode_pair(reference_path,
+                                      test_path,
+                                      nullptr,
+                                      exposure,
+                                      tonemap,
+                                      false,
+                                      false);
+            }
+            int32_t height = decoded.reference_.height_;
+            int32_t rows
+                = band_rows(decoded.reference_.width_, height, kernels.radius_);
+            result = analyze_banded(decoded,
+                                    output,
+                                    exposure,
+                                    tonemap,
+                                    rows != 0 ? rows : height,
+                                    summary,
+                                    histogram);
+            continue;
+        }
+
+        // The sources are uploaded and converted to YyCxCz once, and only
+        // filtered and compared for every viewing condition
+        if (!sources_converted_)
+        {
+            summary.decode_milliseconds = decoded.milliseconds_;
+            upload_sources(decoded, summary);
+            // A cached reference skips its conversion, which the remaining
+            // conditions can't
+            reference_filtered_ = false;
+        }
+        result = analyze_loaded(output, exposure, tonemap, summary, histogram);
+        sources_converted_ = result == 0;
+    }
+    sources_converted_ = false;
+    decoded.reference_.reset();
+    decoded.test_.reset();
+    if (result)
+    {
+        return 1;
+    }
+
+    // Unless the pair is evaluated in bands, decoding and uploading are shared
+    // by every condition, and only reported by the first summary. The elapsed
+    // time covers all conditions.
+    auto milliseconds = static_cast<int>(milliseconds_since(start_time));
+    for (int i = 0; i != count; ++i)
+    {
+        summaries[i].milliseconds_elapsed = milliseconds;
+        if (out_summaries)
+        {
+            out_summaries[i] = summaries[i];
+        }
+        if (log_summary_)
+        {
+            print_summary(summaries[i]);
+        }
+    }
+
+    return 0;
+}
+
+// Binds an external image to source, returning 0 on success
+static int import_external(FlopVulkanImage const& external, Image& source)
+{
+    bool hdr;
+    switch (external.format)
+    {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        hdr = false;
+        break;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        hdr = true;
+        break;
+    default:
+        return 1;
+    }
+    if (external.width == 0 || external.height == 0
+        || external.layout == VK_IMAGE_LAYOUT_UNDEFINED
+        || external.layout == VK_IMAGE_LAYOUT_PREINITIALIZED)
+    {
+        return 1;
+    }
+
+    int32_t width  = static_cast<int32_t>(external.width);
+    int32_t height = static_cast<int32_t>(external.height);
+    if (external.image != VK_NULL_HANDLE)
+    {
+        source = Image::wrap(
+            external.image, external.format, width, height, external.layout);
+    }
+    else
+    {
+        source = Image::import_fd(external.memory_fd,
+                                  external.memory_size,
+                                  external.memory_type_index,
+                                  external.dedicated != 0,
+                                  external.usage,
+                                  external.format,
+                                  width,
+                                  height,
+                                  external.layout);
+    }
+    source.hdr_ = hdr;
+    return source.image_ == VK_NULL_HANDLE ? 1 : 0;
+}
+
+int FlopContext::analyze_external(FlopVulkanImage const& reference,
+                                  FlopVulkanImage const& test,
+                                  float exposure,
+                                  int tonemap,
+                                  FlopSummary* out_summary)
+{
+    if (g_backend == FLOP_BACKEND_CPU)
+    {
+        error_message_ = "External images require the Vulkan backend.";
+        return 1;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    release_reference();
+    test_.source_.reset();
+    if (import_external(reference, reference_.source_))
+    {
+        error_message_ = "Failed to import the reference image.";
+        return 1;
+    }
+    if (import_external(test, test_.source_))
+    {
+        reference_.source_.reset();
+        error_message_ = "Failed to import the test image.";
+        return 1;
+    }
+
+    FlopSummary summary{};
+    uint32_t* histogram = summary.histogram;
+    update_filter_kernels(g_pixels_per_degree);
+    int result
+        = analyze_loaded(ErrorOutput{}, exposure, tonemap, summary, histogram);
+
+    // The evaluation has retired, and the caller may release its images as
+    // soon as this returns
+    release_reference();
+    test_.source_.reset();
+    if (result)
+    {
+        return 1;
+    }
+
+    summary.milliseconds_elapsed
+        = static_cast<int>(milliseconds_since(start_time));
+    if (out_summary)
+    {
+        *out_summary = summary;
+    }
+
+    if (log_summary_)
+    {
+        print_summary(summary);
+    }
+
+    return 0;
+}
+
+int FlopContext::analyze_decoded(DecodedPair& decoded,
+                                 ErrorOutput const& output,
+                                 float exposure,
+                                 int tonemap,
+                                 FlopSummary& summary,
+                                 uint32_t* histogram)
+{
+    if (g_backend == FLOP_BACKEND_CPU)
+    {
+        return analyze_cpu(
+            decoded, output, exposure, tonemap, summary, histogram);
+    }
+
+    // A cached reference was evaluated at once, and a test image of matching
+    // extent is too
+    FilterKernels const& kernels = update_filter_kernels(g_pixels_per_degree);
+    reload_reference(decoded);
+    int32_t rows = band_rows(
+        decoded.reference_.width_, decoded.reference_.height_, kernels.radius_);
+    if (rows != 0 && !decoded.reference_cached_)
+    {
+        return analyze_banded(
+            decoded, output, exposure, tonemap, rows, summary, histogram);
+    }
+
+    summary.decode_milliseconds = decoded.milliseconds_;
+    upload_sources(decoded, summary);
+    return analyze_loaded(output, exposure, tonemap, summary, histogram);
+}
+
+bool FlopContext::resolve_early(DecodedPair& decoded,
+                                ErrorOutput const& output,
+                                FlopSummary& summary)
+{
+    if (decoded.result_cached_)
+    {
+        CachedResult& result        = decoded.cached_result_;
+        summary                     = result.summary_;
+        summary.decode_milliseconds = decoded.milliseconds_;
+        histogram_buckets_
+            = static_cast<int32_t>(result.histogram_counts_.size());
+        histogram_scale_  = g_histogram_scale;
+        gate_             = g_gate;
+        histogram_counts_ = std::move(result.histogram_counts_);
+        histogram_cdf_    = std::move(result.histogram_cdf_);
+        return true;
+    }
+
+    if (!decoded.fingerprint_.identical_)
+    {
+        return false;
+    }
+
+    // Only the extent of the pair is needed, which decode_pair read from the
+    // header of the reference. Otherwise, the reference was decoded instead
+    // (unless it is cached), and a reference that fails to decode is reported
+    // by the regular evaluation.
+    int32_t width  = decoded.identical_width_;
+    int32_t height = decoded.identical_height_;
+    if (width == 0)
+    {
+        reload_reference(decoded);
+        width  = reference_.source_.width_;
+        height = reference_.source_.height_;
+        if (!decoded.reference_cached_)
+        {
+            if (!decoded.reference_.data_)
+            {
+                return false;
+            }
+            width  = decoded.reference_.width_;
+            height = decoded.reference_.height_;
+            decoded.reference_.reset();
+        }
+    }
+
+    summary.decode_milliseconds = decoded.milliseconds_;
+    resolve_identical(width, height, output, summary);
+    return true;
+}
+
+void FlopContext::resolve_identical(int32_t width,
+                                    int32_t height,
+                                    ErrorOutput const& output,
+                                    FlopSummary& summary)
+{
+    auto evaluate_start = std::chrono::high_resolution_clock::now();
+
+    // The error of every pixel is zero, so every pixel lands in the first
+    // bucket of both histograms and every statistic is zero
+    auto pixel_count   = static_cast<uint32_t>(width) * height;
+    histogram_buckets_ = g_histogram_buckets;
+    histogram_scale_   = g_histogram_scale;
+    gate_              = g_gate;
+    histogram_counts_.assign(histogram_buckets_, 0u);
+    histogram_cdf_.assign(histogram_buckets_, pixel_count == 0 ? 0.f : 1.f);
+    if (histogram_buckets_ != 0)
+    {
+        histogram_counts_[0] = pixel_count;
+    }
+
+    summary.width                 = width;
+    summary.height                = height;
+    summary.mean_error            = 0.f;
+    summary.max_error             = 0.f;
+    summary.weighted_median_error = 0.f;
+    summary.p50_error             = 0.f;
+    summary.p95_error             = 0.f;
+    summary.p99_error             = 0.f;
+    // Thresholds of the gate are only exceeded by errors above them, which a
+    // zero error never is
+    summary.gate_failed = 0;
+    std::fill(std::begin(summary.histogram), std::end(summary.histogram), 0u);
+    summary.histogram[0]          = pixel_count;
+    summary.evaluate_milliseconds = milliseconds_since(evaluate_start);
+
+    if (output && (!g_gate_enabled || summary.gate_failed))
+    {
+        // Only an error image requires the zero error map
+        auto encode_start = std::chrono::high_resolution_clock::now();
+        cpu::Workspace workspace{
+            .width_  = width,
+            .height_ = height,
+            .error_  = std::vector<float>(static_cast<size_t>(pixel_count)),
+        };
+        if (output.path_)
+        {
+            cpu::write_error_map(workspace, output.path_);
+        }
+        else
+        {
+            cpu::map_error(workspace, output.pixels_, output.stride_);
+        }
+        summary.encode_milliseconds = milliseconds_since(encode_start);
+    }
+}
+
+CachedResult FlopContext::cached_result(FlopSummary const& summary) const
+{
+    CachedResult result{
+        .summary_          = summary,
+        .histogram_counts_ = histogram_counts_,
+        .histogram_cdf_    = histogram_cdf_,
+    };
+
+    // Timings describe the run that produced the result, not the result
+    FlopSummary& cached          = result.summary_;
+    cached.milliseconds_elapsed  = 0;
+    cached.decode_milliseconds   = 0.f;
+    cached.upload_milliseconds   = 0.f;
+    cached.evaluate_milliseconds = 0.f;
+    cached.encode_milliseconds   = 0.f;
+    std::fill(std::begin(cached.stage_milliseconds),
+              std::end(cached.stage_milliseconds),
+              0.f);
+    return result;
+}
+
+int FlopContext::analyze_loaded(ErrorOutput const& output,
+                                float exposure,
+                                int tonemap,
+                                FlopSummary& summary,
+                                uint32_t* histogram)
+{
+    if (validate_sources(&summary))
+    {
+        return 1;
+    }
+
+    // With a gate, the error image is written by the evaluation, but only
+    // color mapped and read back once the pair is known to fail the gate
+    bool gated = g_gate_enabled;
+    create_intermediates(output && !gated ? 1 : 0);
+
+    auto evaluate_start = std::chrono::high_resolution_clock::now();
+    VkCommandBuffer cb  = command_buffer_;
+    Image* readback     = output && !gated ? &error_readback_[0] : nullptr;
+    record(cb, readback, exposure, tonemap, nullptr, static_cast<bool>(output));
+    submit_and_wait(cb, fence_);
+    read_timestamps(summary);
+    std::memcpy(histogram, error_histogram_.data_, sizeof(uint32_t) * 32);
+    read_statistics(summary);
+
+    if (gated && output && summary.gate_failed)
+    {
+        create_intermediates(1);
+        readback = &error_readback_[0];
+        record_gated_output(cb, *readback);
+        submit_and_wait(cb, fence_);
+        read_timestamps(summary, FLOP_STAGE_COLOR_MAP);
+    }
+    summary.evaluate_milliseconds = milliseconds_since(evaluate_start);
+
+    if (readback)
+    {
+        auto encode_start = std::chrono::high_resolution_clock::now();
+        write_output(*readback, output);
+        summary.encode_milliseconds = milliseconds_since(encode_start);
+    }
+    return 0;
+}
+
+int FlopContext::analyze_banded(DecodedPair& decoded,
+                                ErrorOutput const& output,
+                                float exposure,
+                                int tonemap,
+                                int32_t band_rows,
+                                FlopSummary& summary,
+                                uint32_t* histogram)
+{
+    summary.decode_milliseconds = decoded.milliseconds_;
+
+    if (validate_decoded(decoded, summary))
+    {
+        decoded.reference_.reset();
+        decoded.test_.reset();
+        return 1;
+    }
+
+    ImageData const& reference = decoded.reference_;
+    ImageData const& test      = decoded.test_;
+    int32_t width              = reference.width_;
+    int32_t height             = reference.height_;
+
+    // The band images are sized for a band with an apron on both sides, and
+    // are reused by every band
+    int32_t apron       = filter_kernels_.radius_;
+    int32_t band_height = std::min(band_rows + 2 * apron, height);
+    release_reference();
+    test_.source_.reset();
+    reference_.source_ = Image::create_for_data(reference, band_height);
+    test_.source_      = Image::create_for_data(test, band_height);
+
+    // The error image of a band is only retained until the next band is
+    // evaluated, so with a gate, the bands of a pair that fails it are
+    // evaluated a second time to produce its error image
+    bool write = output && !g_gate_enabled;
+    // Bands are read back straight to caller memory, or stitched together in
+    // host memory before encoding
+    std::vector<uint8_t> encoded;
+    uint8_t* pixels = output.pixels_;
+    size_t stride   = output.pixels_ ? output.stride_ : width * size_t{4};
+    for (int pass = 0; pass != 2; ++pass)
+    {
+        create_intermediates(write ? 1 : 0);
+        Image* readback = write ? &error_readback_[0] : nullptr;
+        if (write && output.path_)
+        {
+            encoded.resize(static_cast<size_t>(width) * height * 4);
+            pixels = encoded.data();
+        }
+
+        Band band;
+        for (int32_t y = 0; y < height; y += band_rows)
+        {
+            int32_t first_row = std::max(y - apron, 0);
+            int32_t last_row  = std::min(y + band_rows + apron, height);
+            band.rows_        = last_row - first_row;
+            band.first_row_   = y - first_row;
+            band.row_count_   = std::min(band_rows, height - y);
+
+            auto upload_start = std::chrono::high_resolution_clock::now();
+            reference_.source_.upload_rows(
+                reference, first_row, band.rows_, upload_ring_);
+            test_.source_.upload_rows(
+                test, first_row, band.rows_, upload_ring_);
+            summary.upload_milliseconds += milliseconds_since(upload_start);
+
+            auto evaluate_start = std::chrono::high_resolution_clock::now();
+            record(command_buffer_, readback, exposure, tonemap, &band);
+            submit_and_wait(command_buffer_, fence_);
+            summary.evaluate_milliseconds += milliseconds_since(evaluate_start);
+            read_timestamps(summary);
+
+            if (readback)
+            {
+                auto encode_start = std::chrono::high_resolution_clock::now();
+                readback->read(pixels + static_cast<size_t>(y) * stride,
+                               band.row_count_,
+                               stride);
+                summary.encode_milliseconds += milliseconds_since(encode_start);
+            }
+
+            band.first_ = false;
+        }
+
+        std::memcpy(histogram, error_histogram_.data_, sizeof(uint32_t) * 32);
+        read_statistics(summary);
+        if (write || !output || !summary.gate_failed)
+        {
+            break;
+        }
+        write = true;
+    }
+
+    decoded.reference_.reset();
+    decoded.test_.reset();
+
+    if (write && output.path_)
+    {
+        auto encode_start = std::chrono::high_resolution_clock::now();
+        stbi_write_png(output.path_, width, height, 4, pixels, width * 4);
+        summary.encode_milliseconds += milliseconds_since(encode_start);
+    }
+    return 0;
+}
+
+int FlopContext::analyze_cpu(DecodedPair& decoded,
+                             ErrorOutput const& output,
+                             float exposure,
+                             int tonemap,
+                             FlopSummary& summary,
+                             uint32_t* histogram)
+{
+    summary.decode_milliseconds = decoded.milliseconds_;
+
+    int result = 1;
+    if (validate_decoded(decoded, summary) == 0)
+    {
+        evaluate_cpu(decoded,
+                     output,
+                     exposure,
+                     tonemap,
+                     update_filter_kernels(g_pixels_per_degree),
+                     summary,
+                     histogram);
+        result = 0;
+    }
+
+    decoded.reference_.reset();
+    decoded.test_.reset();
+    return result;
+}
+
+void FlopContext::evaluate_cpu(DecodedPair const& decoded,
+                               ErrorOutput const& output,
+                               float exposure,
+                               int tonemap,
+                               FilterKernels const& kernels,
+                               FlopSummary& summary,
+                               uint32_t* histogram)
+{
+    auto evaluate_start = std::chrono::high_resolution_clock::now();
+    cpu::evaluate(decoded.reference_,
+                  decoded.test_,
+                  exposure,
+                  tonemap,
+                  kernels,
+                  cpu_workspace_,
+                  histogram);
+    histogram_buckets_ = g_histogram_buckets;
+    histogram_scale_   = g_histogram_scale;
+    gate_              = g_gate;
+    cpu::resolve_statistics(cpu_workspace_,
+                            histogram_buckets_,
+                            histogram_scale_,
+                            gate_,
+                            summary,
+                            histogram_counts_,
+                            histogram_cdf_);
+    summary.evaluate_milliseconds = milliseconds_since(evaluate_start);
+
+    // With a gate, the error image is only written if the pair fails it
+    if (output && (!g_gate_enabled || summary.gate_failed))
+    {
+        auto encode_start = std::chrono::high_resolution_clock::now();
+        if (output.path_)
+        {
+            cpu::write_error_map(cpu_workspace_, output.path_);
+        }
+        else
+        {
+            cpu::map_error(cpu_workspace_, output.pixels_, output.stride_);
+        }
+        summary.encode_milliseconds = milliseconds_since(encode_start);
+    }
+}
+
+void FlopContext::print_summary(FlopSummary const& summary)
+{
+    uint32_t const* histogram = summary.histogram;
+    std::printf("Evaluation time: %ims (decode %.2fms, upload %.2fms, "
+                "evaluate %.2fms, encode %.2fms)\n",
+                summary.milliseconds_elapsed,
+                summary.decode_milliseconds,
+                summary.upload_milliseconds,
+                summary.evaluate_milliseconds,
+                summary.encode_milliseconds);
+    if (g_backend == FLOP_BACKEND_VULKAN && timestamps_ != VK_NULL_HANDLE)
+    {
+        std::printf("GPU time:");
+        for (int i = 0; i != FLOP_STAGE_COUNT; ++i)
+        {
+            std::printf("%s %s %.3fms",
+                        i == 0 ? "" : ",",
+                        flop_stage_name(static_cast<FlopStage>(i)),
+                        summary.stage_milliseconds[i]);
+        }
+        std::printf("\n");
+    }
+    std::printf("Error: mean %.4f, weighted median %.4f, p50 %.4f, p95 %.4f, "
+                "p99 %.4f, max %.4f\n",
+                summary.mean_error,
+                summary.weighted_median_error,
+                summary.p50_error,
+                summary.p95_error,
+                summary.p99_error,
+                summary.max_error);
+    if (g_gate_enabled)
+    {
+        std::printf("Gate: %s\n", summary.gate_failed ? "failed" : "passed");
+    }
+    std::cout << "Error histogram: \n[";
+
+    std::printf("%i", histogram[0]);
+    for (uint32_t i = 1; i != 32u; ++i)
+    {
+        std::printf(", %i", histogram[i]);
+    }
+    std::printf("]\n");
+}
+
+void FlopContext::read_timestamps(FlopSummary& summary, int first_stage)
+{
+    if (timestamps_ == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    // Queries preceding first_stage weren't written by the last submission
+    uint64_t timestamps[s_timestamp_count];
+    uint32_t count = s_timestamp_count - first_stage;
+    if (vkGetQueryPoolResults(g_device,
+                              timestamps_,
+                              first_stage,
+                              count,
+                              sizeof(uint64_t) * count,
+                              timestamps + first_stage,
+                              sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT)
+        != VK_SUCCESS)
+    {
+        return;
+    }
+
+    // Only the low timestampValidBits bits are meaningful, and timestampPeriod
+    // is the number of nanoseconds per tick
+    uint64_t mask = g_timestamp_valid_bits >= 64
+                        ? ~0ull
+                        : (1ull << g_timestamp_valid_bits) - 1;
+    float period  = g_physical_device_props.limits.timestampPeriod;
+    for (int i = first_stage; i != FLOP_STAGE_COUNT; ++i)
+    {
+        uint64_t ticks = (timestamps[i + 1] - timestamps[i]) & mask;
+        summary.stage_milliseconds[i] += static_cast<float>(ticks) * period * 1e-6f;
+    }
+}
+
+void FlopContext::read_statistics(FlopSummary& summary)
+{
+    ErrorStatistics statistics;
+    std::memcpy(&statistics, error_statistics_.data_, sizeof(statistics));
+    summary.mean_error            = statistics.mean;
+    summary.max_error             = statistics.max;
+    summary.weighted_median_error = statistics.weighted_median;
+    summary.p50_error             = statistics.p50;
+    summary.p95_error             = statistics.p95;
+    summary.p99_error             = statistics.p99;
+    summary.gate_failed           = statistics.gate_failed != 0;
+
+    uint8_t const* histogram = static_cast<uint8_t const*>(error_statistics_.data_)
+                               + sizeof(ErrorStatistics);
+    histogram_counts_.resize(histogram_buckets_);
+    histogram_cdf_.resize(histogram_buckets_);
+    std::memcpy(histogram_counts_.data(), histogram, histogram_buckets_ * 4);
+    std::memcpy(histogram_cdf_.data(),
+                histogram + histogram_buckets_ * 4,
+                histogram_buckets_ * 4);
+}
+
+int FlopContext::validate_decoded(DecodedPair const& decoded,
+                                  FlopSummary& summary)
+{
+    ImageData const& reference = decoded.reference_;
+    ImageData const& test      = decoded.test_;
+    if (!reference.data_)
+    {
+        error_message_ = "Failed to load reference image.";
+        return 1;
+    }
+
+    if (!test.data_)
+    {
+        error_message_ = "Failed to load test image.";
+        return 1;
+    }
+
+    if (reference.width_ != test.width_ || reference.height_ != test.height_)
+    {
+        error_message_
+            = "Reference and test images do not have matching extents.";
+        return 1;
+    }
+
+    summary.width  = reference.width_;
+    summary.height = reference.height_;
+    return 0;
+}
+
+int FlopContext::validate_sources(FlopSummary* out_summary)
+{
+    if (reference_.source_.image_ == VK_NULL_HANDLE)
+    {
+        error_message_ = "Failed to load reference image.";
+        return 1;
+    }
+
+    if (test_.source_.image_ == VK_NULL_HANDLE)
+    {
+        error_message_ = "Failed to load test image.";
+        return 1;
+    }
+
+    // Validate that the images have the same dimensions
+    if (reference_.source_.width_ != test_.source_.width_
+        || reference_.source_.height_ != test_.source_.height_)
+    {
+        error_message_
+            = "Reference and test images do not have matching extents.";
+        return 1;
+    }
+    if (out_summary)
+    {
+        out_summary->width  = reference_.source_.width_;
+        out_summary->height = reference_.source_.height_;
+    }
+    return 0;
+}
+
+void FlopContext::record(VkCommandBuffer cb,
+                         Image* readback,
+                         float exposure,
+                         int tonemap,
+                         Band const* band,
+                         bool write_error)
+{
+    // Whole-image evaluations of a reference that may be compared again
+    // write its fully filtered color and features, which later evaluations
+    // read back instead of converting and filtering the reference again
+    uint32_t reference_mode = 0;
+    if (!band && g_reference_cache
+        && reference_.features_.image_ != VK_NULL_HANDLE)
+    {
+        reference_mode = reference_filtered_ ? Kernel::FILTER_CACHED_REFERENCE
+                                             : Kernel::FILTER_OUTPUT_REFERENCE;
+    }
+    bool cached = reference_mode == Kernel::FILTER_CACHED_REFERENCE;
+
+    Band whole{.rows_      = reference_.source_.height_,
+               .first_row_ = 0,
+               .row_count_ = reference_.source_.height_};
+    if (!band)
+    {
+        band = &whole;
+    }
+    int32_t rows = band->rows_;
+
+    VkCommandBufferBeginInfo begin{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(cb, &begin);
+
+    if (timestamps_ != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(cb, timestamps_, 0, s_timestamp_count);
+    }
+    write_timestamp(cb, timestamps_, -1);
+
+    // The histogram accumulates across dispatches and must be cleared for
+    // every evaluation
+    if (band->first_)
+    {
+        histogram_buckets_ = g_histogram_buckets;
+        histogram_scale_   = g_histogram_scale;
+        gate_              = g_gate;
+
+        vkCmdFillBuffer(cb, error_histogram_.buffer_, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(
+            cb, error_statistics_scratch_.buffer_, 0, VK_WHOLE_SIZE, 0);
+        VkBufferMemoryBarrier histogram_clear[2];
+        for (int i = 0; i != 2; ++i)
+        {
+            histogram_clear[i] = {
+                .sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+                                 | VK_ACCESS_SHADER_WRITE_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = i == 0 ? error_histogram_.buffer_
+                                 : error_statistics_scratch_.buffer_,
+                .offset = 0,
+                .size   = VK_WHOLE_SIZE};
+        }
+        vkCmdPipelineBarrier(cb,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0,
+                             nullptr,
+                             2,
+                             histogram_clear,
+                             0,
+                             nullptr);
+    }
+
+    // Transfer storage images to a writable state
+    VkImageSubresourceRange transfer_range{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                           .baseMipLevel   = 0,
+                                           .levelCount     = 1,
+                                           .baseArrayLayer = 0,
+                                           .layerCount     = 1};
+    // Converted sources are retained by sources_converted_, and are only
+    // transitioned to the layout read by the filters
+    bool converted = sources_converted_;
+    VkImageMemoryBarrier transfers[10] = {
+        converted ? reference_.yycxcz_.raw_barrier(VK_ACCESS_NONE_KHR)
+                  : reference_.yycxcz_.start_barrier(),
+        converted ? test_.yycxcz_.raw_barrier(VK_ACCESS_NONE_KHR)
+                  : test_.yycxcz_.start_barrier(),
+        reference_.yycxcz_blur_x_.start_barrier(),
+        // The contents of a cached reference must be preserved
+        cached ? reference_.yycxcz_blurred_.raw_barrier()
+               : reference_.yycxcz_blurred_.start_barrier(),
+        reference_.feature_blur_x_.start_barrier(),
+        test_.yycxcz_blur_x_.start_barrier(),
+        test_.yycxcz_blurred_.start_barrier(),
+        test_.feature_blur_x_.start_barrier(),
+        error_.start_barrier()};
+    uint32_t transfer_count = 9;
+    if (reference_mode != 0)
+    {
+        transfers[transfer_count++] = cached
+                                          ? reference_.features_.raw_barrier()
+                                          : reference_.features_.start_barrier();
+    }
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         transfer_count,
+                         transfers);
+
+    // External sources are handed over in the caller's layout, and possibly by
+    // another queue family
+    if (reference_.source_.external_)
+    {
+        VkImageMemoryBarrier acquire[2] = {reference_.source_.acquire_barrier(),
+                                           test_.source_.acquire_barrier()};
+        vkCmdPipelineBarrier(cb,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0,
+                             nullptr,
+                             0,
+                             nullptr,
+                             2,
+                             acquire);
+    }
+
+    // Transform input images to YyCxCz space
+    uint32_t source_tonemap = 0;
+    float source_exposure   = 1.f;
+    if (reference_.source_.hdr_)
+    {
+        source_tonemap  = tonemap;
+        source_exposure = std::powf(2.f, exposure);
+    }
+
+    // Kernels are compiled for the precision of the intermediates they access
+    bool half
+        = reference_.yycxcz_.format_ == VK_FORMAT_R16G16B16A16_SFLOAT;
+    Kernel const& yycxcz = yycxcz_pipeline(half);
+    if (!cached && !converted)
+    {
+        yycxcz.dispatch(cb,
+                        reference_.source_,
+                        reference_.yycxcz_,
+                        source_tonemap,
+                        source_exposure,
+                        reference_.source_.channels_ == 4);
+    }
+    if (!converted)
+    {
+        yycxcz.dispatch(cb,
+                        test_.source_,
+                        test_.yycxcz_,
+                        source_tonemap,
+                        source_exposure,
+                        test_.source_.channels_ == 4);
+    }
+    write_timestamp(cb, timestamps_, FLOP_STAGE_YYCXCZ);
+
+    VkEventCreateInfo event_info{.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO,
+                                 .flags = VK_EVENT_CREATE_DEVICE_ONLY_BIT_KHR};
+
+    transfers[0] = reference_.yycxcz_.raw_barrier();
+    transfers[1] = test_.yycxcz_.raw_barrier();
+
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         2,
+                         transfers);
+
+    // Convolve input images in YyCxCz space with feature-detection kernels and
+    // the separable Gaussian filters based on the contrast sensitivity
+    // functions. Both images are filtered by a single dispatch per direction
+    // (or only the test image, if the reference is cached).
+    FilterPipelines const& filters = filter_pipelines(filter_kernels_, half);
+    filters.x_.dispatch(cb,
+                        reference_.yycxcz_,
+                        test_.yycxcz_,
+                        reference_.yycxcz_blur_x_,
+                        test_.yycxcz_blur_x_,
+                        reference_.feature_blur_x_,
+                        test_.feature_blur_x_,
+                        filter_kernel_weights_,
+                        cached ? Kernel::FILTER_CACHED_REFERENCE : 0,
+                        rows);
+    write_timestamp(cb, timestamps_, FLOP_STAGE_FILTER_X);
+
+    transfers[0] = reference_.yycxcz_blur_x_.raw_barrier();
+    transfers[1] = test_.yycxcz_blur_x_.raw_barrier();
+    transfers[2] = reference_.feature_blur_x_.raw_barrier();
+    transfers[3] = test_.feature_blur_x_.raw_barrier();
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         4,
+                         transfers);
+
+    // Finalize both convolutions in the y direction, and compare the results.
+    // The modified HyAB color difference metric is used to compute the
+    // color-based error, amplified by feature differences. The histogram of
+    // the error excludes the apron rows of a band.
+    uint32_t outputs = 0;
+    if (retain_images_)
+    {
+        outputs = Kernel::FILTER_OUTPUT_COLORS | Kernel::FILTER_OUTPUT_ERROR;
+    }
+    else if (readback || write_error)
+    {
+        outputs = Kernel::FILTER_OUTPUT_ERROR;
+    }
+    outputs |= reference_mode;
+    filters.y_.dispatch(cb,
+                        reference_.yycxcz_blur_x_,
+                        test_.yycxcz_blur_x_,
+                        reference_.yycxcz_blurred_,
+                        test_.yycxcz_blurred_,
+                        reference_.feature_blur_x_,
+                        test_.feature_blur_x_,
+                        reference_.yycxcz_blurred_,
+                        reference_.features_,
+                        error_,
+                        error_histogram_,
+                        error_statistics_scratch_,
+                        filter_kernel_weights_,
+                        histogram_buckets_,
+                        histogram_scale_,
+                        band->first_row_,
+                        band->row_count_,
+                        outputs,
+                        rows);
+    // Every caller submits the evaluation before recording another
+    reference_filtered_ = reference_mode != 0;
+
+    // Resolve the mean, max and percentiles of the error accumulated so far,
+    // and the cumulative distribution of the configurable histogram. With
+    // banded evaluation, the statistics of the last band are final.
+    VkBufferMemoryBarrier statistics_barrier{
+        .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask       = VK_ACCESS_SHADER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer              = error_statistics_scratch_.buffer_,
+        .offset              = 0,
+        .size                = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         1,
+                         &statistics_barrier,
+                         0,
+                         nullptr);
+    g_statistics.dispatch(cb,
+                          error_statistics_scratch_,
+                          error_statistics_,
+                          histogram_buckets_,
+                          gate_);
+    write_timestamp(cb, timestamps_, FLOP_STAGE_FILTER_Y);
+
+    if (readback)
+    {
+        record_output(cb, *readback, band->first_row_);
+    }
+    else
+    {
+        // Skipped stages are reported as taking no time
+        write_timestamp(cb, timestamps_, FLOP_STAGE_COLOR_MAP);
+        write_timestamp(cb, timestamps_, FLOP_STAGE_READBACK);
+    }
+
+    transfers[0] = reference_.yycxcz_.sample_barrier();
+    transfers[1] = test_.yycxcz_.sample_barrier();
+    transfers[2] = reference_.source_.sample_barrier();
+    transfers[3] = test_.source_.sample_barrier();
+    transfers[4] = reference_.yycxcz_blurred_.sample_barrier();
+    transfers[5] = test_.yycxcz_blurred_.sample_barrier();
+    transfers[6] = error_.sample_barrier(
+        readback ? VK_ACCESS_MEMORY_READ_BIT : VK_ACCESS_MEMORY_WRITE_BIT);
+    transfers[7] = reference_.yycxcz_blur_x_.sample_barrier();
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         8,
+                         transfers);
+
+    if (reference_.source_.external_)
+    {
+        transfers[0] = reference_.source_.release_barrier();
+        transfers[1] = test_.source_.release_barrier();
+        vkCmdPipelineBarrier(cb,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0,
+                             0,
+                             nullptr,
+                             0,
+                             nullptr,
+                             2,
+                             transfers);
+    }
+
+    vkEndCommandBuffer(cb);
+}
+
+void FlopContext::record_output(VkCommandBuffer cb,
+                                Image& readback,
+                                int32_t first_row)
+{
+    VkImageMemoryBarrier transfers[2]
+        = {error_color_.start_barrier(), readback.readback_barrier()};
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                             | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         2,
+                         transfers);
+
+    // Transfer monochromatic error channel via color map
+
+    transfers[0] = error_.rar_barrier();
+    // The error image was last written by the vertical filter pass
+    transfers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         transfers);
+
+    g_error_color_map.dispatch(
+        cb, error_, error_color_, get_color_map(ColorMap::Magma));
+    write_timestamp(cb, timestamps_, FLOP_STAGE_COLOR_MAP);
+
+    transfers[0] = error_color_.blit_barrier();
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         transfers);
+
+    // Issue readback and transition host image to general layout
+    error_color_.readback(cb, readback, first_row);
+    write_timestamp(cb, timestamps_, FLOP_STAGE_READBACK);
+    transfers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    transfers[0].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    transfers[0].oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    transfers[0].newLayout     = VK_IMAGE_LAYOUT_GENERAL;
+    transfers[0].image         = readback.image_;
+    readback.layout_           = VK_IMAGE_LAYOUT_GENERAL;
+    vkCmdPipelineBarrier(cb,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         transfers);
+}
+
+void FlopContext::record_gated_output(VkCommandBuffer cb, Image& readback)
+{
+    VkCommandBufferBeginInfo begin{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(cb, &begin);
+
+    // Only the queries of the remaining stages are rewritten, starting with
+    // the end of the vertical filter pass
+    if (timestamps_ != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(cb,
+                            timestamps_,
+                            FLOP_STAGE_COLOR_MAP,
+                            s_timestamp_count - FLOP_STAGE_COLOR_MAP);
+    }
+    write_timestamp(cb, timestamps_, FLOP_STAGE_FILTER_Y);
+
+    record_output(cb, readback, 0);
+
+    vkEndCommandBuffer(cb);
+}
+
+int FlopContext::analyze_pipelined(FlopPair const* pairs,
+                                   int pair_count,
+                                   float exposure,
+                                   int tonemap,
+                                   FlopSummary* out_summaries,
+                                   int& gate_failure_count)
+{
+    // The pipeline below overlaps three stages. Pair i+1 is decoded on a
+    // worker while the GPU evaluates pair i, and the error image of pair i-1
+    // is encoded on another worker. Readback images alternate between pairs,
+    // and the encoder of a pair starts once its evaluation has retired.
+    // Decoding runs ahead of evaluation, so a reference is assumed to be
+    // cached if it is the reference of the previous pair (or of the last
+    // evaluation, for the first pair), and reloaded if that turns out false.
+    //
+    // With a compute queue, pair i+1 is fetched as soon as the evaluation of
+    // pair i is submitted, and its sources are uploaded on the compute queue
+    // while the graphics queue is still busy. Its evaluation then only waits
+    // for the upload on the device.
+    std::vector<ReferenceKey> keys(pair_count);
+    auto decode = [&, pairs](int i) {
+        keys[i] = reference_key(pairs[i].reference_path, exposure, tonemap);
+        bool cached = i == 0 ? reference_cached(keys[i])
+                             : g_reference_cache && !keys[i].empty()
+                                   && keys[i] == keys[i - 1];
+        return std::async(std::launch::async, [=] {
+            return decode_pair(pairs[i].reference_path,
+                               pairs[i].test_path,
+                               pairs[i].output_path,
+                               exposure,
+                               tonemap,
+                               cached);
+        });
+    };
+
+    std::future<DecodedPair> next_pair;
+    if (pair_count > 0)
+    {
+        next_pair = decode(0);
+    }
+    auto fetch = [&](int i) {
+        DecodedPair decoded    = next_pair.get();
+        decoded.reference_key_ = keys[i];
+        if (i + 1 != pair_count)
+        {
+            next_pair = decode(i + 1);
+        }
+        return decoded;
+    };
+    std::future<void> encodes[2];
+
+    // Pair fetched ahead of its iteration, whose sources may be staged
+    DecodedPair fetched;
+    int fetched_index = -1;
+
+    int failure_count = 0;
+    for (int i = 0; i != pair_count; ++i)
+    {
+        FlopSummary* summary = out_summaries ? out_summaries + i : nullptr;
+        if (summary)
+        {
+            *summary = {};
+        }
+
+        DecodedPair decoded
+            = fetched_index == i ? std::move(fetched) : fetch(i);
+        fetched = {};
+
+        auto pair_start = std::chrono::high_resolution_clock::now();
+
+        FlopSummary timings{};
+        if (resolve_early(
+                decoded, ErrorOutput{.path_ = pairs[i].output_path}, timings))
+        {
+            if (timings.gate_failed)
+            {
+                ++gate_failure_count;
+            }
+            timings.milliseconds_elapsed
+                = static_cast<int>(milliseconds_since(pair_start));
+            if (summary)
+            {
+                *summary = timings;
+            }
+            continue;
+        }
+
+        FilterKernels const& kernels
+            = update_filter_kernels(g_pixels_per_degree);
+        reload_reference(decoded);
+        int32_t rows = band_rows(decoded.reference_.width_,
+                                 decoded.reference_.height_,
+                                 kernels.radius_);
+        if (rows != 0 && !decoded.reference_cached_)
+        {
+            // Banded pairs are evaluated synchronously and replace the
+            // intermediate and readback images, so pending encodes must
+            // finish first
+            for (std::future<void>& encode : encodes)
+            {
+                if (encode.valid())
+                {
+                    encode.get();
+                }
+            }
+
+            if (analyze_banded(decoded,
+                               ErrorOutput{.path_ = pairs[i].output_path},
+                               exposure,
+                               tonemap,
+                               rows,
+                               timings,
+                               timings.histogram))
+            {
+                std::printf("Pair %i (%s, %s) failed: %s\n",
+                            i,
+                            pairs[i].reference_path,
+                            pairs[i].test_path,
+                            error_message_);
+                ++failure_count;
+                continue;
+            }
+
+            if (timings.gate_failed)
+            {
+                ++gate_failure_count;
+            }
+            if (decoded.result_key_ != 0)
+            {
+                store_result(decoded.result_key_,
+                             cached_result(timings),
+                             pairs[i].output_path);
+            }
+            timings.milliseconds_elapsed
+                = static_cast<int>(milliseconds_since(pair_start));
+            if (summary)
+            {
+                *summary = timings;
+            }
+            continue;
+        }
+
+        timings.decode_milliseconds = decoded.milliseconds_;
+        upload_sources(decoded, timings);
+
+        if (validate_sources(&timings))
+        {
+            std::printf("Pair %i (%s, %s) failed: %s\n",
+                        i,
+                        pairs[i].reference_path,
+                        pairs[i].test_path,
+                        error_message_);
+            ++failure_count;
+            continue;
+        }
+
+        // Readback images are recreated when the extent changes, and this
+        // pair overwrites one of them. Either way, pending encodes reading
+        // from them must finish first.
+        char const* output_path = pairs[i].output_path;
+        bool resized = !intermediates_match();
+        for (int j = 0; j != 2; ++j)
+        {
+            if (encodes[j].valid() && (resized || (output_path && j == i % 2)))
+            {
+                encodes[j].get();
+            }
+        }
+
+        // With a gate, the error image is only color mapped and read back
+        // once the evaluation has shown that the pair fails it
+        bool gated = g_gate_enabled;
+        create_intermediates(output_path && !gated ? 2 : 0);
+        Image* readback
+            = output_path && !gated ? &error_readback_[i % 2] : nullptr;
+
+        auto evaluate_start = std::chrono::high_resolution_clock::now();
+        record(command_buffer_,
+               readback,
+               exposure,
+               tonemap,
+               nullptr,
+               output_path != nullptr);
+        uint64_t value = ++timeline_value_;
+        submit_and_signal(command_buffer_,
+                          timeline_,
+                          value,
+                          decoded.upload_value_ != 0 ? upload_timeline_
+                                                     : VK_NULL_HANDLE,
+                          decoded.upload_value_);
+
+        if (g_compute_queue != VK_NULL_HANDLE && i + 1 != pair_count)
+        {
+            fetched       = fetch(i + 1);
+            fetched_index = i + 1;
+            stage_sources(fetched);
+        }
+
+        // The command buffer, sources and intermediates are reused by the next
+        // pair, whose decode is already in flight
+        wait_timeline(timeline_, value);
+        read_timestamps(timings);
+        std::memcpy(timings.histogram,
+                    error_histogram_.data_,
+                    sizeof(timings.histogram));
+        read_statistics(timings);
+
+        if (gated && output_path && timings.gate_failed)
+        {
+            create_intermediates(2);
+            readback = &error_readback_[i % 2];
+            record_gated_output(command_buffer_, *readback);
+            value = ++timeline_value_;
+            submit_and_signal(command_buffer_, timeline_, value);
+            wait_timeline(timeline_, value);
+            read_timestamps(timings, FLOP_STAGE_COLOR_MAP);
+        }
+        if (timings.gate_failed)
+        {
+            ++gate_failure_count;
+        }
+
+        timings.evaluate_milliseconds = milliseconds_since(evaluate_start);
+        timings.milliseconds_elapsed
+            = static_cast<int>(milliseconds_since(pair_start));
+        if (summary)
+        {
+            *summary = timings;
+        }
+
+        // The summary is complete before the encode starts, which only
+        // reports its own duration. A result with an error image is cached
+        // once the image is written.
+        uint64_t result_key = decoded.result_key_;
+        if (readback)
+        {
+            CachedResult result = result_key != 0 ? cached_result(timings)
+                                                  : CachedResult{};
+            auto encode = [=] {
+                auto encode_start = std::chrono::high_resolution_clock::now();
+                readback->write(output_path);
+                if (summary)
+                {
+                    summary->encode_milliseconds
+                        = milliseconds_since(encode_start);
+                }
+                if (result_key != 0)
+                {
+                    store_result(result_key, result, output_path);
+                }
+            };
+            encodes[i % 2] = std::async(std::launch::async, encode);
+        }
+        else if (result_key != 0)
+        {
+            store_result(result_key, cached_result(timings), output_path);
+        }
+    }
+
+    for (std::future<void>& encode : encodes)
+    {
+        if (encode.valid())
+        {
+            encode.get();
+        }
+    }
+    release_staged_sources();
+
+    return failure_count;
+}
+
+int FlopContext::analyze_serial(FlopPair const* pairs,
+                                int pair_count,
+                                float exposure,
+                                int tonemap,
+                                FlopSummary* out_summaries,
+                                int& gate_failure_count)
+{
+    // Per-pair logging would dominate the output of large batches
+    bool log_summary = log_summary_;
+    log_summary_     = false;
+
+    int failure_count = 0;
+    for (int i = 0; i != pair_count; ++i)
+    {
+        FlopSummary summary{};
+        if (analyze(pairs[i].reference_path,
+                    pairs[i].test_path,
+                    pairs[i].output_path,
+                    exposure,
+                    tonemap,
+                    &summary,
+                    false))
+        {
+            std::printf("Pair %i (%s, %s) failed: %s\n",
+                        i,
+                        pairs[i].reference_path,
+                        pairs[i].test_path,
+                        error_message_);
+            ++failure_count;
+        }
+        else if (summary.gate_failed)
+        {
+            ++gate_failure_count;
+        }
+
+        if (out_summaries)
+        {
+            out_summaries[i] = summary;
+        }
+    }
+
+    log_summary_ = log_summary;
+    return failure_count;
+}
+
+int FlopContext::analyze_batch(FlopPair const* pairs,
+                               int pair_count,
+                               float exposure,
+                               int tonemap,
+                               FlopSummary* out_summaries,
+                               FlopBatchSummary* out_batch_summary)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    int failure_count      = 0;
+    int gate_failure_count = 0;
+    if (g_backend == FLOP_BACKEND_CPU)
+    {
+        failure_count = analyze_serial(pairs,
+                                       pair_count,
+                                       exposure,
+                                       tonemap,
+                                       out_summaries,
+                                       gate_failure_count);
+    }
+    else
+    {
+        failure_count = analyze_pipelined(pairs,
+                                          pair_count,
+                                          exposure,
+                                          tonemap,
+                                          out_summaries,
+                                          gate_failure_count);
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end_time - start_time;
+    float pairs_per_second
+        = elapsed.count() > 0.0 ? pair_count / elapsed.count() : 0.f;
+
+    if (out_batch_summary)
+    {
+        out_batch_summary->pair_count         = pair_count;
+        out_batch_summary->failure_count      = failure_count;
+        out_batch_summary->gate_failure_count = gate_failure_count;
+        out_batch_summary->milliseconds_elapsed
+            = static_cast<int>(elapsed.count() * 1000.0);
+        out_batch_summary->pairs_per_second = pairs_per_second;
+    }
+
+    if (log_summary_)
+    {
+        std::printf("Batch of %i pairs (%i failed) evaluated in %.2fs: "
+                    "%.2f pairs/s\n",
+                    pair_count,
+                    failure_count,
+                    elapsed.count(),
+                    pairs_per_second);
+        if (g_gate_enabled)
+        {
+            std::printf("%i pairs failed the gate\n", gate_failure_count);
+        }
+    }
+
+    if (failure_count != 0)
+    {
+        error_message_ = "One or more pairs in the batch failed.";
+        return 1;
+    }
+    return 0;
+}
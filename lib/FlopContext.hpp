@@ -1,9 +1,17 @@
 #pragma once
 
 #include "Buffer.hpp"
+#include "Cpu.hpp"
+#include "FilterKernels.hpp"
 #include "Image.hpp"
 #include "Kernel.hpp"
-#include "Fullscreen.hpp"
+#include "ResultCache.hpp"
+
+#include <flop/Flop.h>
+#include <flop/FlopVulkan.h>
+
+#include <string>
+#include <vector>
 
 namespace flop
 {
@@ -19,20 +27,474 @@ struct ImagePacket
     Image yycxcz_blur_x_;
     Image yycxcz_blurred_;
     Image feature_blur_x_;
+    // Feature magnitudes of the fully filtered image. Only written for a
+    // cached reference, whose fully filtered color is kept in yycxcz_blurred_.
+    Image features_;
+};
+
+// Identifies a reference image, along with the parameters its preprocessing
+// depends on. An empty key identifies nothing, and is never cached.
+struct ReferenceKey
+{
+    // Path of a reference file, or empty for pixels in caller memory
+    std::string path_;
+    // Hash of the size and modification time of the file, or of the pixels
+    uint64_t hash_  = 0;
+    float exposure_ = 0.f;
+    int tonemap_    = 0;
+
+    bool empty() const
+    {
+        return path_.empty() && hash_ == 0;
+    }
+
+    bool operator==(ReferenceKey const&) const = default;
+};
+
+// Host-side pixels of a reference/test pair awaiting upload
+struct DecodedPair
+{
+    ImageData reference_;
+    ImageData test_;
+    float milliseconds_ = 0.f;
+    ReferenceKey reference_key_;
+    // Set if the reference matches the cached reference, in which case it
+    // isn't decoded or uploaded at all
+    bool reference_cached_ = false;
+    // Pairs of bit-identical files, and pairs found in the result cache, are
+    // resolved without decoding the test image (see resolve_early)
+    PairFingerprint fingerprint_;
+    // Extent of a bit-identical pair, read from the header of the reference
+    // instead of decoding it. Zero if the header couldn't be read, in which
+    // case the reference is decoded.
+    int32_t identical_width_  = 0;
+    int32_t identical_height_ = 0;
+    uint64_t result_key_      = 0;
+    bool result_cached_       = false;
+    CachedResult cached_result_;
+    // If not zero, the sources were staged on the compute queue (see
+    // FlopContext::stage_sources), and are uploaded once the upload timeline
+    // reaches this value
+    uint64_t upload_value_ = 0;
+};
+
+// Source images uploaded on the compute queue ahead of their evaluation. The
+// staging buffers are retained until the upload retires.
+struct StagedSources
+{
+    // Empty if the reference is cached, and therefore not uploaded
+    Image reference_;
+    Image test_;
+    StagingBuffer staging_[2];
+    float milliseconds_ = 0.f;
+};
+
+// Destination of the color-mapped error image of a pair: a PNG file, or
+// caller-owned RGBA8 pixels with rows stride bytes apart. Neither if empty.
+struct ErrorOutput
+{
+    char const* path_ = nullptr;
+    uint8_t* pixels_  = nullptr;
+    size_t stride_    = 0;
+
+    explicit operator bool() const
+    {
+        return path_ || pixels_;
+    }
 };
 
-inline ImagePacket g_reference;
-inline ImagePacket g_test;
-inline Image g_error;
-inline Image g_error_color;
-inline Image g_error_readback;
-inline Buffer g_error_histogram;
-inline Kernel g_csf_filter_x;
-inline Kernel g_csf_filter_y;
-inline Kernel g_color_compare;
-inline Kernel g_feature_filter_x;
-inline Kernel g_feature_filter_y;
-inline Kernel g_summarize;
-inline Fullscreen g_yycxcz;
-inline Fullscreen g_error_color_map;
+// Images too tall to evaluate at once are evaluated in horizontal bands. The
+// source rows of a band are uploaded to the top rows_ rows of fixed-size band
+// images. Only rows [first_row_, first_row_ + row_count_) of a band are
+// evaluated; the rows around them form the apron read by the vertical filters.
+struct Band
+{
+    int32_t rows_      = 0;
+    int32_t first_row_ = 0;
+    int32_t row_count_ = 0;
+    // The histogram is cleared before evaluating the first band of an image,
+    // and accumulates across subsequent bands
+    bool first_ = true;
+};
+} // namespace flop
+
+// Backing storage for the opaque FlopContext handle exposed in the C API. A
+// context owns every resource needed to evaluate a single reference/test pair
+// (source and intermediate images, the error histogram, and its own command
+// pool), so independent contexts may be evaluated concurrently. Pipelines are
+// immutable and shared between all contexts.
+struct FlopContext
+{
+    // Allocates the command pool, fence, upload ring, timestamp queries and
+    // histogram buffer. Requires an initialized device.
+    int init();
+    void destroy();
+
+    // Release per-pair images. If keep_sources is set, the decoded source
+    // images are retained so the pair can be re-evaluated with different
+    // parameters.
+    void reset(bool keep_sources);
+
+    void load_reference(char const* reference_path);
+    void load_test(char const* test_path);
+
+    // Evaluate the pair, optionally writing a color-mapped error image to
+    // output_path. If bypass_initialization is set, the source images already
+    // loaded via load_reference/load_test are used and the paths are ignored.
+    // Returns 0 on success, 1 on failure (error_message_ describes the
+    // failure).
+    int analyze(char const* reference_path,
+                char const* test_path,
+                char const* output_path,
+                float exposure,
+                int tonemap,
+                FlopSummary* out_summary,
+                bool bypass_initialization);
+
+    // Evaluate a pair of images in caller memory, which are copied straight to
+    // the upload staging buffers. If error_map is not null, the color-mapped
+    // error image is written to it, with rows error_map_stride bytes apart.
+    int analyze_pixels(FlopPixels const& reference,
+                       FlopPixels const& test,
+                       uint8_t* error_map,
+                       size_t error_map_stride,
+                       float exposure,
+                       int tonemap,
+                       FlopSummary* out_summary);
+
+    // Evaluate a pair once per viewing condition, given in pixels per degree
+    // (see flop_config_set_pixels_per_degree), writing one summary per
+    // condition to out_summaries. The pair is decoded, uploaded and converted
+    // to YyCxCz once, and only filtered and compared per condition. If
+    // output_paths is not null, it holds one optional error image path per
+    // condition.
+    int analyze_viewing_conditions(char const* reference_path,
+                                   char const* test_path,
+                                   float const* pixels_per_degree,
+                                   int count,
+                                   char const* const* output_paths,
+                                   float exposure,
+                                   int tonemap,
+                                   FlopSummary* out_summaries);
+
+    // Evaluate a pair of images in Vulkan memory in place, either wrapped (if
+    // created on this device) or imported from an opaque file descriptor. The
+    // images are released before returning, and no error image is produced.
+    int analyze_external(FlopVulkanImage const& reference,
+                         FlopVulkanImage const& test,
+                         float exposure,
+                         int tonemap,
+                         FlopSummary* out_summary);
+
+    // Evaluate a list of pairs. Intermediate images are retained between pairs
+    // with matching extents. With the Vulkan backend, evaluation is pipelined:
+    // while the GPU evaluates one pair, a worker decodes the next pair and
+    // another encodes the error image of the previous pair. The CPU backend
+    // already occupies every core and evaluates pairs one at a time. A failing
+    // pair does not abort the batch; its summary is zeroed and the failure is
+    // counted.
+    int analyze_batch(FlopPair const* pairs,
+                      int pair_count,
+                      float exposure,
+                      int tonemap,
+                      FlopSummary* out_summaries,
+                      FlopBatchSummary* out_batch_summary);
+
+    // Evaluates a decoded pair with the selected backend, releasing its
+    // pixels. With the Vulkan backend, images taller than the band height (see
+    // flop_config_set_band_rows) are evaluated with analyze_banded.
+    int analyze_decoded(flop::DecodedPair& decoded,
+                        flop::ErrorOutput const& output,
+                        float exposure,
+                        int tonemap,
+                        FlopSummary& summary,
+                        uint32_t* histogram);
+
+    // Resolves a pair without evaluating it if its inputs are bit-identical,
+    // or if its result was cached. Returns false if the pair must be evaluated.
+    bool resolve_early(flop::DecodedPair& decoded,
+                       flop::ErrorOutput const& output,
+                       FlopSummary& summary);
+
+    // Resolves a pair of identical images of the supplied extent, which has no
+    // error at all
+    void resolve_identical(int32_t width,
+                           int32_t height,
+                           flop::ErrorOutput const& output,
+                           FlopSummary& summary);
+
+    // The result of the last evaluation, to be stored in the result cache
+    flop::CachedResult cached_result(FlopSummary const& summary) const;
+
+    // Evaluates the loaded sources with the Vulkan backend
+    int analyze_loaded(flop::ErrorOutput const& output,
+                       float exposure,
+                       int tonemap,
+                       FlopSummary& summary,
+                       uint32_t* histogram);
+
+    // Evaluates a decoded pair band by band with the Vulkan backend, releasing
+    // its pixels. Device memory use is bounded by the band height, rather than
+    // the image height. The error image is stitched together on the host.
+    int analyze_banded(flop::DecodedPair& decoded,
+                       flop::ErrorOutput const& output,
+                       float exposure,
+                       int tonemap,
+                       int32_t band_rows,
+                       FlopSummary& summary,
+                       uint32_t* histogram);
+
+    // Evaluates a decoded pair with the CPU backend, releasing its pixels
+    int analyze_cpu(flop::DecodedPair& decoded,
+                    flop::ErrorOutput const& output,
+                    float exposure,
+                    int tonemap,
+                    FlopSummary& summary,
+                    uint32_t* histogram);
+
+    // Evaluates a validated pair with the CPU backend and the supplied filter
+    // kernels, retaining its pixels
+    void evaluate_cpu(flop::DecodedPair const& decoded,
+                      flop::ErrorOutput const& output,
+                      float exposure,
+                      int tonemap,
+                      flop::FilterKernels const& kernels,
+                      FlopSummary& summary,
+                      uint32_t* histogram);
+
+    // Batch strategies used by analyze_batch. Both return the failure count,
+    // and count the pairs that failed the gate in gate_failure_count.
+    int analyze_pipelined(FlopPair const* pairs,
+                          int pair_count,
+                          float exposure,
+                          int tonemap,
+                          FlopSummary* out_summaries,
+                          int& gate_failure_count);
+    int analyze_serial(FlopPair const* pairs,
+                       int pair_count,
+                       float exposure,
+                       int tonemap,
+                       FlopSummary* out_summaries,
+                       int& gate_failure_count);
+
+    void print_summary(FlopSummary const& summary);
+
+    // Replaces the source images with the decoded pair, releasing its pixels.
+    // A cached reference is retained instead. Sources staged by stage_sources
+    // are adopted rather than uploaded again.
+    void upload_sources(flop::DecodedPair& decoded, FlopSummary& summary);
+
+    // Uploads the sources of a decoded pair on the compute queue without
+    // blocking, so that the upload overlaps the evaluation in flight on the
+    // graphics queue. Pairs resolved early or evaluated in bands, and devices
+    // without a compute queue, are left to upload_sources.
+    void stage_sources(flop::DecodedPair& decoded);
+
+    // Waits for the last staged upload to retire, and releases its staging
+    // buffers along with any staged images that weren't adopted
+    void release_staged_sources();
+
+    // Releases the reference source, along with its cached preprocessing
+    void release_reference();
+
+    // Returns true if the reference identified by key is the loaded reference,
+    // and its preprocessing is cached (see flop_config_set_reference_cache)
+    bool reference_cached(flop::ReferenceKey const& key) const;
+
+    // Decodes the reference of a pair decoded on the assumption that it was
+    // cached, if it no longer is (e.g. because the previous pair of a batch
+    // failed)
+    void reload_reference(flop::DecodedPair& decoded);
+
+    // Recomputes the filter kernels if they were last computed for other
+    // pixels per degree (usually g_pixels_per_degree), and copies them to
+    // filter_kernel_weights_. Evaluations use the kernels last updated. Must
+    // not be called while an evaluation is in flight.
+    flop::FilterKernels const& update_filter_kernels(float pixels_per_degree);
+
+    // (Re)creates intermediate images if the source extent or the requested
+    // precision has changed, along with readback_count readback images
+    void create_intermediates(int readback_count);
+
+    // Returns true if the intermediates match the source extent and the
+    // requested precision
+    bool intermediates_match() const;
+
+    // Returns 0 if the loaded sources are present and have matching extents
+    int validate_sources(FlopSummary* out_summary);
+
+    // Returns 0 if both images of a decoded pair are present and have matching
+    // extents
+    int validate_decoded(flop::DecodedPair const& decoded, FlopSummary& summary);
+
+    // Records a full evaluation of the loaded sources, or of a single band if
+    // band is not null. If readback is not null, the color-mapped error image
+    // (of the evaluated rows of the band) is copied to it. Otherwise, the error
+    // image is only written if write_error is set, so that it can be color
+    // mapped later with record_gated_output.
+    void record(VkCommandBuffer cb,
+                Image* readback,
+                float exposure,
+                int tonemap,
+                flop::Band const* band = nullptr,
+                bool write_error       = false);
+
+    // Records the color mapping of the error image, and its copy to readback
+    void record_output(VkCommandBuffer cb, Image& readback, int32_t first_row);
+
+    // Records the color mapping and readback of the error image written by the
+    // last evaluation, once it is known to have failed the gate
+    void record_gated_output(VkCommandBuffer cb, Image& readback);
+
+    // Adds the timings of stages from first_stage onwards measured by the last
+    // submission to the summary
+    void read_timestamps(FlopSummary& summary, int first_stage = 0);
+
+    // Copies the error statistics and gate outcome of the last evaluation to
+    // the summary, and the configurable histogram to histogram_counts_ and
+    // histogram_cdf_
+    void read_statistics(FlopSummary& summary);
+
+    flop::ImagePacket reference_;
+    flop::ImagePacket test_;
+    Image error_;
+    Image error_color_;
+    // Batch evaluation alternates between both readback images so that the
+    // previous result can be encoded while the next is produced
+    Image error_readback_[2];
+    Buffer error_histogram_;
+    // Error statistics accumulated by the vertical filter pass, and the
+    // statistics resolved from them (see Statistics.hlsli)
+    Buffer error_statistics_scratch_;
+    Buffer error_statistics_;
+
+    // Filter kernels of the current pixels per degree, and their weights as
+    // read by the filter kernels (see FilterKernels.hpp)
+    flop::FilterKernels filter_kernels_;
+    Buffer filter_kernel_weights_;
+
+    // Configurable histogram of the last evaluation, and its cumulative
+    // distribution. Empty if disabled.
+    int32_t histogram_buckets_          = 0;
+    FlopHistogramScale histogram_scale_ = FLOP_HISTOGRAM_LINEAR;
+    std::vector<uint32_t> histogram_counts_;
+    std::vector<float> histogram_cdf_;
+
+    // Gate checked by the last evaluation
+    FlopGate gate_{-1.f, 0.f, -1.f, -1.f};
+
+    // Key of the loaded reference. Once reference_filtered_ is set, the fully
+    // filtered reference is held in reference_.yycxcz_blurred_ and
+    // reference_.features_, and later evaluations only filter the test image.
+    flop::ReferenceKey reference_key_;
+    bool reference_filtered_ = false;
+
+    VkCommandPool command_pool_     = VK_NULL_HANDLE;
+    VkCommandBuffer command_buffer_ = VK_NULL_HANDLE;
+    VkFence fence_                  = VK_NULL_HANDLE;
+
+    // Staging memory through which sources are uploaded on the graphics queue
+    UploadRing upload_ring_;
+
+    // Timestamps written before the first and after every FlopStage, or null
+    // if the queue doesn't support timestamps
+    VkQueryPool timestamps_ = VK_NULL_HANDLE;
+
+    // Signaled with an increasing value as each batched evaluation retires
+    VkSemaphore timeline_    = VK_NULL_HANDLE;
+    uint64_t timeline_value_ = 0;
+
+    // Command buffer of the compute queue, and the timeline signaled as each
+    // staged upload retires. Null if the device has no compute queue.
+    VkCommandPool upload_command_pool_     = VK_NULL_HANDLE;
+    VkCommandBuffer upload_command_buffer_ = VK_NULL_HANDLE;
+    VkSemaphore upload_timeline_           = VK_NULL_HANDLE;
+    uint64_t upload_timeline_value_        = 0;
+    flop::StagedSources staged_;
+
+    // Host intermediates used by the CPU backend
+    flop::cpu::Workspace cpu_workspace_;
+
+    char const* error_message_ = "";
+    bool log_summary_          = true;
+    // If set, the YyCxCz images of both sources hold the converted sources of
+    // the previous evaluation, which record reuses instead of converting the
+    // sources again (see analyze_viewing_conditions)
+    bool sources_converted_ = false;
+    // If set, the filtered colors and the error image are always written.
+    // Otherwise, the error image is only written if an error image output is
+    // requested, and the filtered colors are not written at all.
+    bool retain_images_ = false;
+};
+
+namespace flop
+{
+// Backend in use, resolved by flop_init
+inline FlopBackend g_backend = FLOP_BACKEND_VULKAN;
+
+// Maximum number of rows evaluated at once (see flop_config_set_band_rows). If
+// zero, the band height is derived from g_band_budget.
+inline int32_t g_band_rows = 0;
+
+// Device memory available to the images of a single band, resolved by
+// flop_init
+inline VkDeviceSize g_band_budget = 0;
+
+// Configurable histogram accumulated by subsequent evaluations (see
+// flop_config_set_histogram)
+inline int32_t g_histogram_buckets          = 0;
+inline FlopHistogramScale g_histogram_scale = FLOP_HISTOGRAM_LINEAR;
+
+// Gate applied to subsequent evaluations (see flop_config_set_gate). The
+// thresholds of a disabled gate are negative, so the gate always passes.
+inline bool g_gate_enabled = false;
+inline FlopGate g_gate{.mean_error       = -1.f,
+                       .percentile       = 0.f,
+                       .percentile_error = -1.f,
+                       .max_error        = -1.f};
+
+// Whether the fully filtered reference is retained between evaluations (see
+// flop_config_set_reference_cache)
+inline bool g_reference_cache = true;
+
+// Pixels per degree of the viewing condition the filter kernels are computed
+// for, or 0 for the default (see flop_config_set_pixels_per_degree)
+inline float g_pixels_per_degree = 0.f;
+
+// Precision of intermediate images (see flop_config_set_precision)
+inline FlopPrecision g_precision = FLOP_PRECISION_FULL;
+
+// Whether the device supports half-precision storage images (R16F, for the
+// error image), resolved by flop_init. If not, full precision is used
+// regardless of g_precision.
+inline bool g_half_precision_supported = false;
+
+// Number of meaningful bits in timestamps written to the graphics queue,
+// resolved by flop_init. If zero, stage timings aren't measured.
+inline uint32_t g_timestamp_valid_bits = 0;
+
+// Context used by the path-based entry points and the interactive viewer
+inline FlopContext g_context;
+
+// Horizontal and vertical filter kernels, specialized for the radii of a set of
+// filter kernels
+struct FilterPipelines
+{
+    Kernel x_;
+    Kernel y_;
+};
+
+// Returns the filter pipelines specialized for the radii of kernels, and
+// compiled for full or half-precision intermediates, creating them on first
+// use. Pipelines are retained for the lifetime of the runtime, so changing the
+// pixels per degree (or precision) back and forth doesn't recreate them.
+FilterPipelines const& filter_pipelines(FilterKernels const& kernels,
+                                        bool half);
+
+// Returns the YyCxCz kernel writing full or half-precision intermediates. The
+// half-precision kernel is created on first use.
+Kernel const& yycxcz_pipeline(bool half);
+
+inline Kernel g_statistics;
+inline Kernel g_error_color_map;
 } // namespace flop
@@ -1,7 +1,12 @@
 #include "Image.hpp"
 
 #include <tinyexr.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <vector>
 
 // Forward declare STBI calls to avoid including a massive header
 #include <cstdio>
@@ -14,6 +19,7 @@ extern "C"
                              int* channels_in_file,
                              int desired_channels);
     void stbi_image_free(void* retval_from_stbi_load);
+    int stbi_info(char const* filename, int* x, int* y, int* comp);
     int stbi_write_png(char const* filename,
                        int w,
                        int h,
@@ -24,7 +30,18 @@ extern "C"
 
 using namespace flop;
 
-static int s_image_count;
+// Slots in the bindless descriptor arrays are recycled when images are reset
+// so that several analysis contexts can share the descriptor set.
+static uint32_t s_image_count;
+static std::vector<uint32_t> s_free_indices;
+
+// Images released with Image::reset are retained for reuse. Pooled images keep
+// their view and bindless slot, so reacquiring one requires no descriptor
+// writes. The oldest entries are destroyed once the pool exceeds
+// g_image_pool_budget.
+static std::mutex s_pool_mutex;
+static std::vector<Image> s_pool;
+static VkDeviceSize s_pool_size;
 
 constexpr static VkImageSubresourceRange s_transfer_range{
     .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -39,42 +56,125 @@ constexpr static VkImageSubresourceLayers s_subresource{
     .baseArrayLayer = 0,
     .layerCount     = 1};
 
-void Image::reset_count(uint32_t counter)
+// Must be called with g_descriptor_mutex held
+static uint32_t acquire_index()
 {
-    s_image_count = counter;
+    if (s_free_indices.empty())
+    {
+        return s_image_count++;
+    }
+    uint32_t index = s_free_indices.back();
+    s_free_indices.pop_back();
+    return index;
 }
 
-void init_from_data(void* image_data, int bytes_per_channel, Image& image)
+static VkDeviceSize allocation_size(VmaAllocation allocation)
 {
-    VkBuffer staging_buffer;
-    VmaAllocation staging_allocation;
-    image.set_extents();
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(g_allocator, allocation, &info);
+    return info.size;
+}
 
-    VmaAllocationCreateInfo staging_allocation_info{
-        .usage = VMA_MEMORY_USAGE_CPU_ONLY,
+static void release_view(Image& image)
+{
+    if (image.image_view_ != VK_NULL_HANDLE)
+    {
+        vkDestroyImageView(g_device, image.image_view_, nullptr);
+
+        // Only images with a view occupy a bindless slot
+        std::lock_guard lock{g_descriptor_mutex};
+        s_free_indices.push_back(image.index_);
+    }
+}
+
+static void destroy(Image& image)
+{
+    vmaDestroyImage(g_allocator, image.image_, image.allocation_);
+    release_view(image);
+}
+
+// Creates a view of the image and binds it to the sampled image array
+static void bind_sampled(Image& image)
+{
+    VkImageSubresourceRange range{
+        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel   = 0,
+        .levelCount     = 1,
+        .baseArrayLayer = 0,
+        .layerCount     = 1,
     };
-    VkBufferCreateInfo staging_info{
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size  = static_cast<VkDeviceSize>(image.width_ * image.height_ * 4 * bytes_per_channel),
-        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        .sharingMode           = VK_SHARING_MODE_EXCLUSIVE,
-        .queueFamilyIndexCount = 1,
-        .pQueueFamilyIndices   = &g_graphics_queue_index,
+    VkImageViewCreateInfo view_info{
+        .sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image            = image.image_,
+        .viewType         = VK_IMAGE_VIEW_TYPE_2D,
+        .format           = image.format_,
+        .subresourceRange = range};
+    vkCreateImageView(g_device, &view_info, nullptr, &image.image_view_);
+
+    std::lock_guard lock{g_descriptor_mutex};
+    image.index_ = acquire_index();
+
+    VkDescriptorImageInfo descriptor_info{
+        .imageView   = image.image_view_,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet descriptor_write{
+        .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet          = g_descriptor_set,
+        .dstBinding      = 0,
+        .dstArrayElement = image.index_,
+        .descriptorCount = 1,
+        .descriptorType  = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .pImageInfo      = &descriptor_info,
     };
-    vmaCreateBuffer(g_allocator,
-                    &staging_info,
-                    &staging_allocation_info,
-                    &staging_buffer,
-                    &staging_allocation,
-                    nullptr);
-    void* data;
-    vmaMapMemory(g_allocator, staging_allocation, &data);
-    std::memcpy(data, image_data, image.width_ * image.height_ * 4 * bytes_per_channel);
+    vkUpdateDescriptorSets(g_device, 1, &descriptor_write, 0, nullptr);
+}
+
+// Moves the device resources of a pooled image matching the requested extent,
+// format and usage into image. Returns false if no such image is pooled.
+static bool
+acquire_pooled(Image& image, VkFormat format, VkImageUsageFlags usage)
+{
+    std::lock_guard lock{s_pool_mutex};
+    for (auto it = s_pool.begin(); it != s_pool.end(); ++it)
+    {
+        if (it->width_ == image.width_ && it->height_ == image.height_
+            && it->format_ == format && it->usage_ == usage)
+        {
+            image.image_      = it->image_;
+            image.image_view_ = it->image_view_;
+            image.allocation_ = it->allocation_;
+            image.layout_     = it->layout_;
+            image.index_      = it->index_;
+            image.format_     = format;
+            image.usage_      = usage;
+            s_pool_size -= allocation_size(it->allocation_);
+            s_pool.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+static VkFormat data_format(ImageData const& data)
+{
+    if (data.hdr_)
+    {
+        return data.half_ ? VK_FORMAT_R16G16B16A16_SFLOAT
+                          : VK_FORMAT_R32G32B32A32_SFLOAT;
+    }
+    return VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+// Allocates a sampled image able to receive uploads of decoded data, and binds
+// it to the sampled image array
+static void allocate_for_data(Image& image, VkFormat format)
+{
+    image.set_extents();
 
     VkImageCreateInfo image_info{
         .sType       = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType   = VK_IMAGE_TYPE_2D,
-        .format      = bytes_per_channel == 1 ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R32G32B32A32_SFLOAT,
+        .format      = format,
         .extent      = image.extent3_,
         .mipLevels   = 1,
         .arrayLayers = 1,
@@ -87,6 +187,14 @@ void init_from_data(void* image_data, int bytes_per_channel, Image& image)
         .pQueueFamilyIndices   = &g_graphics_queue_index,
         .initialLayout         = VK_IMAGE_LAYOUT_UNDEFINED,
     };
+    // Sources may be uploaded on the compute queue (see
+    // FlopContext::stage_sources)
+    share_between_queues(image_info);
+    if (acquire_pooled(image, image_info.format, image_info.usage))
+    {
+        return;
+    }
+
     VmaAllocationCreateInfo allocation_info{
         .usage = VMA_MEMORY_USAGE_GPU_ONLY,
     };
@@ -96,23 +204,460 @@ void init_from_data(void* image_data, int bytes_per_channel, Image& image)
                    &image.image_,
                    &image.allocation_,
                    nullptr);
+    image.format_ = image_info.format;
+    image.usage_  = image_info.usage;
+
+    bind_sampled(image);
+}
+
+void ImageData::reset()
+{
+    if (data_ && owned_)
+    {
+        if (hdr_)
+        {
+            std::free(data_);
+        }
+        else
+        {
+            stbi_image_free(data_);
+        }
+    }
+    *this = {};
+}
+
+size_t ImageData::pixel_size() const
+{
+    if (hdr_)
+    {
+        return half_ ? 8 : 16;
+    }
+    return 4;
+}
+
+size_t ImageData::row_pitch() const
+{
+    return stride_ != 0 ? stride_ : pixel_size() * width_;
+}
+
+static ImageData decode_exr(char const* path)
+{
+    ImageData data;
+    data.hdr_ = true;
+
+    float* rgba       = nullptr;
+    char const* error = nullptr;
+    if (LoadEXRWithLayer(&rgba, &data.width_, &data.height_, path, nullptr, &error) < 0 || !rgba)
+    {
+        if (error)
+        {
+            std::cout << "Error loading EXR " << path << ":\n" << error << '\n';
+        }
+        else
+        {
+            std::cout << "Error loading EXR " << path << '\n';
+        }
+        FreeEXRErrorMessage(error);
+        return {};
+    }
+    data.data_     = rgba;
+    data.channels_ = 4;
+    return data;
+}
+
+static ImageData decode_non_exr(char const* path)
+{
+    ImageData data;
+
+    data.data_ = stbi_load(path, &data.width_, &data.height_, &data.channels_, 4);
+
+    if (!data.data_)
+    {
+        std::cout << "Error loading PNG " << path << '\n';
+        return {};
+    }
+    return data;
+}
+
+ImageData Image::decode(char const* path)
+{
+    std::filesystem::path ext = std::filesystem::path{path}.extension();
+
+    if (ext == ".exr")
+    {
+        return decode_exr(path);
+    }
+    else if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp")
+    {
+        return decode_non_exr(path);
+    }
+
+    std::printf("Image %s has unrecognized extension\n", path);
+    return {};
+}
+
+bool Image::read_extent(char const* path, int32_t& width, int32_t& height)
+{
+    std::filesystem::path ext = std::filesystem::path{path}.extension();
+
+    if (ext == ".exr")
+    {
+        EXRVersion version;
+        if (ParseEXRVersionFromFile(&version, path) != TINYEXR_SUCCESS
+            || version.multipart)
+        {
+            return false;
+        }
+
+        EXRHeader header;
+        InitEXRHeader(&header);
+        char const* error = nullptr;
+        if (ParseEXRHeaderFromFile(&header, &version, path, &error)
+            != TINYEXR_SUCCESS)
+        {
+            FreeEXRErrorMessage(error);
+            return false;
+        }
+        // The data window holds inclusive bounds, as decoded by
+        // LoadEXRWithLayer
+        int x = header.data_window[2] - header.data_window[0] + 1;
+        int y = header.data_window[3] - header.data_window[1] + 1;
+        FreeEXRHeader(&header);
+        if (x <= 0 || y <= 0)
+        {
+            return false;
+        }
+        width  = x;
+        height = y;
+        return true;
+    }
+    else if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp")
+    {
+        int x;
+        int y;
+        int channels;
+        if (!stbi_info(path, &x, &y, &channels))
+        {
+            return false;
+        }
+        width  = x;
+        height = y;
+        return true;
+    }
+
+    return false;
+}
+
+Image Image::create_from_data(ImageData const& data, UploadRing& ring)
+{
+    if (!data.data_)
+    {
+        return {};
+    }
+
+    Image image = create_for_data(data, data.height_);
+    image.upload_rows(data, 0, data.height_, ring);
+
+    return image;
+}
+
+Image Image::create_for_data(ImageData const& data, int32_t height)
+{
+    Image image;
+    image.width_    = data.width_;
+    image.height_   = height;
+    image.channels_ = data.channels_;
+    image.hdr_      = data.hdr_;
+
+    allocate_for_data(image, data_format(data));
+
+    return image;
+}
+
+Image Image::wrap(VkImage handle,
+                  VkFormat format,
+                  int32_t width,
+                  int32_t height,
+                  VkImageLayout external_layout)
+{
+    Image image;
+    image.image_           = handle;
+    image.format_          = format;
+    image.usage_           = VK_IMAGE_USAGE_SAMPLED_BIT;
+    image.width_           = width;
+    image.height_          = height;
+    image.channels_        = 4;
+    image.layout_          = external_layout;
+    image.external_layout_ = external_layout;
+    image.external_        = true;
+    image.set_extents();
+
+    bind_sampled(image);
+
+    return image;
+}
+
+Image Image::import_fd(int fd,
+                       VkDeviceSize size,
+                       uint32_t memory_type_index,
+                       bool dedicated,
+                       VkImageUsageFlags usage,
+                       VkFormat format,
+                       int32_t width,
+                       int32_t height,
+                       VkImageLayout external_layout)
+{
+    if (!g_external_memory_fd_supported || size == 0)
+    {
+        return {};
+    }
+
+    Image image;
+    image.format_          = format;
+    image.usage_           = usage;
+    image.width_           = width;
+    image.height_          = height;
+    image.channels_        = 4;
+    image.layout_          = external_layout;
+    image.external_layout_ = external_layout;
+    image.external_        = true;
+    image.set_extents();
+
+    VkExternalMemoryImageCreateInfo external_info{
+        .sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    VkImageCreateInfo image_info{
+        .sType                 = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext                 = &external_info,
+        .imageType             = VK_IMAGE_TYPE_2D,
+        .format                = format,
+        .extent                = image.extent3_,
+        .mipLevels             = 1,
+        .arrayLayers           = 1,
+        .samples               = VK_SAMPLE_COUNT_1_BIT,
+        .tiling                = VK_IMAGE_TILING_OPTIMAL,
+        .usage                 = usage,
+        .sharingMode           = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices   = &g_graphics_queue_index,
+        .initialLayout         = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    if (vkCreateImage(g_device, &image_info, nullptr, &image.image_)
+        != VK_SUCCESS)
+    {
+        return {};
+    }
+
+    // The import must repeat the memory type and size of the exported
+    // allocation, which must also satisfy the requirements of this image
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(g_device, image.image_, &requirements);
+    if (memory_type_index >= 32
+        || !(requirements.memoryTypeBits & (1u << memory_type_index))
+        || size < requirements.size)
+    {
+        vkDestroyImage(g_device, image.image_, nullptr);
+        return {};
+    }
+
+    VkMemoryDedicatedAllocateInfo dedicated_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = image.image_,
+    };
+    VkImportMemoryFdInfoKHR import_info{
+        .sType      = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+        .pNext      = dedicated ? &dedicated_info : nullptr,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+        .fd         = fd,
+    };
+    VkMemoryAllocateInfo allocate_info{
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext           = &import_info,
+        .allocationSize  = size,
+        .memoryTypeIndex = memory_type_index,
+    };
+    if (vkAllocateMemory(g_device, &allocate_info, nullptr, &image.memory_)
+        != VK_SUCCESS)
+    {
+        vkDestroyImage(g_device, image.image_, nullptr);
+        return {};
+    }
+    vkBindImageMemory(g_device, image.image_, image.memory_, 0);
+
+    bind_sampled(image);
+
+    return image;
+}
+
+void StagingBuffer::reset()
+{
+    if (buffer_ != VK_NULL_HANDLE)
+    {
+        vmaUnmapMemory(g_allocator, allocation_);
+        vmaDestroyBuffer(g_allocator, buffer_, allocation_);
+    }
+    *this = {};
+}
+
+int UploadRing::init(VkCommandPool pool)
+{
+    VmaAllocationCreateInfo allocation_info{
+        .usage = VMA_MEMORY_USAGE_CPU_ONLY,
+    };
+    VkBufferCreateInfo buffer_info{
+        .sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size                  = s_slot_size * s_slot_count,
+        .usage                 = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode           = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices   = &g_graphics_queue_index,
+    };
+    if (vmaCreateBuffer(g_allocator,
+                        &buffer_info,
+                        &allocation_info,
+                        &buffer_,
+                        &allocation_,
+                        nullptr)
+        != VK_SUCCESS)
+    {
+        return 1;
+    }
+    vmaMapMemory(g_allocator, allocation_, reinterpret_cast<void**>(&data_));
+
+    pool_ = pool;
+    VkCommandBufferAllocateInfo command_buffer_info{
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool        = pool_,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = s_slot_count};
+    if (vkAllocateCommandBuffers(
+            g_device, &command_buffer_info, command_buffers_)
+        != VK_SUCCESS)
+    {
+        return 1;
+    }
+
+    VkFenceCreateInfo fence_info{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    for (VkFence& fence : fences_)
+    {
+        if (vkCreateFence(g_device, &fence_info, nullptr, &fence) != VK_SUCCESS)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void UploadRing::destroy()
+{
+    wait();
+    for (VkFence fence : fences_)
+    {
+        if (fence != VK_NULL_HANDLE)
+        {
+            vkDestroyFence(g_device, fence, nullptr);
+        }
+    }
+    if (command_buffers_[0] != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(g_device, pool_, s_slot_count, command_buffers_);
+    }
+    if (buffer_ != VK_NULL_HANDLE)
+    {
+        vmaUnmapMemory(g_allocator, allocation_);
+        vmaDestroyBuffer(g_allocator, buffer_, allocation_);
+    }
+    *this = {};
+}
+
+uint32_t UploadRing::acquire()
+{
+    uint32_t slot = next_slot_;
+    next_slot_    = (next_slot_ + 1) % s_slot_count;
+    if (pending_[slot])
+    {
+        vkWaitForFences(g_device, 1, &fences_[slot], VK_TRUE, UINT64_MAX);
+        vkResetFences(g_device, 1, &fences_[slot]);
+        pending_[slot] = false;
+    }
 
-    VkCommandBuffer cb = g_command_buffers[0];
     VkCommandBufferBeginInfo begin{
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
-    vkBeginCommandBuffer(cb, &begin);
+    vkBeginCommandBuffer(command_buffers_[slot], &begin);
+    return slot;
+}
+
+void UploadRing::submit(uint32_t slot)
+{
+    vkEndCommandBuffer(command_buffers_[slot]);
+    VkSubmitInfo submit{
+        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount   = 0,
+        .commandBufferCount   = 1,
+        .pCommandBuffers      = &command_buffers_[slot],
+        .signalSemaphoreCount = 0,
+    };
+    {
+        std::lock_guard lock{g_queue_mutex};
+        vkQueueSubmit(g_graphics_queue, 1, &submit, fences_[slot]);
+    }
+    pending_[slot] = true;
+}
+
+void UploadRing::wait()
+{
+    for (uint32_t slot = 0; slot != s_slot_count; ++slot)
+    {
+        if (pending_[slot])
+        {
+            vkWaitForFences(g_device, 1, &fences_[slot], VK_TRUE, UINT64_MAX);
+            vkResetFences(g_device, 1, &fences_[slot]);
+            pending_[slot] = false;
+        }
+    }
+}
 
+// Copies rows [first_row, first_row + row_count) of data to out, packing
+// strided rows
+static void pack_rows(ImageData const& data,
+                      int32_t first_row,
+                      int32_t row_count,
+                      uint8_t* out)
+{
+    size_t row_size = data.pixel_size() * data.width_;
+    size_t pitch    = data.row_pitch();
+    uint8_t const* rows
+        = static_cast<uint8_t const*>(data.data_) + pitch * first_row;
+    if (pitch == row_size)
+    {
+        std::memcpy(out, rows, row_size * row_count);
+    }
+    else
+    {
+        for (int32_t i = 0; i != row_count; ++i)
+        {
+            std::memcpy(out + row_size * i, rows + pitch * i, row_size);
+        }
+    }
+}
+
+// Transitions an image to receive an upload. Previous contents are discarded,
+// as every upload overwrites the rows subsequently read. Source images may be
+// shared by both queues, so no queue family ownership is transferred.
+static void begin_upload(VkCommandBuffer cb, VkImage image)
+{
     VkImageMemoryBarrier dst_transfer{
         .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .srcAccessMask       = VK_ACCESS_MEMORY_WRITE_BIT,
         .dstAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
         .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
         .newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .srcQueueFamilyIndex = g_graphics_queue_index,
-        .dstQueueFamilyIndex = g_graphics_queue_index,
-        .image               = image.image_,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image               = image,
         .subresourceRange    = s_transfer_range};
     vkCmdPipelineBarrier(cb,
                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
@@ -124,29 +669,21 @@ void init_from_data(void* image_data, int bytes_per_channel, Image& image)
                          nullptr,
                          1,
                          &dst_transfer);
-    VkOffset3D offset{.x = 0, .y = 0, .z = 0};
-    VkBufferImageCopy copy{.bufferOffset      = 0,
-                           .bufferRowLength   = 0,
-                           .bufferImageHeight = 0,
-                           .imageSubresource  = s_subresource,
-                           .imageOffset       = offset,
-                           .imageExtent       = image.extent3_};
-    vkCmdCopyBufferToImage(cb,
-                           staging_buffer,
-                           image.image_,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                           1,
-                           &copy);
+}
 
+// Transitions an uploaded image to the shader read-only layout. The barrier
+// also covers copies recorded in earlier submissions to the same queue.
+static void end_upload(VkCommandBuffer cb, VkImage image)
+{
     VkImageMemoryBarrier src_transfer{
         .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .srcAccessMask       = VK_ACCESS_MEMORY_WRITE_BIT,
         .dstAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
         .oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         .newLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .srcQueueFamilyIndex = g_graphics_queue_index,
-        .dstQueueFamilyIndex = g_graphics_queue_index,
-        .image               = image.image_,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image               = image,
         .subresourceRange    = s_transfer_range};
     vkCmdPipelineBarrier(cb,
                          VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -158,99 +695,112 @@ void init_from_data(void* image_data, int bytes_per_channel, Image& image)
                          nullptr,
                          1,
                          &src_transfer);
-    vkEndCommandBuffer(cb);
-    VkSubmitInfo submit{
-        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount   = 0,
-        .commandBufferCount   = 1,
-        .pCommandBuffers      = &cb,
-        .signalSemaphoreCount = 0,
-    };
-    vkQueueSubmit(g_graphics_queue, 1, &submit, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(g_device);
-
-    vmaUnmapMemory(g_allocator, staging_allocation);
-    vmaDestroyBuffer(g_allocator, staging_buffer, staging_allocation);
-
-    VkImageSubresourceRange range{
-        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-        .baseMipLevel   = 0,
-        .levelCount     = 1,
-        .baseArrayLayer = 0,
-        .layerCount     = 1,
-    };
-    VkImageViewCreateInfo view_info{
-        .sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image            = image.image_,
-        .viewType         = VK_IMAGE_VIEW_TYPE_2D,
-        .format           = image_info.format,
-        .subresourceRange = range};
-    vkCreateImageView(g_device, &view_info, nullptr, &image.image_view_);
-
-    image.index_ = s_image_count++;
+}
 
-    VkDescriptorImageInfo descriptor_info{
-        .imageView   = image.image_view_,
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-    VkWriteDescriptorSet descriptor_write{
-        .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet          = g_descriptor_set,
-        .dstBinding      = 0,
-        .dstArrayElement = image.index_,
-        .descriptorCount = 1,
-        .descriptorType  = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-        .pImageInfo      = &descriptor_info,
-    };
-    vkUpdateDescriptorSets(g_device, 1, &descriptor_write, 0, nullptr);
+// Records the copy of row_count rows at buffer_offset to the image, starting at
+// row y
+static void copy_rows(VkCommandBuffer cb,
+                      VkBuffer buffer,
+                      VkDeviceSize buffer_offset,
+                      Image const& image,
+                      int32_t y,
+                      int32_t row_count)
+{
+    VkOffset3D offset{.x = 0, .y = y, .z = 0};
+    VkExtent3D extent{.width  = static_cast<uint32_t>(image.width_),
+                      .height = static_cast<uint32_t>(row_count),
+                      .depth  = 1};
+    VkBufferImageCopy copy{.bufferOffset      = buffer_offset,
+                           .bufferRowLength   = 0,
+                           .bufferImageHeight = 0,
+                           .imageSubresource  = s_subresource,
+                           .imageOffset       = offset,
+                           .imageExtent       = extent};
+    vkCmdCopyBufferToImage(cb,
+                           buffer,
+                           image.image_,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1,
+                           &copy);
 }
 
-Image Image::create_from_exr(char const* path)
+void Image::upload_rows(ImageData const& data,
+                        int32_t first_row,
+                        int32_t row_count,
+                        UploadRing& ring)
 {
-    Image image;
-    image.hdr_ = true;
+    // A slot holds rows of over half a million RGBA32F pixels, far more than
+    // the maximum image dimension
+    size_t row_size = data.pixel_size() * data.width_;
+    auto chunk_rows = static_cast<int32_t>(UploadRing::s_slot_size / row_size);
 
-    float* rgba = nullptr;
-    char const* error = nullptr;
-    if (LoadEXRWithLayer(&rgba, &image.width_, &image.height_, path, nullptr, &error) < 0 || !rgba)
+    // Each chunk is packed while the copies of the previous chunks are in
+    // flight. Chunks are submitted to the same queue, so the transitions
+    // recorded with the first and last chunks order all of them.
+    for (int32_t y = 0; y < row_count; y += chunk_rows)
     {
-        if (error)
+        int32_t count      = std::min(chunk_rows, row_count - y);
+        uint32_t slot      = ring.acquire();
+        VkCommandBuffer cb = ring.command_buffers_[slot];
+        pack_rows(data, first_row + y, count, ring.slot_data(slot));
+
+        if (y == 0)
         {
-            std::cout << "Error loading EXR " << path << ":\n" << error << '\n';
+            begin_upload(cb, image_);
         }
-        else
+        copy_rows(
+            cb, ring.buffer_, UploadRing::s_slot_size * slot, *this, y, count);
+        if (y + count == row_count)
         {
-            std::cout << "Error loading EXR " << path << '\n';
+            end_upload(cb, image_);
         }
-        std::exit(1);
+        ring.submit(slot);
     }
-    image.channels_ = 4;
-
-    init_from_data(rgba, 4, image);
-    std::free(rgba);
-
-    return image;
+    ring.wait();
+    layout_ = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
 
-Image Image::create_from_non_exr(char const* path)
+StagingBuffer Image::record_upload(ImageData const& data,
+                                   int32_t first_row,
+                                   int32_t row_count,
+                                   VkCommandBuffer cb)
 {
-    Image image;
-
-    unsigned char* stb_data
-        = stbi_load(path, &image.width_, &image.height_, &image.channels_, 4);
+    StagingBuffer staging_buffer;
 
-    if (!stb_data)
-    {
-        std::cout << "Error loading PNG " << path << ":\n";
-        std::exit(1);
-    }
+    size_t size = data.pixel_size() * data.width_ * row_count;
+    VmaAllocationCreateInfo staging_allocation_info{
+        .usage = VMA_MEMORY_USAGE_CPU_ONLY,
+    };
+    VkBufferCreateInfo staging_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size  = static_cast<VkDeviceSize>(size),
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode           = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices   = &g_graphics_queue_index,
+    };
+    share_between_queues(staging_info);
+    vmaCreateBuffer(g_allocator,
+                    &staging_info,
+                    &staging_allocation_info,
+                    &staging_buffer.buffer_,
+                    &staging_buffer.allocation_,
+                    nullptr);
+    uint8_t* staging;
+    vmaMapMemory(g_allocator,
+                 staging_buffer.allocation_,
+                 reinterpret_cast<void**>(&staging));
+    pack_rows(data, first_row, row_count, staging);
 
-    init_from_data(stb_data, 1, image);
-    stbi_image_free(stb_data);
+    begin_upload(cb, image_);
+    copy_rows(cb, staging_buffer.buffer_, 0, *this, 0, row_count);
+    end_upload(cb, image_);
+    layout_ = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    return image;
+    return staging_buffer;
 }
 
-Image Image::create(const Image& other, VkFormat format, bool attachment)
+Image Image::create(const Image& other, VkFormat format)
 {
     // Create an RGB image with matching dimensions to the supplied image
     Image image;
@@ -276,18 +826,9 @@ Image Image::create(const Image& other, VkFormat format, bool attachment)
         .pQueueFamilyIndices   = &g_graphics_queue_index,
         .initialLayout         = VK_IMAGE_LAYOUT_UNDEFINED,
     };
-    if (attachment)
+    if (acquire_pooled(image, format, image_info.usage))
     {
-        if (format == VK_FORMAT_R8G8B8A8_SRGB)
-        {
-            image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-                               | VK_IMAGE_USAGE_SAMPLED_BIT
-                               | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-        }
-        else
-        {
-            image_info.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-        }
+        return image;
     }
 
     VmaAllocationCreateInfo allocation_info{
@@ -299,6 +840,8 @@ Image Image::create(const Image& other, VkFormat format, bool attachment)
                    &image.image_,
                    &image.allocation_,
                    nullptr);
+    image.format_ = format;
+    image.usage_  = image_info.usage;
 
     VkImageSubresourceRange range{
         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -315,7 +858,8 @@ Image Image::create(const Image& other, VkFormat format, bool attachment)
         .subresourceRange = range};
     vkCreateImageView(g_device, &view_info, nullptr, &image.image_view_);
 
-    image.index_ = s_image_count++;
+    std::lock_guard lock{g_descriptor_mutex};
+    image.index_ = acquire_index();
 
     VkDescriptorImageInfo descriptor_info{
         .imageView = image.image_view_, .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
@@ -373,6 +917,13 @@ Image Image::create_readback(Image const& other, VkFormat format)
         .initialLayout         = VK_IMAGE_LAYOUT_UNDEFINED,
     };
 
+    // Readback images are the only pooled images without sampled usage, so
+    // the usage flags alone distinguish their linear tiling
+    if (acquire_pooled(image, format, image_info.usage))
+    {
+        return image;
+    }
+
     VmaAllocationCreateInfo allocation_info{
         .usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
     };
@@ -382,21 +933,41 @@ Image Image::create_readback(Image const& other, VkFormat format)
                    &image.image_,
                    &image.allocation_,
                    nullptr);
+    image.format_ = format;
+    image.usage_  = image_info.usage;
     return image;
 }
 
 void Image::reset()
 {
-    if (allocation_ != VK_NULL_HANDLE)
+    if (external_)
     {
-        vmaDestroyImage(g_allocator, image_, allocation_);
-        if (image_view_ != VK_NULL_HANDLE)
+        // The caller owns wrapped images, so only the view and slot are ours
+        release_view(*this);
+        if (memory_ != VK_NULL_HANDLE)
         {
-            vkDestroyImageView(g_device, image_view_, nullptr);
-            image_view_ = VK_NULL_HANDLE;
+            vkDestroyImage(g_device, image_, nullptr);
+            vkFreeMemory(g_device, memory_, nullptr);
         }
+        *this = Image{};
+    }
+    else if (allocation_ != VK_NULL_HANDLE)
+    {
+        {
+            std::lock_guard lock{s_pool_mutex};
+            s_pool.push_back(*this);
+            s_pool_size += allocation_size(allocation_);
+            while (s_pool_size > g_image_pool_budget)
+            {
+                s_pool_size -= allocation_size(s_pool.front().allocation_);
+                destroy(s_pool.front());
+                s_pool.erase(s_pool.begin());
+            }
+        }
+
         allocation_ = VK_NULL_HANDLE;
         image_      = VK_NULL_HANDLE;
+        image_view_ = VK_NULL_HANDLE;
         width_      = 0;
         height_     = 0;
         channels_   = 0;
@@ -404,13 +975,15 @@ void Image::reset()
     }
 }
 
-void Image::readback(VkCommandBuffer cb, Image& readback)
+void Image::readback(VkCommandBuffer cb, Image& readback, int32_t first_row)
 {
+    VkExtent3D extent = readback.extent3_;
+    extent.height     = height_ - first_row;
     VkImageCopy copy{.srcSubresource = s_subresource,
-                     .srcOffset      = {.x = 0, .y = 0, .z = 0},
+                     .srcOffset      = {.x = 0, .y = first_row, .z = 0},
                      .dstSubresource = s_subresource,
                      .dstOffset      = {.x = 0, .y = 0, .z = 0},
-                     .extent         = readback.extent3_};
+                     .extent         = extent};
     vkCmdCopyImage(cb,
                    image_,
                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
@@ -435,6 +1008,28 @@ void Image::write(std::string const& path)
     vmaUnmapMemory(g_allocator, allocation_);
 }
 
+void Image::read(uint8_t* out, int32_t row_count, size_t stride)
+{
+    VkImageSubresource subresource{
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .arrayLayer = 0};
+    VkSubresourceLayout layout;
+    vkGetImageSubresourceLayout(g_device, image_, &subresource, &layout);
+
+    uint8_t* data;
+    vmaMapMemory(g_allocator, allocation_, reinterpret_cast<void**>(&data));
+    data += layout.offset;
+    size_t row_size = static_cast<size_t>(width_) * 4;
+    if (stride == 0)
+    {
+        stride = row_size;
+    }
+    for (int32_t i = 0; i != row_count; ++i)
+    {
+        std::memcpy(out + stride * i, data + layout.rowPitch * i, row_size);
+    }
+    vmaUnmapMemory(g_allocator, allocation_);
+}
+
 VkImageMemoryBarrier Image::start_barrier(VkImageLayout layout)
 {
     layout_ = layout;
@@ -443,8 +1038,8 @@ VkImageMemoryBarrier Image::start_barrier(VkImageLayout layout)
             .dstAccessMask       = VK_ACCESS_MEMORY_WRITE_BIT,
             .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
             .newLayout           = layout_,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -456,8 +1051,8 @@ VkImageMemoryBarrier Image::war_barrier()
             .dstAccessMask       = VK_ACCESS_MEMORY_WRITE_BIT,
             .oldLayout           = VK_IMAGE_LAYOUT_GENERAL,
             .newLayout           = VK_IMAGE_LAYOUT_GENERAL,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -471,8 +1066,8 @@ VkImageMemoryBarrier Image::raw_barrier(VkAccessFlags access)
             .dstAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
             .oldLayout           = old,
             .newLayout           = VK_IMAGE_LAYOUT_GENERAL,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -486,8 +1081,8 @@ VkImageMemoryBarrier Image::rar_barrier(VkImageLayout layout)
             .dstAccessMask       = VK_ACCESS_SHADER_READ_BIT,
             .oldLayout           = old,
             .newLayout           = layout_,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -501,8 +1096,8 @@ VkImageMemoryBarrier Image::waw_barrier()
             .dstAccessMask       = VK_ACCESS_MEMORY_WRITE_BIT,
             .oldLayout           = old,
             .newLayout           = layout_,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -516,8 +1111,8 @@ VkImageMemoryBarrier Image::blit_barrier()
             .dstAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
             .oldLayout           = old,
             .newLayout           = layout_,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -531,8 +1126,8 @@ VkImageMemoryBarrier Image::sample_barrier(VkAccessFlags src_access)
             .dstAccessMask       = VK_ACCESS_MEMORY_READ_BIT,
             .oldLayout           = old,
             .newLayout           = layout_,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
-            .dstQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
@@ -546,8 +1141,41 @@ VkImageMemoryBarrier Image::readback_barrier()
             .dstAccessMask       = VK_ACCESS_MEMORY_WRITE_BIT,
             .oldLayout           = old,
             .newLayout           = layout_,
-            .srcQueueFamilyIndex = g_graphics_queue_index,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image               = image_,
+            .subresourceRange    = s_transfer_range};
+}
+
+VkImageMemoryBarrier Image::acquire_barrier()
+{
+    layout_ = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return {.sType         = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout     = external_layout_,
+            .newLayout     = layout_,
+            .srcQueueFamilyIndex
+            = memory_ != VK_NULL_HANDLE ? VK_QUEUE_FAMILY_EXTERNAL
+                                        : g_graphics_queue_index,
             .dstQueueFamilyIndex = g_graphics_queue_index,
             .image               = image_,
             .subresourceRange    = s_transfer_range};
 }
+
+VkImageMemoryBarrier Image::release_barrier()
+{
+    VkImageLayout old = layout_;
+    layout_           = external_layout_;
+    return {.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask       = VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask       = VK_ACCESS_NONE_KHR,
+            .oldLayout           = old,
+            .newLayout           = layout_,
+            .srcQueueFamilyIndex = g_graphics_queue_index,
+            .dstQueueFamilyIndex = memory_ != VK_NULL_HANDLE
+                                       ? VK_QUEUE_FAMILY_EXTERNAL
+                                       : g_graphics_queue_index,
+            .image               = image_,
+            .subresourceRange    = s_transfer_range};
+}
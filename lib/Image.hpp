@@ -4,34 +4,181 @@
 
 #include <string>
 
+// Pixel data decoded on the host (or supplied by the caller), awaiting upload.
+// Decoding touches no Vulkan state, so it may be performed on any thread.
+// Pixels always have four channels: 8-bit sRGB for LDR images, and linear
+// 16-bit or 32-bit floats for HDR images.
+struct ImageData
+{
+    // Frees the decoded pixels. Borrowed pixels are left untouched.
+    void reset();
+
+    // Bytes per pixel, and between the starts of consecutive rows
+    size_t pixel_size() const;
+    size_t row_pitch() const;
+
+    void* data_       = nullptr;
+    int32_t width_    = 0;
+    int32_t height_   = 0;
+    int32_t channels_ = 0;
+    // Rows are tightly packed if zero
+    size_t stride_ = 0;
+    bool hdr_      = false;
+    // HDR pixels are stored as 16-bit floats
+    bool half_ = false;
+    // Pixels supplied by the caller are borrowed rather than owned
+    bool owned_ = true;
+};
+
+// Host-visible buffer holding rows on their way to an image (see
+// Image::record_upload)
+struct StagingBuffer
+{
+    // Destroys the buffer, which must no longer be in use by the device
+    void reset();
+
+    VkBuffer buffer_          = VK_NULL_HANDLE;
+    VmaAllocation allocation_ = VK_NULL_HANDLE;
+};
+
+// Persistently mapped staging memory through which images are uploaded in row
+// chunks (see Image::upload_rows). The ring is split into slots, each with its
+// own command buffer and fence, so the rows of one chunk are packed into a
+// slot while the device copies the chunks before it. Host memory used for
+// staging is bounded by the ring size, regardless of the image size.
+struct UploadRing
+{
+    constexpr static uint32_t s_slot_count     = 4;
+    constexpr static VkDeviceSize s_slot_size = VkDeviceSize{8} << 20;
+
+    // Allocates and maps the ring, and allocates the command buffers of its
+    // slots from pool (a pool of the graphics queue family). Returns 0 on
+    // success.
+    int init(VkCommandPool pool);
+    void destroy();
+
+    // Returns the next slot once the copy last submitted from it has retired,
+    // with its command buffer ready to record
+    uint32_t acquire();
+
+    // Ends the command buffer of the slot and submits it without blocking
+    void submit(uint32_t slot);
+
+    // Blocks until every submitted copy has retired
+    void wait();
+
+    uint8_t* slot_data(uint32_t slot) const
+    {
+        return data_ + s_slot_size * slot;
+    }
+
+    VkBuffer buffer_          = VK_NULL_HANDLE;
+    VmaAllocation allocation_ = VK_NULL_HANDLE;
+    uint8_t* data_            = nullptr;
+    VkCommandPool pool_       = VK_NULL_HANDLE;
+    VkCommandBuffer command_buffers_[s_slot_count] = {};
+    VkFence fences_[s_slot_count]                  = {};
+    bool pending_[s_slot_count]                    = {};
+    uint32_t next_slot_                            = 0;
+};
+
 class Image
 {
 public:
-    static void reset_count(uint32_t counter = 0);
+    // Decodes an EXR, PNG, JPEG or BMP image based on the path extension. If
+    // decoding fails, the returned data is empty (with a null data_ pointer).
+    static ImageData decode(char const* path);
+
+    // Reads the extent of an image from its header, without decoding its
+    // pixels. Returns false if the header can't be read.
+    static bool
+    read_extent(char const* path, int32_t& width, int32_t& height);
+
+    // Uploads decoded data to the GPU through the upload ring, blocking until
+    // the upload completes. The result is provided in the shader read-only
+    // layout. Empty data produces an empty image (with a null image_ handle).
+    static Image create_from_data(ImageData const& data, UploadRing& ring);
 
-    // Decodes an image and uploads it to the GPU. The result is provided in the
-    // shader read-only layout.
-    static Image create_from_non_exr(char const* path);
-    static Image create_from_exr(char const* path);
+    // Creates a device image matching the width and format of decoded data,
+    // but with the supplied height, so that the data may be uploaded a band of
+    // rows at a time with upload_rows. The image layout that results is
+    // undefined.
+    static Image create_for_data(ImageData const& data, int32_t height);
+
+    // Uploads rows [first_row, first_row + row_count) of data to the top rows
+    // of this image a slot of the upload ring at a time, blocking until the
+    // upload completes. The result is provided in the shader read-only layout.
+    void upload_rows(ImageData const& data,
+                     int32_t first_row,
+                     int32_t row_count,
+                     UploadRing& ring);
+
+    // Records the upload of rows [first_row, first_row + row_count) of data to
+    // the top rows of this image into cb, which may be submitted to either the
+    // graphics or the compute queue. The rows are copied to the returned
+    // staging buffer, which must be retained until cb retires. The result is
+    // provided in the shader read-only layout.
+    StagingBuffer record_upload(ImageData const& data,
+                                int32_t first_row,
+                                int32_t row_count,
+                                VkCommandBuffer cb);
+
+    // Binds an image owned by the caller (created on the flop device with
+    // sampled usage) to the sampled image array, without copying it. The
+    // image is expected in external_layout, and is returned to it by
+    // release_barrier.
+    static Image wrap(VkImage image,
+                      VkFormat format,
+                      int32_t width,
+                      int32_t height,
+                      VkImageLayout external_layout);
+
+    // Creates an image bound to memory exported by another device or instance
+    // as an opaque file descriptor, and binds it to the sampled image array.
+    // The create parameters must match those of the exported image. The image
+    // takes ownership of fd on success. The allocation size and memory type
+    // must be those of the exported allocation. Returns an empty image on
+    // failure.
+    static Image import_fd(int fd,
+                           VkDeviceSize size,
+                           uint32_t memory_type_index,
+                           bool dedicated,
+                           VkImageUsageFlags usage,
+                           VkFormat format,
+                           int32_t width,
+                           int32_t height,
+                           VkImageLayout external_layout);
 
     // Creates a device image with matching dimensions. The image layout that
     // results is undefined.
     static Image
-    create(const Image& other, VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT, bool attachment = false);
+    create(const Image& other, VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT);
 
     // Creates a host image with matching dimensions suitable for readback.
     static Image create_readback(Image const& other,
                                  VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);
 
+    // Returns the image to an internal pool keyed by extent, format and usage.
+    // A subsequent create call with a matching key reuses the allocation, view
+    // and bindless slot without touching VMA or the descriptor set. The image
+    // must no longer be in use by the device. External images are never
+    // pooled: their view and slot are released, along with imported memory.
     void reset();
+
     float aspect() const
     {
         return static_cast<float>(width_) / height_;
     }
 
-    void readback(VkCommandBuffer cb, Image& readback);
+    // Copies this image, starting at first_row, to the top of a readback image
+    // of equal extent
+    void readback(VkCommandBuffer cb, Image& readback, int32_t first_row = 0);
     void write(std::string const& path);
 
+    // Copies the first row_count rows of a readback image to host memory,
+    // with rows stride bytes apart (or tightly packed if stride is zero)
+    void read(uint8_t* out, int32_t row_count, size_t stride = 0);
+
     void set_extents();
 
     VkImageMemoryBarrier start_barrier(VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
@@ -43,10 +190,23 @@ public:
     VkImageMemoryBarrier sample_barrier(VkAccessFlags src_access = VK_ACCESS_MEMORY_WRITE_BIT);
     VkImageMemoryBarrier readback_barrier();
 
+    // Transitions an external image from the caller's layout to the shader
+    // read-only layout, and back. Imported images are acquired from, and
+    // released to, the external queue family.
+    VkImageMemoryBarrier acquire_barrier();
+    VkImageMemoryBarrier release_barrier();
+
     VkImage image_            = VK_NULL_HANDLE;
     VkImageView image_view_   = VK_NULL_HANDLE;
     VmaAllocation allocation_ = VK_NULL_HANDLE;
     VkImageLayout layout_     = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkFormat format_          = VK_FORMAT_UNDEFINED;
+    VkImageUsageFlags usage_  = 0;
+
+    // Memory owned by an imported image, and the layout an external image is
+    // handed over in
+    VkDeviceMemory memory_         = VK_NULL_HANDLE;
+    VkImageLayout external_layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
 
     VkExtent2D extent2_ = {};
     VkExtent3D extent3_ = {};
@@ -56,4 +216,6 @@ public:
     uint32_t index_     = 0;
     bool hdr_           = false;
     bool writable_      = false;
+    // Wrapped or imported rather than allocated by flop
+    bool external_ = false;
 };
@@ -25,11 +25,39 @@ VkShaderModule Kernel::compile_shader(uint8_t const* data, size_t size)
     return shader_module;
 }
 
+void Kernel::create_layouts()
+{
+    if (s_kernel_layout != VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    VkPushConstantRange push_constant_range{
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset     = 0,
+        .size       = sizeof(PushConstants)};
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info{
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount         = 1,
+        .pSetLayouts            = &g_descriptor_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges    = &push_constant_range};
+
+    vkCreatePipelineLayout(
+        g_device, &pipeline_layout_info, nullptr, &s_kernel_layout);
+
+    push_constant_range.size = sizeof(FilterPushConstants);
+    vkCreatePipelineLayout(
+        g_device, &pipeline_layout_info, nullptr, &s_compare_kernel_layout);
+}
+
 Kernel Kernel::create(uint8_t const* data,
                       size_t size,
                       int thread_count_x,
                       int thread_count_y,
-                      bool is_compare_kernel)
+                      bool is_compare_kernel,
+                      VkSpecializationInfo const* specialization)
 {
     Kernel out;
     out.thread_count_x_ = thread_count_x;
@@ -37,28 +65,6 @@ Kernel Kernel::create(uint8_t const* data,
 
     VkShaderModule shader_module = compile_shader(data, size);
 
-    if (s_kernel_layout == VK_NULL_HANDLE)
-    {
-        VkPushConstantRange push_constant_range{
-            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-            .offset     = 0,
-            .size       = sizeof(PushConstants)};
-
-        VkPipelineLayoutCreateInfo pipeline_layout_info{
-            .sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-            .setLayoutCount = 1,
-            .pSetLayouts    = &g_descriptor_set_layout,
-            .pushConstantRangeCount = 1,
-            .pPushConstantRanges    = &push_constant_range};
-
-        vkCreatePipelineLayout(
-            g_device, &pipeline_layout_info, nullptr, &s_kernel_layout);
-
-        push_constant_range.size = sizeof(ComparePushConstants);
-        vkCreatePipelineLayout(
-            g_device, &pipeline_layout_info, nullptr, &s_compare_kernel_layout);
-    }
-
     VkComputePipelineCreateInfo pipeline_info{
         .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
         .stage  = {
@@ -66,12 +72,16 @@ Kernel Kernel::create(uint8_t const* data,
             .stage = VK_SHADER_STAGE_COMPUTE_BIT,
             .module = shader_module,
             .pName = "CSMain",
-            .pSpecializationInfo = nullptr,
+            .pSpecializationInfo = specialization,
         },
         .layout = is_compare_kernel ? s_compare_kernel_layout : s_kernel_layout,
     };
-    vkCreateComputePipelines(
-        g_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &out.pipeline_);
+    vkCreateComputePipelines(g_device,
+                             g_pipeline_cache,
+                             1,
+                             &pipeline_info,
+                             nullptr,
+                             &out.pipeline_);
 
     return out;
 }
@@ -81,8 +91,12 @@ uint32_t div_round_up(int a, int b)
     return (a + b - 1) / b;
 }
 
-void Kernel::dispatch(VkCommandBuffer cb, Image const& input, Image const& output)
+void Kernel::dispatch(VkCommandBuffer cb,
+                      Image const& input,
+                      Image const& output,
+                      int32_t rows)
 {
+    int32_t height = rows ? rows : input.height_;
     vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
     vkCmdBindDescriptorSets(cb,
                             VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -93,7 +107,7 @@ void Kernel::dispatch(VkCommandBuffer cb, Image const& input, Image const& outpu
                             0,
                             nullptr);
 
-    PushConstants push_constants{.extent = {input.width_, input.height_},
+    PushConstants push_constants{.extent = {input.width_, height},
                                  .input  = input.index_,
                                  .output = output.index_};
     vkCmdPushConstants(cb,
@@ -104,15 +118,17 @@ void Kernel::dispatch(VkCommandBuffer cb, Image const& input, Image const& outpu
                        &push_constants);
     vkCmdDispatch(cb,
                   div_round_up(input.width_, thread_count_x_),
-                  div_round_up(input.height_, thread_count_y_),
+                  div_round_up(height, thread_count_y_),
                   1);
 }
 
 void Kernel::dispatch(VkCommandBuffer cb,
                       Image const& input1,
                       Image const& input2,
-                      Image const& output)
+                      Image const& output,
+                      int32_t rows)
 {
+    int32_t height = rows ? rows : input1.height_;
     vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
     vkCmdBindDescriptorSets(cb,
                             VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -123,7 +139,7 @@ void Kernel::dispatch(VkCommandBuffer cb,
                             0,
                             nullptr);
 
-    ComparePushConstants push_constants{.extent = {input1.width_, input1.height_},
+    ComparePushConstants push_constants{.extent = {input1.width_, height},
                                         .input1  = input1.index_,
                                         .input2  = input2.index_,
                                         .output1 = output.index_};
@@ -135,14 +151,16 @@ void Kernel::dispatch(VkCommandBuffer cb,
                        &push_constants);
     vkCmdDispatch(cb,
                   div_round_up(input1.width_, thread_count_x_),
-                  div_round_up(input1.height_, thread_count_y_),
+                  div_round_up(height, thread_count_y_),
                   1);
 }
 
 void Kernel::dispatch(VkCommandBuffer cb,
                       Image const& input,
                       Image const& output,
-                      Buffer const& buffer)
+                      uint32_t tonemap,
+                      float exposure,
+                      bool handle_alpha)
 {
     vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
     vkCmdBindDescriptorSets(cb,
@@ -154,19 +172,54 @@ void Kernel::dispatch(VkCommandBuffer cb,
                             0,
                             nullptr);
 
-    ComparePushConstants push_constants{.extent = {input.width_, input.height_},
-                                        .input1 = input.index_,
-                                        .input2 = output.index_,
-                                        .output1 = buffer.index_};
+    YyCxCzPushConstants push_constants{
+        .extent       = {output.width_, output.height_},
+        .input        = input.index_,
+        .output       = output.index_,
+        .tonemap      = tonemap,
+        .exposure     = exposure,
+        .handle_alpha = handle_alpha ? 1u : 0u};
     vkCmdPushConstants(cb,
                        s_compare_kernel_layout,
                        VK_SHADER_STAGE_COMPUTE_BIT,
                        0,
-                       sizeof(ComparePushConstants),
+                       sizeof(YyCxCzPushConstants),
                        &push_constants);
     vkCmdDispatch(cb,
-                  div_round_up(input.width_, thread_count_x_),
-                  div_round_up(input.height_, thread_count_y_),
+                  div_round_up(output.width_, thread_count_x_),
+                  div_round_up(output.height_, thread_count_y_),
+                  1);
+}
+
+void Kernel::dispatch(VkCommandBuffer cb,
+                      Image const& input,
+                      Image const& output,
+                      Buffer const& color_map)
+{
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+    vkCmdBindDescriptorSets(cb,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            s_compare_kernel_layout,
+                            0,
+                            1,
+                            &g_descriptor_set,
+                            0,
+                            nullptr);
+
+    ColorMapPushConstants push_constants{
+        .extent    = {output.width_, output.height_},
+        .input     = input.index_,
+        .output    = output.index_,
+        .color_map = color_map.index_};
+    vkCmdPushConstants(cb,
+                       s_compare_kernel_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT,
+                       0,
+                       sizeof(ColorMapPushConstants),
+                       &push_constants);
+    vkCmdDispatch(cb,
+                  div_round_up(output.width_, thread_count_x_),
+                  div_round_up(output.height_, thread_count_y_),
                   1);
 }
 
@@ -174,8 +227,10 @@ void Kernel::dispatch(VkCommandBuffer cb,
                       Image const& input1,
                       Image const& input2,
                       Image const& output1,
-                      Image const& output2)
+                      Image const& output2,
+                      int32_t rows)
 {
+    int32_t height = rows ? rows : input1.height_;
     vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
     vkCmdBindDescriptorSets(cb,
                             VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -186,7 +241,7 @@ void Kernel::dispatch(VkCommandBuffer cb,
                             0,
                             nullptr);
 
-    ComparePushConstants push_constants{.extent = {input1.width_, input1.height_},
+    ComparePushConstants push_constants{.extent = {input1.width_, height},
                                         .input1  = input1.index_,
                                         .input2  = input2.index_,
                                         .output1 = output1.index_,
@@ -199,33 +254,144 @@ void Kernel::dispatch(VkCommandBuffer cb,
                        &push_constants);
     vkCmdDispatch(cb,
                   div_round_up(input1.width_, thread_count_x_),
-                  div_round_up(input1.height_, thread_count_y_),
+                  div_round_up(height, thread_count_y_),
                   1);
 }
 
-void Kernel::dispatch(VkCommandBuffer cb, Image const& input, Buffer const& output)
+void Kernel::dispatch(VkCommandBuffer cb,
+                      Image const& input1,
+                      Image const& input2,
+                      Image const& output1,
+                      Image const& output2,
+                      Image const& moments1,
+                      Image const& moments2,
+                      Buffer const& kernels,
+                      uint32_t outputs,
+                      int32_t rows)
 {
+    int32_t height = rows ? rows : input1.height_;
     vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
     vkCmdBindDescriptorSets(cb,
                             VK_PIPELINE_BIND_POINT_COMPUTE,
-                            s_kernel_layout,
+                            s_compare_kernel_layout,
                             0,
                             1,
                             &g_descriptor_set,
                             0,
                             nullptr);
 
-    PushConstants push_constants{.extent = {input.width_, input.height_},
-                                 .input  = input.index_,
-                                 .output = output.index_};
+    FilterPushConstants push_constants{.extent   = {input1.width_, height},
+                                       .input1   = input1.index_,
+                                       .input2   = input2.index_,
+                                       .output1  = output1.index_,
+                                       .output2  = output2.index_,
+                                       .moments1 = moments1.index_,
+                                       .moments2 = moments2.index_,
+                                       .outputs  = outputs,
+                                       .kernels  = kernels.index_};
     vkCmdPushConstants(cb,
                        s_compare_kernel_layout,
                        VK_SHADER_STAGE_COMPUTE_BIT,
                        0,
-                       sizeof(PushConstants),
+                       sizeof(FilterPushConstants),
                        &push_constants);
     vkCmdDispatch(cb,
-                  div_round_up(input.width_, thread_count_x_),
-                  div_round_up(input.height_, thread_count_y_),
+                  div_round_up(input1.width_, thread_count_x_),
+                  div_round_up(height, thread_count_y_),
+                  1);
+}
+
+void Kernel::dispatch(VkCommandBuffer cb,
+                      Image const& input1,
+                      Image const& input2,
+                      Image const& output1,
+                      Image const& output2,
+                      Image const& moments1,
+                      Image const& moments2,
+                      Image const& reference_color,
+                      Image const& reference_features,
+                      Image const& error,
+                      Buffer const& histogram,
+                      Buffer const& statistics,
+                      Buffer const& kernels,
+                      int32_t histogram_buckets,
+                      FlopHistogramScale histogram_scale,
+                      int32_t first_row,
+                      int32_t row_count,
+                      uint32_t outputs,
+                      int32_t rows)
+{
+    int32_t height = rows ? rows : input1.height_;
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+    vkCmdBindDescriptorSets(cb,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            s_compare_kernel_layout,
+                            0,
+                            1,
+                            &g_descriptor_set,
+                            0,
+                            nullptr);
+
+    FilterPushConstants push_constants{
+        .extent             = {input1.width_, height},
+        .input1             = input1.index_,
+        .input2             = input2.index_,
+        .output1            = output1.index_,
+        .output2            = output2.index_,
+        .moments1           = moments1.index_,
+        .moments2           = moments2.index_,
+        .error              = error.index_,
+        .histogram          = histogram.index_,
+        .statistics         = statistics.index_,
+        .first_row          = static_cast<uint32_t>(first_row),
+        .row_count          = static_cast<uint32_t>(row_count),
+        .outputs            = outputs,
+        .histogram_buckets  = static_cast<uint32_t>(histogram_buckets),
+        .histogram_scale    = static_cast<uint32_t>(histogram_scale),
+        .reference_color    = reference_color.index_,
+        .reference_features = reference_features.index_,
+        .kernels            = kernels.index_};
+    vkCmdPushConstants(cb,
+                       s_compare_kernel_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT,
+                       0,
+                       sizeof(FilterPushConstants),
+                       &push_constants);
+    vkCmdDispatch(cb,
+                  div_round_up(input1.width_, thread_count_x_),
+                  div_round_up(height, thread_count_y_),
                   1);
 }
+
+void Kernel::dispatch(VkCommandBuffer cb,
+                      Buffer const& input,
+                      Buffer const& output,
+                      int32_t histogram_buckets,
+                      FlopGate const& gate)
+{
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+    vkCmdBindDescriptorSets(cb,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            s_compare_kernel_layout,
+                            0,
+                            1,
+                            &g_descriptor_set,
+                            0,
+                            nullptr);
+
+    StatisticsPushConstants push_constants{
+        .histogram_buckets     = static_cast<uint32_t>(histogram_buckets),
+        .input                 = input.index_,
+        .output                = output.index_,
+        .gate_mean_error       = gate.mean_error,
+        .gate_percentile       = gate.percentile,
+        .gate_percentile_error = gate.percentile_error,
+        .gate_max_error        = gate.max_error};
+    vkCmdPushConstants(cb,
+                       s_compare_kernel_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT,
+                       0,
+                       sizeof(StatisticsPushConstants),
+                       &push_constants);
+    vkCmdDispatch(cb, 1, 1, 1);
+}
@@ -5,6 +5,8 @@
 #include "Buffer.hpp"
 #include "Image.hpp"
 
+#include <flop/Flop.h>
+
 class Kernel
 {
 public:
@@ -25,29 +27,172 @@ public:
         uint32_t output2;
     };
 
+    // Push constants of the fused filter kernels (see Filter.hlsl). These use
+    // the compare kernel layout.
+    struct FilterPushConstants
+    {
+        int32_t extent[2];
+        uint32_t input1;
+        uint32_t input2;
+        uint32_t output1;
+        uint32_t output2;
+        uint32_t moments1;
+        uint32_t moments2;
+        uint32_t error;
+        uint32_t histogram;
+        uint32_t statistics;
+        uint32_t first_row;
+        uint32_t row_count;
+        uint32_t outputs;
+        uint32_t histogram_buckets;
+        uint32_t histogram_scale;
+        uint32_t reference_color;
+        uint32_t reference_features;
+        uint32_t kernels;
+    };
+
+    // Push constants of the statistics kernel (see Statistics.hlsl). These use
+    // the compare kernel layout.
+    struct StatisticsPushConstants
+    {
+        uint32_t histogram_buckets;
+        uint32_t padding;
+        uint32_t input;
+        uint32_t output;
+        float gate_mean_error;
+        float gate_percentile;
+        float gate_percentile_error;
+        float gate_max_error;
+    };
+
+    // Push constants of the YyCxCz conversion (see YyCxCz.hlsl). These use the
+    // compare kernel layout.
+    struct YyCxCzPushConstants
+    {
+        int32_t extent[2];
+        uint32_t input;
+        uint32_t output;
+        uint32_t tonemap;
+        float exposure;
+        uint32_t handle_alpha;
+    };
+
+    // Push constants of the error color map (see ErrorColorMap.hlsl). These
+    // use the compare kernel layout.
+    struct ColorMapPushConstants
+    {
+        int32_t extent[2];
+        uint32_t input;
+        uint32_t output;
+        uint32_t color_map;
+    };
+
+    // Optional outputs of the vertical filter pass. With
+    // FILTER_CACHED_REFERENCE, the fully filtered reference written by an
+    // earlier FILTER_OUTPUT_REFERENCE dispatch is read instead of filtering the
+    // reference again, and the horizontal pass only filters the test image.
+    enum FilterOutput : uint32_t
+    {
+        FILTER_OUTPUT_COLORS    = 1,
+        FILTER_OUTPUT_ERROR     = 2,
+        FILTER_OUTPUT_REFERENCE = 4,
+        FILTER_CACHED_REFERENCE = 8,
+    };
+
     static void init_dxc();
+    // Creates the pipeline layouts shared by every kernel. Must be called
+    // before the first create, after which kernels may be created from
+    // several threads at once.
+    static void create_layouts();
+    // Specialization constants of the shader may be supplied, e.g. the kernel
+    // radii of the filter kernels
     static Kernel create(uint8_t const* data,
                          size_t size,
                          int thread_count_x,
                          int thread_count_y,
-                         bool is_compare_kernel);
+                         bool is_compare_kernel,
+                         VkSpecializationInfo const* specialization = nullptr);
     static VkShaderModule compile_shader(uint8_t const* data, size_t size);
 
-    void dispatch(VkCommandBuffer cb, Image const& input, Image const& output);
+    // If rows is nonzero, only the first rows of the images are processed, and
+    // filters clamp to the last of these rows instead of the image edge
+    void dispatch(VkCommandBuffer cb,
+                  Image const& input,
+                  Image const& output,
+                  int32_t rows = 0);
     void dispatch(VkCommandBuffer cb,
                   Image const& input1,
                   Image const& input2,
-                  Image const& output);
+                  Image const& output,
+                  int32_t rows = 0);
+    // Converts input to YyCxCz space in output. HDR inputs are tonemapped
+    // with tonemap (a FlopTonemapper, or 0 for none) after scaling by
+    // exposure, and the Yy channel is weighted by alpha if handle_alpha is set.
+    void dispatch(VkCommandBuffer cb,
+                  Image const& input,
+                  Image const& output,
+                  uint32_t tonemap,
+                  float exposure,
+                  bool handle_alpha);
+    // Maps the error in input to the colors of color_map in output
     void dispatch(VkCommandBuffer cb,
                   Image const& input,
                   Image const& output,
-                  Buffer const& buffer);
+                  Buffer const& color_map);
+    void dispatch(VkCommandBuffer cb,
+                  Image const& input1,
+                  Image const& input2,
+                  Image const& output1,
+                  Image const& output2,
+                  int32_t rows = 0);
+    // Horizontal filter pass over a reference and test image pair, with the
+    // filter weights in kernels (see FilterKernels.hpp). outputs may only
+    // contain FILTER_CACHED_REFERENCE, which skips the reference.
     void dispatch(VkCommandBuffer cb,
                   Image const& input1,
                   Image const& input2,
                   Image const& output1,
-                  Image const& output2);
-    void dispatch(VkCommandBuffer cb, Image const& input, Buffer const& output);
+                  Image const& output2,
+                  Image const& moments1,
+                  Image const& moments2,
+                  Buffer const& kernels,
+                  uint32_t outputs,
+                  int32_t rows = 0);
+    // Vertical filter pass, which computes the final error. The error of rows
+    // [first_row, first_row + row_count) is accumulated in the histogram and
+    // the statistics scratch buffer, along with a configurable histogram of
+    // histogram_buckets buckets if nonzero.
+    // outputs is a combination of FilterOutput flags; the filtered colors and
+    // the error image are only written if requested. The fully filtered
+    // reference is written to, or read from, reference_color and
+    // reference_features.
+    void dispatch(VkCommandBuffer cb,
+                  Image const& input1,
+                  Image const& input2,
+                  Image const& output1,
+                  Image const& output2,
+                  Image const& moments1,
+                  Image const& moments2,
+                  Image const& reference_color,
+                  Image const& reference_features,
+                  Image const& error,
+                  Buffer const& histogram,
+                  Buffer const& statistics,
+                  Buffer const& kernels,
+                  int32_t histogram_buckets,
+                  FlopHistogramScale histogram_scale,
+                  int32_t first_row,
+                  int32_t row_count,
+                  uint32_t outputs,
+                  int32_t rows = 0);
+    // Statistics pass, dispatched as a single group. Resolves the statistics
+    // accumulated in input, along with a configurable histogram of
+    // histogram_buckets buckets if nonzero, and checks them against the gate.
+    void dispatch(VkCommandBuffer cb,
+                  Buffer const& input,
+                  Buffer const& output,
+                  int32_t histogram_buckets,
+                  FlopGate const& gate);
 
 private:
     VkPipeline pipeline_ = VK_NULL_HANDLE;
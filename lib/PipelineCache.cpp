@@ -0,0 +1,155 @@
+#include "PipelineCache.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#include "ResultCache.hpp"
+#include "VkGlobals.hpp"
+
+namespace flop
+{
+std::string default_pipeline_cache_directory()
+{
+    std::filesystem::path base;
+#if defined(_WIN32)
+    if (char const* local = std::getenv("LOCALAPPDATA"))
+    {
+        base = local;
+    }
+#elif defined(__APPLE__)
+    if (char const* home = std::getenv("HOME"))
+    {
+        base = std::filesystem::path{home} / "Library" / "Caches";
+    }
+#else
+    if (char const* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    {
+        base = xdg;
+    }
+    else if (char const* home = std::getenv("HOME"))
+    {
+        base = std::filesystem::path{home} / ".cache";
+    }
+#endif
+    if (base.empty())
+    {
+        return {};
+    }
+    return (base / "flop").string();
+}
+
+// Contents of the cache file as last read or written, so that unchanged caches
+// aren't written again
+static std::vector<char> s_stored_data;
+static std::mutex s_store_mutex;
+
+// Pipelines are keyed by the pipeline cache UUID of the device (which
+// identifies the device and its compiler) and the driver version
+static std::filesystem::path pipeline_cache_path()
+{
+    VkPhysicalDeviceProperties const& props = g_physical_device_props;
+    char name[64];
+    int length = std::snprintf(name, sizeof(name), "pipelines-");
+    for (uint8_t byte : props.pipelineCacheUUID)
+    {
+        length += std::snprintf(
+            name + length, sizeof(name) - length, "%02x", byte);
+    }
+    std::snprintf(name + length,
+                  sizeof(name) - length,
+                  "-%08" PRIx32 ".bin",
+                  props.driverVersion);
+    return std::filesystem::path{g_pipeline_cache_directory} / name;
+}
+
+bool load_pipeline_cache()
+{
+    std::vector<char> data;
+    if (!g_pipeline_cache_directory.empty())
+    {
+        std::ifstream file{pipeline_cache_path(), std::ios::binary};
+        data.assign(std::istreambuf_iterator<char>{file},
+                    std::istreambuf_iterator<char>{});
+    }
+
+    // Drivers validate the header of the data, and ignore data written by
+    // another device or driver
+    VkPipelineCacheCreateInfo cache_info{
+        .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.size(),
+        .pInitialData    = data.data(),
+    };
+    if (vkCreatePipelineCache(g_device, &cache_info, nullptr, &g_pipeline_cache)
+        == VK_SUCCESS)
+    {
+        s_stored_data = std::move(data);
+        return !s_stored_data.empty();
+    }
+
+    // Data the driver rejects outright is discarded
+    cache_info.initialDataSize = 0;
+    cache_info.pInitialData    = nullptr;
+    if (vkCreatePipelineCache(g_device, &cache_info, nullptr, &g_pipeline_cache)
+        != VK_SUCCESS)
+    {
+        g_pipeline_cache = VK_NULL_HANDLE;
+    }
+    return false;
+}
+
+void store_pipeline_cache()
+{
+    if (g_pipeline_cache == VK_NULL_HANDLE
+        || g_pipeline_cache_directory.empty())
+    {
+        return;
+    }
+
+    // Pipelines may be created (and stored) by several threads at once
+    std::lock_guard lock{s_store_mutex};
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(g_device, g_pipeline_cache, &size, nullptr)
+        != VK_SUCCESS)
+    {
+        return;
+    }
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(g_device, g_pipeline_cache, &size, data.data())
+            != VK_SUCCESS
+        || size == 0)
+    {
+        return;
+    }
+    data.resize(size);
+
+    // A cache that was loaded and created no new pipelines is left as is
+    if (data == s_stored_data)
+    {
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(g_pipeline_cache_directory, error);
+    std::filesystem::path path      = pipeline_cache_path();
+    std::filesystem::path temporary = temporary_path(path);
+    {
+        std::ofstream file{temporary, std::ios::binary};
+        file.write(data.data(), static_cast<std::streamsize>(size));
+        if (!file)
+        {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    publish(temporary, path);
+    s_stored_data = std::move(data);
+}
+} // namespace flop
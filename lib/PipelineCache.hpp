@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+// Pipeline cache shared by every pipeline, persisted across runs so that
+// pipelines aren't compiled to device code again by every process (see
+// flop_config_set_pipeline_cache)
+namespace flop
+{
+// Directory holding cached pipelines, or empty if the cache isn't persisted.
+// Resolved by flop_init unless configured.
+inline std::string g_pipeline_cache_directory;
+inline bool g_pipeline_cache_configured = false;
+
+// Returns the flop directory of the user cache directory, or an empty path if
+// it can't be determined
+std::string default_pipeline_cache_directory();
+
+// Creates g_pipeline_cache, seeded with the pipelines cached for the current
+// device and driver version if found. Returns true if cached pipelines were
+// loaded.
+bool load_pipeline_cache();
+
+// Writes the contents of g_pipeline_cache to the cache directory, unless they
+// are unchanged since they were last loaded or written
+void store_pipeline_cache();
+} // namespace flop
@@ -0,0 +1,230 @@
+#include "ResultCache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+namespace flop
+{
+// Files are compared and hashed in chunks of this size
+constexpr static size_t s_chunk_size = 1 << 20;
+
+// Identifies a result entry, and the version of its layout
+constexpr static char s_result_magic[8]
+    = {'F', 'L', 'O', 'P', 'R', 'E', 'S', '1'};
+
+// Entries larger than this are rejected as corrupt
+constexpr static uint32_t s_max_histogram_buckets = 4096;
+
+uint64_t hash_bytes(void const* data, size_t size, uint64_t hash)
+{
+    constexpr uint64_t prime = 1099511628211ull;
+    auto bytes               = static_cast<uint8_t const*>(data);
+    size_t i                 = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i != size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return hash;
+}
+
+PairFingerprint
+fingerprint_pair(char const* reference_path, char const* test_path, bool hash)
+{
+    std::error_code error;
+    uint64_t sizes[2] = {std::filesystem::file_size(reference_path, error), 0};
+    if (error)
+    {
+        return {};
+    }
+    sizes[1] = std::filesystem::file_size(test_path, error);
+    if (error)
+    {
+        return {};
+    }
+
+    // Files of different sizes can't be identical
+    bool identical = sizes[0] == sizes[1];
+    if (!identical && !hash)
+    {
+        return {.valid_ = true};
+    }
+
+    std::ifstream files[2] = {std::ifstream{reference_path, std::ios::binary},
+                              std::ifstream{test_path, std::ios::binary}};
+    if (!files[0] || !files[1])
+    {
+        return {};
+    }
+
+    std::vector<char> chunks[2];
+    uint64_t hashes[2];
+    uint64_t remaining[2];
+    for (int i = 0; i != 2; ++i)
+    {
+        chunks[i].resize(static_cast<size_t>(std::min<uint64_t>(
+            std::max(sizes[0], sizes[1]), s_chunk_size)));
+        hashes[i]    = hash_bytes(&sizes[i], sizeof(sizes[i]));
+        remaining[i] = sizes[i];
+    }
+
+    while (remaining[0] != 0 || remaining[1] != 0)
+    {
+        size_t counts[2];
+        for (int i = 0; i != 2; ++i)
+        {
+            counts[i] = static_cast<size_t>(
+                std::min<uint64_t>(remaining[i], s_chunk_size));
+            if (counts[i] != 0 && !files[i].read(chunks[i].data(), counts[i]))
+            {
+                return {};
+            }
+            remaining[i] -= counts[i];
+            if (hash)
+            {
+                hashes[i] = hash_bytes(chunks[i].data(), counts[i], hashes[i]);
+            }
+        }
+
+        // Chunks have equal sizes as long as the files might be identical
+        identical
+            = identical
+              && std::memcmp(chunks[0].data(), chunks[1].data(), counts[0]) == 0;
+        // Without hashing, reading stops at the first difference
+        if (!identical && !hash)
+        {
+            break;
+        }
+    }
+
+    return {.reference_hash_ = hashes[0],
+            .test_hash_      = hashes[1],
+            .identical_      = identical,
+            .valid_          = true};
+}
+
+static std::filesystem::path entry_path(uint64_t key, char const* extension)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016" PRIx64 "%s", key, extension);
+    return std::filesystem::path{g_result_cache_directory} / name;
+}
+
+std::filesystem::path temporary_path(std::filesystem::path const& target)
+{
+    static uint64_t const s_salt = std::random_device{}();
+    static std::atomic<uint64_t> s_counter{0};
+
+    char suffix[48];
+    std::snprintf(suffix,
+                  sizeof(suffix),
+                  ".%08" PRIx64 "%" PRIu64 ".tmp",
+                  s_salt & 0xffffffff,
+                  s_counter.fetch_add(1));
+    std::filesystem::path path = target;
+    path += suffix;
+    return path;
+}
+
+void publish(std::filesystem::path const& source,
+             std::filesystem::path const& target)
+{
+    std::error_code error;
+    std::filesystem::rename(source, target, error);
+    if (error)
+    {
+        std::filesystem::remove(source, error);
+    }
+}
+
+bool load_result(uint64_t key, CachedResult& result)
+{
+    std::ifstream file{entry_path(key, ".bin"), std::ios::binary};
+    if (!file)
+    {
+        return false;
+    }
+
+    char magic[sizeof(s_result_magic)];
+    uint32_t buckets = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&result.summary_), sizeof(FlopSummary));
+    file.read(reinterpret_cast<char*>(&buckets), sizeof(buckets));
+    if (!file || std::memcmp(magic, s_result_magic, sizeof(magic)) != 0
+        || buckets > s_max_histogram_buckets)
+    {
+        return false;
+    }
+
+    result.histogram_counts_.resize(buckets);
+    result.histogram_cdf_.resize(buckets);
+    file.read(reinterpret_cast<char*>(result.histogram_counts_.data()),
+              buckets * 4);
+    file.read(reinterpret_cast<char*>(result.histogram_cdf_.data()),
+              buckets * 4);
+    return static_cast<bool>(file);
+}
+
+bool load_error_image(uint64_t key, char const* path)
+{
+    std::error_code error;
+    auto options = std::filesystem::copy_options::overwrite_existing;
+    std::filesystem::copy_file(entry_path(key, ".png"), path, options, error);
+    return !error;
+}
+
+void store_result(uint64_t key,
+                  CachedResult const& result,
+                  char const* error_image_path)
+{
+    std::error_code error;
+    if (error_image_path && g_result_cache_error_images
+        && std::filesystem::exists(error_image_path, error))
+    {
+        std::filesystem::path image     = entry_path(key, ".png");
+        std::filesystem::path temporary = temporary_path(image);
+        std::filesystem::copy_file(error_image_path, temporary, error);
+        if (!error)
+        {
+            publish(temporary, image);
+        }
+    }
+
+    // The result is published after its error image, so that a reader finding
+    // the result also finds the image
+    std::filesystem::path entry     = entry_path(key, ".bin");
+    std::filesystem::path temporary = temporary_path(entry);
+    {
+        std::ofstream file{temporary, std::ios::binary};
+        auto buckets = static_cast<uint32_t>(result.histogram_counts_.size());
+        file.write(s_result_magic, sizeof(s_result_magic));
+        file.write(reinterpret_cast<char const*>(&result.summary_),
+                   sizeof(FlopSummary));
+        file.write(reinterpret_cast<char const*>(&buckets), sizeof(buckets));
+        file.write(
+            reinterpret_cast<char const*>(result.histogram_counts_.data()),
+            buckets * 4);
+        file.write(reinterpret_cast<char const*>(result.histogram_cdf_.data()),
+                   buckets * 4);
+        if (!file)
+        {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    publish(temporary, entry);
+}
+} // namespace flop
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <flop/Flop.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// On-disk cache of pair results, addressed by the contents of both input files
+// and every setting that affects them (see flop_config_set_result_cache)
+namespace flop
+{
+// Directory holding cached results, or empty if the cache is disabled
+inline std::string g_result_cache_directory;
+
+// Whether color-mapped error images are cached along with the results
+inline bool g_result_cache_error_images = false;
+
+// FNV-1a over 8-byte words, with an extra shift to diffuse the high bits of
+// each word. Chained by passing the previous hash.
+uint64_t hash_bytes(void const* data,
+                    size_t size,
+                    uint64_t hash = 14695981039346656037ull);
+
+// Identity of the input files of a pair
+struct PairFingerprint
+{
+    // Hashes of the contents of both files, if requested
+    uint64_t reference_hash_ = 0;
+    uint64_t test_hash_      = 0;
+    // Both files have identical contents
+    bool identical_ = false;
+    // Both files could be read
+    bool valid_ = false;
+};
+
+// Compares the contents of both files, reading them in chunks. Files of
+// different sizes are only read if hash is set, in which case both files are
+// hashed in the same pass.
+PairFingerprint
+fingerprint_pair(char const* reference_path, char const* test_path, bool hash);
+
+// Cached result of a pair. Timings are not cached.
+struct CachedResult
+{
+    FlopSummary summary_{};
+    // Configurable histogram and its cumulative distribution, empty if it was
+    // disabled
+    std::vector<uint32_t> histogram_counts_;
+    std::vector<float> histogram_cdf_;
+};
+
+// Returns a path next to target that no other writer uses
+std::filesystem::path temporary_path(std::filesystem::path const& target);
+
+// Moves source to target, replacing any entry written concurrently. Writers
+// write entries to a temporary path first, so readers never observe a partial
+// entry.
+void publish(std::filesystem::path const& source,
+             std::filesystem::path const& target);
+
+// Returns true and fills result if the cache holds a result for key
+bool load_result(uint64_t key, CachedResult& result);
+
+// Copies the cached error image of key to path. Returns false if the cache
+// holds no error image for key.
+bool load_error_image(uint64_t key, char const* path);
+
+// Stores the result of a pair, along with a copy of the error image at
+// error_image_path (which may be null) if error images are cached. Entries
+// are written to a temporary file first, so concurrent writers and readers of
+// the same key never observe a partial entry.
+void store_result(uint64_t key,
+                  CachedResult const& result,
+                  char const* error_image_path);
+} // namespace flop
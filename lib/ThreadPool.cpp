@@ -0,0 +1,90 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // The calling thread is the final participant
+    workers_.reserve(thread_count - 1);
+    for (uint32_t i = 1; i != thread_count; ++i)
+    {
+        workers_.emplace_back([this] {
+            uint64_t generation = 0;
+            while (true)
+            {
+                std::unique_lock lock{mutex_};
+                job_cv_.wait(
+                    lock, [&] { return stop_ || generation_ != generation; });
+                if (stop_)
+                {
+                    return;
+                }
+                generation = generation_;
+                lock.unlock();
+
+                run_ranges();
+
+                lock.lock();
+                if (--active_ == 0)
+                {
+                    done_cv_.notify_one();
+                }
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock{mutex_};
+        stop_ = true;
+    }
+    job_cv_.notify_all();
+    for (std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(int count,
+                              int grain,
+                              std::function<void(int, int)> const& fn)
+{
+    std::lock_guard job_lock{job_mutex_};
+
+    {
+        std::lock_guard lock{mutex_};
+        job_    = &fn;
+        count_  = count;
+        grain_  = std::max(grain, 1);
+        next_   = 0;
+        active_ = static_cast<uint32_t>(workers_.size());
+        ++generation_;
+    }
+    job_cv_.notify_all();
+
+    run_ranges();
+
+    std::unique_lock lock{mutex_};
+    done_cv_.wait(lock, [this] { return active_ == 0; });
+    job_ = nullptr;
+}
+
+void ThreadPool::run_ranges()
+{
+    while (true)
+    {
+        int begin = next_.fetch_add(grain_);
+        if (begin >= count_)
+        {
+            return;
+        }
+        (*job_)(begin, std::min(begin + grain_, count_));
+    }
+}
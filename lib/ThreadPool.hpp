@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads used to split CPU evaluation across rows. Only
+// one job runs at a time; concurrent callers are serialized.
+class ThreadPool
+{
+public:
+    // A thread count of 0 uses one thread per hardware thread
+    explicit ThreadPool(uint32_t thread_count = 0);
+    ~ThreadPool();
+
+    // Invokes fn(begin, end) over [0, count) in ranges of at most grain
+    // elements, and blocks until every range has been processed. The calling
+    // thread participates.
+    void parallel_for(int count,
+                      int grain,
+                      std::function<void(int, int)> const& fn);
+
+private:
+    void run_ranges();
+
+    std::vector<std::thread> workers_;
+
+    std::mutex job_mutex_;
+    std::mutex mutex_;
+    std::condition_variable job_cv_;
+    std::condition_variable done_cv_;
+
+    std::function<void(int, int)> const* job_ = nullptr;
+    int count_                                = 0;
+    int grain_                                = 1;
+    std::atomic<int> next_                    = 0;
+    uint32_t active_                          = 0;
+    uint64_t generation_                      = 0;
+    bool stop_                                = false;
+};
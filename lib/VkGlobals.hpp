@@ -1,5 +1,6 @@
 #pragma once
 
+#include <mutex>
 #include <vector>
 #include <volk.h>
 
@@ -12,10 +13,24 @@ inline VkPhysicalDevice g_physical_device                 = VK_NULL_HANDLE;
 inline VkPhysicalDeviceProperties g_physical_device_props = {};
 inline PFN_vkCmdBeginDebugUtilsLabelEXT vkCmdBeginDebugUtilsLabel = nullptr;
 inline PFN_vkCmdEndDebugUtilsLabelEXT vkCmdEndDebugUtilsLabel     = nullptr;
-inline uint32_t g_graphics_queue_index                            = -0u;
-inline uint32_t g_compute_queue_index                             = -0u;
-inline VkQueue g_graphics_queue     = VK_NULL_HANDLE;
-inline VkQueue g_compute_queue      = VK_NULL_HANDLE;
+
+// Queue that pairs are evaluated on. Only guaranteed to support graphics if
+// the device presents (i.e. flop_init received instance extensions), as every
+// stage of the evaluation is a compute dispatch.
+inline uint32_t g_graphics_queue_index = ~0u;
+inline VkQueue g_graphics_queue        = VK_NULL_HANDLE;
+
+// Queue of a compute-capable family other than the graphics queue family,
+// preferably one without graphics support (i.e. an async compute queue). Null
+// if the device has no such family. Sources are uploaded on this queue while
+// the graphics queue evaluates the previous pair of a batch.
+inline uint32_t g_compute_queue_index = ~0u;
+inline VkQueue g_compute_queue        = VK_NULL_HANDLE;
+
+// Graphics and compute queue families, which share the resources accessed by
+// both queues (see share_between_queues)
+inline uint32_t g_shared_queue_families[2] = {};
+
 inline VkDevice g_device            = VK_NULL_HANDLE;
 inline VmaAllocator g_allocator     = VK_NULL_HANDLE;
 inline VkCommandPool g_command_pool = VK_NULL_HANDLE;
@@ -25,6 +40,38 @@ inline VkDescriptorPool g_descriptor_pool            = VK_NULL_HANDLE;
 inline VkDescriptorSetLayout g_descriptor_set_layout = VK_NULL_HANDLE;
 inline VkDescriptorSet g_descriptor_set              = VK_NULL_HANDLE;
 
+// Used to create every pipeline, and persisted across runs (see
+// PipelineCache.hpp). Pipeline caches are internally synchronized, so
+// pipelines may be created concurrently.
+inline VkPipelineCache g_pipeline_cache = VK_NULL_HANDLE;
+
+// Device memory retained by released images for reuse (see Image::reset),
+// resolved by flop_init from the size of the device-local heap
+inline VkDeviceSize g_image_pool_budget = 0;
+
+// Whether the device imports memory through opaque file descriptors (see
+// Image::import_fd), resolved by flop_init
+inline bool g_external_memory_fd_supported = false;
+
+// Queue submission and descriptor set updates require external
+// synchronization. Analysis contexts may be driven from several threads, so
+// all submissions and bindless descriptor writes go through these locks.
+inline std::mutex g_queue_mutex;
+inline std::mutex g_descriptor_mutex;
+
+// Creates the resource described by info with concurrent sharing between the
+// graphics and compute queues, if the device has a compute queue
+template <typename CreateInfo>
+void share_between_queues(CreateInfo& info)
+{
+    if (g_compute_queue != VK_NULL_HANDLE)
+    {
+        info.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+        info.queueFamilyIndexCount = 2;
+        info.pQueueFamilyIndices   = g_shared_queue_families;
+    }
+}
+
 // Helper function to retrieve a count, and then populate a vector with
 // count entries
 template <typename T, typename F, typename... Ts>
@@ -38,4 +85,70 @@ std::vector<T> vk_enumerate(F fn, Ts... args)
 
     return out;
 }
+
+// Submit a single command buffer to the graphics queue and block until it has
+// retired. The fence is reset afterwards so that it may be reused.
+inline void submit_and_wait(VkCommandBuffer cb, VkFence fence)
+{
+    VkSubmitInfo submit{
+        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount   = 0,
+        .commandBufferCount   = 1,
+        .pCommandBuffers      = &cb,
+        .signalSemaphoreCount = 0,
+    };
+    {
+        std::lock_guard lock{g_queue_mutex};
+        vkQueueSubmit(g_graphics_queue, 1, &submit, fence);
+    }
+    vkWaitForFences(g_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(g_device, 1, &fence);
+}
+
+// Submit a single command buffer to the graphics queue (or the supplied
+// queue) without blocking. The timeline semaphore is signaled with the
+// supplied value once the command buffer retires. If wait is not null, the
+// command buffer only starts once the wait semaphore reaches wait_value.
+inline void submit_and_signal(VkCommandBuffer cb,
+                              VkSemaphore timeline,
+                              uint64_t value,
+                              VkSemaphore wait    = VK_NULL_HANDLE,
+                              uint64_t wait_value = 0,
+                              VkQueue queue       = g_graphics_queue)
+{
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timeline_info{
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount   = wait != VK_NULL_HANDLE ? 1u : 0u,
+        .pWaitSemaphoreValues      = &wait_value,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues    = &value,
+    };
+    VkSubmitInfo submit{
+        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext                = &timeline_info,
+        .waitSemaphoreCount   = wait != VK_NULL_HANDLE ? 1u : 0u,
+        .pWaitSemaphores      = &wait,
+        .pWaitDstStageMask    = &wait_stage,
+        .commandBufferCount   = 1,
+        .pCommandBuffers      = &cb,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores    = &timeline,
+    };
+    std::lock_guard lock{g_queue_mutex};
+    vkQueueSubmit(queue, 1, &submit, VK_NULL_HANDLE);
+}
+
+// Block the calling thread until the timeline semaphore reaches value. May be
+// called from any thread.
+inline void wait_timeline(VkSemaphore timeline, uint64_t value)
+{
+    VkSemaphoreWaitInfo wait_info{
+        .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores    = &timeline,
+        .pValues        = &value,
+    };
+    vkWaitSemaphores(g_device, &wait_info, UINT64_MAX);
+}
 } // namespace flop
@@ -1,5 +1,17 @@
 #pragma once
 
+// Formats of the storage images holding intermediates and the error image.
+// Kernels that access them are compiled once per precision, so that the
+// declared format always matches the image and no device support for storage
+// images without a format is required.
+#ifdef HALF_PRECISION
+#define INTERMEDIATE_FORMAT "rgba16f"
+#define ERROR_FORMAT "r16f"
+#else
+#define INTERMEDIATE_FORMAT "rgba32f"
+#define ERROR_FORMAT "r32f"
+#endif
+
 // RGB in this context refers to gamma-expanded sRGB values
 static const float3x3 rgb_to_xyz =
     float3x3(
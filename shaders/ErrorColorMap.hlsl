@@ -1,9 +1,10 @@
+// Maps the error image to the colors of a color map, interpolating between
+// its 256 entries
 struct PushConstants
 {
     uint2 extent;
-    float2 uv_offset;
-    float uv_scale;
     uint input;
+    uint output;
     uint color_map;
 };
 [[vk::push_constant]]
@@ -12,20 +13,24 @@ PushConstants constants;
 [[vk::binding(0)]]
 Texture2D<float4> textures[];
 
+// The color-mapped error is always written to an 8-bit UNORM image
+[[vk::binding(1)]]
+[[vk::image_format("rgba8")]]
+RWTexture2D<float4> rwtextures[];
+
 [[vk::binding(2)]]
 ByteAddressBuffer buffers[];
 
-struct VSOutput
+[numthreads(8, 8, 1)]
+void CSMain(uint3 id : SV_DispatchThreadID)
 {
-    float4 position : SV_Position;
-    float2 uv : TEXCOORD0;
-};
+    if (any(id.xy >= constants.extent))
+    {
+        return;
+    }
 
-float4 PSMain(VSOutput IN)
-    : SV_Target0
-{
     Texture2D<float4> error_image = textures[constants.input];
-    float error      = error_image.Load(int3(IN.uv * constants.extent, 0)).r;
+    float error      = error_image.Load(int3(id.xy, 0)).r;
     float u          = error * 255 + 0.5;
     uint left_index  = clamp(floor(u), 0, 255);
     uint right_index = clamp(ceil(u), left_index, 255);
@@ -33,5 +38,5 @@ float4 PSMain(VSOutput IN)
     float3 left  = buffers[constants.color_map].Load<float3>(left_index * 12);
     float3 right = buffers[constants.color_map].Load<float3>(right_index * 12);
 
-    return float4(lerp(left, right, frac(u)), 1.0);
+    rwtextures[constants.output][id.xy] = float4(lerp(left, right, frac(u)), 1.0);
 }
@@ -0,0 +1,515 @@
+#include "Common.hlsli"
+#include "Statistics.hlsli"
+
+// Separable filters applied to the reference and test images in YyCxCz space.
+// The horizontal pass loads each row segment of both images into LDS once, and
+// applies both the CSF Gaussians and the feature-detection kernels to it. The
+// vertical pass finishes both filters and computes the final FLIP error: the
+// HyAB color error amplified by the feature error. The error is accumulated in
+// a histogram and in the statistics resolved by Statistics.hlsl, and is only
+// written to the error image if requested.
+//
+// When one reference is compared against many test images, the fully filtered
+// reference can be cached: the first evaluation writes it (OUTPUT_REFERENCE),
+// and subsequent ones read it back instead of filtering the reference again
+// (CACHED_REFERENCE), so that both passes only filter the test image.
+
+// Filter kernels are computed on the host for the configured pixels per degree
+// (see FilterKernels.hpp) and read from the kernels buffer. Per tap, it holds
+// the Yy, Cx and both Cz CSF weights, followed by the Gaussian, first
+// derivative (edge) and second derivative (point) feature weights. The left
+// half of the first derivative kernel is applied with flipped signs.
+//
+// Pipelines are specialized for the kernel radii. Taps [0, kernel_radius) of
+// the Cz CSF and feature kernels, and taps [0, inner_radius) of the Yy and Cx
+// CSF kernels are applied.
+[[vk::constant_id(0)]] const int kernel_radius = 9;
+[[vk::constant_id(1)]] const int inner_radius = 4;
+
+// Shared memory holds an apron of MAX_KERNEL_RADIUS pixels on either side
+#define MAX_KERNEL_RADIUS 32
+
+#ifdef DIRECTION_X
+#define DIRECTION 0
+#endif
+
+#ifdef DIRECTION_Y
+#define DIRECTION 1
+#endif
+
+#ifndef DIRECTION
+#error "DIRECTION not specified. Specify DIRECTION=0 for a horizontal blur, and DIRECTION=1 for a vertical blur"
+#endif
+
+#define THREAD_COUNT 64
+#if THREAD_COUNT < 2 * MAX_KERNEL_RADIUS
+#error "THREAD_COUNT is too small for this implementation to work correctly"
+#endif
+
+struct PushConstants
+{
+    uint2 extent;
+    // Horizontal pass: YyCxCz reference and test images
+    // Vertical pass: CSF-filtered reference and test images
+    uint input1;
+    uint input2;
+    // Horizontal pass: CSF-filtered reference and test images
+    // Vertical pass: CSF-filtered reference and test images in xyz space
+    uint output1;
+    uint output2;
+    // Feature moments of the reference and test images, written by the
+    // horizontal pass and read by the vertical pass
+    uint moments1;
+    uint moments2;
+    // The remaining members are only used by the vertical pass
+    uint error;
+    uint histogram;
+    // Scratch buffer accumulating error statistics (see Statistics.hlsli)
+    uint statistics;
+    // Only rows [first_row, first_row + row_count) contribute to the histogram
+    uint first_row;
+    uint row_count;
+    // Combination of the OUTPUT_ flags and CACHED_REFERENCE below. The
+    // horizontal pass only honors CACHED_REFERENCE.
+    uint outputs;
+    // Bucket count and HISTOGRAM_ scale of the configurable histogram in the
+    // statistics buffer, which isn't accumulated if the bucket count is zero
+    uint histogram_buckets;
+    uint histogram_scale;
+    // Fully filtered color (in xyz space) and feature magnitudes of the
+    // reference image, written with OUTPUT_REFERENCE and read with
+    // CACHED_REFERENCE
+    uint reference_color;
+    uint reference_features;
+    // Filter kernel weights, as described above
+    uint kernels;
+};
+[[vk::push_constant]]
+PushConstants constants;
+
+// Write the CSF-filtered colors in xyz space to output1 and output2
+#define OUTPUT_COLORS 1
+// Write the FLIP error to the error image
+#define OUTPUT_ERROR 2
+// Write the fully filtered reference to reference_color and reference_features
+#define OUTPUT_REFERENCE 4
+// Read the fully filtered reference instead of filtering the reference image
+#define CACHED_REFERENCE 8
+
+[[vk::binding(1)]]
+[[vk::image_format(INTERMEDIATE_FORMAT)]]
+RWTexture2D<float4> rwtextures[];
+
+// The error image aliases the same binding with its single-channel format
+[[vk::binding(1)]]
+[[vk::image_format(ERROR_FORMAT)]]
+RWTexture2D<float> rwerrors[];
+
+[[vk::binding(2)]]
+RWByteAddressBuffer rwbuffers[];
+
+// CSF weights (sy, sx, sz1, sz2) and feature weights (Gaussian, first and
+// second derivative) of each tap
+groupshared float4 csf_kernels[MAX_KERNEL_RADIUS];
+groupshared float3 feature_kernels[MAX_KERNEL_RADIUS];
+
+#if DIRECTION == 0
+// The horizontal pass filters the YyCxCz color of both images
+groupshared float3 colors[2][MAX_KERNEL_RADIUS * 2 + THREAD_COUNT];
+#else
+// The vertical pass filters the CSF-filtered colors and all three feature
+// moments of both images
+groupshared float4 colors[2][MAX_KERNEL_RADIUS * 2 + THREAD_COUNT];
+groupshared float3 moments[2][MAX_KERNEL_RADIUS * 2 + THREAD_COUNT];
+
+// Construct an LDS histogram with 32 entries
+#define BUCKET_COUNT 32
+#if THREAD_COUNT < BUCKET_COUNT
+#error "THREAD_COUNT is too small to clear and flush the histogram"
+#endif
+groupshared uint histogram[BUCKET_COUNT];
+#endif
+
+// Normalize luminance to [0, 1]
+float normalize_Yy(float Yy)
+{
+    static const float scale = 1.0 / 116.0;
+    static const float bias = 16.0 / 116.0;
+
+    return Yy * scale + bias;
+}
+
+void load(uint offset, int2 uv)
+{
+    uv = clamp(uv, int2(0, 0), constants.extent - int2(1, 1));
+    bool cached = (constants.outputs & CACHED_REFERENCE) != 0;
+#if DIRECTION == 0
+    if (!cached)
+    {
+        colors[0][offset] = rwtextures[constants.input1][uv].rgb;
+    }
+    colors[1][offset] = rwtextures[constants.input2][uv].rgb;
+#else
+    if (!cached)
+    {
+        colors[0][offset] = rwtextures[constants.input1][uv];
+        moments[0][offset] = rwtextures[constants.moments1][uv].rgb;
+    }
+    colors[1][offset] = rwtextures[constants.input2][uv];
+    moments[1][offset] = rwtextures[constants.moments2][uv].rgb;
+#endif
+}
+
+#if DIRECTION == 0
+float4 csf_filter(uint image, uint lds_offset)
+{
+    float3 center = colors[image][lds_offset];
+    float4 color = center.rgbb * csf_kernels[0].yxzw;
+
+    for (int i = 1; i < inner_radius; ++i)
+    {
+        float2 xy = colors[image][lds_offset - i].xy + colors[image][lds_offset + i].xy;
+        color.xy += csf_kernels[i].xy * xy;
+    }
+
+    for (int j = 1; j < kernel_radius; ++j)
+    {
+        float2 zw = colors[image][lds_offset - j].z + colors[image][lds_offset + j].z;
+        color.zw += csf_kernels[j].zw * zw;
+    }
+
+    return color;
+}
+
+float3 feature_filter(uint image, uint lds_offset)
+{
+    float3 result;
+    result.xz = normalize_Yy(colors[image][lds_offset].r) * float2(feature_kernels[0].x, feature_kernels[2].x);
+    result.y = 0.0;
+
+    for (int i = 1; i < kernel_radius; ++i)
+    {
+        float left = normalize_Yy(colors[image][lds_offset - i].r);
+        float right = normalize_Yy(colors[image][lds_offset + i].r);
+        result.xz += (left + right) * feature_kernels[i].xz;
+        result.y += feature_kernels[i].y * (right - left);
+    }
+
+    return result;
+}
+#else
+float4 csf_filter(uint image, uint lds_offset)
+{
+    float4 color = colors[image][lds_offset] * csf_kernels[0].yxzw;
+
+    for (int i = 1; i < inner_radius; ++i)
+    {
+        float2 xy = colors[image][lds_offset - i].xy + colors[image][lds_offset + i].xy;
+        color.xy += csf_kernels[i].xy * xy;
+    }
+
+    for (int j = 1; j < kernel_radius; ++j)
+    {
+        float2 zw = colors[image][lds_offset - j].z + colors[image][lds_offset + j].z;
+        color.zw += csf_kernels[j].zw * zw;
+    }
+
+    // Now that we've finished the blur passes, convert out of YyCxCz to xyz
+    return float4(linearized_Lab_to_xyz(float3(color.rg, color.z + color.w)), 1.0);
+}
+
+// Find filtered x and y derivatives, with edges in compoment 0, points in component 1
+// Intuitively, we have the Gaussian-blurred luminance in the x direction, so we need to
+// apply the edge and point filters to that quantity. For the y direction, we have the
+// edge and point filtered luminance values, so we convolve those quantities with the
+// Gaussian.
+float2 feature_filter(uint image, uint lds_offset)
+{
+    float2 features_x = feature_kernels[0].x * moments[image][lds_offset].yz;
+    float2 features_y = float2(feature_kernels[1].x, feature_kernels[2].x) * moments[image][lds_offset].x;
+
+    for (int i = 1; i < kernel_radius; ++i)
+    {
+        float3 left = moments[image][lds_offset - i];
+        float3 right = moments[image][lds_offset + i];
+        features_x += feature_kernels[i].x * (left.yz + right.yz);
+        features_y.y += feature_kernels[i].z * (left.x + right.x);
+        features_y.x += feature_kernels[i].y * (right.x - left.x);
+    }
+
+    return sqrt(features_x * features_x + features_y * features_y);
+}
+
+void hunt_adjust(inout float3 Lab)
+{
+    // Luminance is in the 0 to 100 range, so this scale factor is in [0, 1]
+    float scale = 0.01 * Lab.x;
+
+    // Dampen chrominance at lower luminance levels
+    Lab.yz *= scale;
+}
+
+// Distance metrics for very large color differences
+// http://markfairchild.org/PDFs/PAP40.pdf
+//
+// Both inputs are expected to be in CIELAB space
+float HyAB_error(float3 r, float3 t)
+{
+    float L_distance = abs(r.x - t.x);
+    float a_delta = r.y - t.y;
+    float b_delta = r.z - t.z;
+    float ab_distance = sqrt(a_delta * a_delta + b_delta * b_delta);
+    return L_distance + ab_distance;
+}
+
+// Max HyAB error is given by computing HyAB_error(green, blue)^0.7 offline
+static const float max_HyAB_error = 41.2760963;
+
+// When remapping HyAB error to [0, 1], FLIP linearly remaps values below this
+// cutoff to [0, 0.95). Values above this cutoff are linearly remapped to the
+// rest of the range.
+static const float cutoff = 0.4 * max_HyAB_error;
+static const float bias = 0.95;
+static const float cutoff_scale = bias / cutoff;
+
+// The FLIP paper notes that large differences ought to be compressed since the
+// distinction between white-black or green-blue are 3 times apart.
+float remap_HyAB_error(float error)
+{
+    error = pow(error, 0.7);
+
+    if (error < cutoff)
+    {
+        error *= cutoff_scale;
+    }
+    else
+    {
+        error = 0.05 * (error - cutoff) / (max_HyAB_error - cutoff) + bias;
+    }
+    return error;
+}
+
+// Errors are usually similar within a wave (and identical in undistorted
+// regions), so lanes adding to the same histogram bin are combined. Each
+// iteration resolves the bin of the first remaining lane, such that a single
+// atomic is issued per distinct bin in the wave.
+
+// Adds one to LDS histogram bin for each lane where counted is set
+void wave_add(uint bin, bool counted)
+{
+    bool pending = counted;
+    [loop]
+    while (pending)
+    {
+        uint leader = WaveReadLaneFirst(bin);
+        if (bin == leader)
+        {
+            uint count = WaveActiveCountBits(true);
+            if (WaveIsFirstLane())
+            {
+                InterlockedAdd(histogram[leader], count);
+            }
+            pending = false;
+        }
+    }
+}
+
+// Adds one to the word at index word of a buffer for each lane where counted is
+// set
+void wave_add(uint buffer, uint word, bool counted)
+{
+    bool pending = counted;
+    [loop]
+    while (pending)
+    {
+        uint leader = WaveReadLaneFirst(word);
+        if (word == leader)
+        {
+            uint count = WaveActiveCountBits(true);
+            if (WaveIsFirstLane())
+            {
+                rwbuffers[buffer].InterlockedAdd(leader * 4, count);
+            }
+            pending = false;
+        }
+    }
+}
+
+float color_error(float3 reference, float3 test)
+{
+    // In the original flip paper, they apply an adjustment to the colors in
+    // CIELAB space to account for the Hunt effect (chromatic differences are
+    // more perceptually pronounced at higher luminance levels)
+    float3 colors[2] = { xyz_to_CIELAB(reference), xyz_to_CIELAB(test) };
+
+    hunt_adjust(colors[0]);
+    hunt_adjust(colors[1]);
+
+    return remap_HyAB_error(HyAB_error(colors[0], colors[1]));
+}
+#endif
+
+#if DIRECTION == 0
+[numthreads(THREAD_COUNT, 1, 1)]
+#else
+[numthreads(1, THREAD_COUNT, 1)]
+#endif
+void CSMain(uint3 id : SV_DispatchThreadID, int3 gtid : SV_GroupThreadID, int3 gid : SV_GroupID)
+{
+    const uint lds_offset = gtid[DIRECTION] + kernel_radius;
+
+    // Taps beyond the kernel radius are zero. The center taps of the second
+    // derivative kernels are drawn from the Gaussian, as they always have
+    // been, which may read beyond the kernel radius.
+    if (gtid[DIRECTION] < MAX_KERNEL_RADIUS)
+    {
+        uint tap = gtid[DIRECTION];
+        RWByteAddressBuffer kernels = rwbuffers[constants.kernels];
+        csf_kernels[tap] = asfloat(kernels.Load4(tap * 32));
+        feature_kernels[tap] = asfloat(kernels.Load3(tap * 32 + 16));
+    }
+
+#if DIRECTION == 1
+    if (gtid.y < BUCKET_COUNT)
+    {
+        histogram[gtid.y] = 0;
+    }
+#endif
+
+    // First, fetch all texture values needed starting with the central values
+    load(lds_offset, id.xy);
+
+    // Now, fetch the front and back of the window
+    if (gtid[DIRECTION] < kernel_radius * 2)
+    {
+        int2 uv;
+        uint offset;
+        if (gtid[DIRECTION] < kernel_radius)
+        {
+#if DIRECTION == 0
+            uv = int2(gid.x * THREAD_COUNT, id.y);
+#else
+            uv = int2(id.x, gid.y * THREAD_COUNT);
+#endif
+            uv[DIRECTION] = uv[DIRECTION] - gtid[DIRECTION] - 1;
+            offset = kernel_radius - gtid[DIRECTION] - 1;
+        }
+        else
+        {
+#if DIRECTION == 0
+            uv = int2((gid.x + 1) * THREAD_COUNT, id.y);
+#else
+            uv = int2(id.x, (gid.y + 1) * THREAD_COUNT);
+#endif
+            uv[DIRECTION] = uv[DIRECTION] + gtid[DIRECTION] - kernel_radius;
+            offset = THREAD_COUNT + gtid[DIRECTION];
+        }
+
+        load(offset, uv);
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+    // At this point, all input values in our sliding window are in LDS and ready to use
+
+#if DIRECTION == 0
+    if (id.x >= constants.extent.x || id.y >= constants.extent.y)
+    {
+        return;
+    }
+
+    if (!(constants.outputs & CACHED_REFERENCE))
+    {
+        rwtextures[constants.output1][id.xy] = csf_filter(0, lds_offset);
+        rwtextures[constants.moments1][id.xy].rgb = feature_filter(0, lds_offset);
+    }
+    rwtextures[constants.output2][id.xy] = csf_filter(1, lds_offset);
+    rwtextures[constants.moments2][id.xy].rgb = feature_filter(1, lds_offset);
+#else
+    // Threads outside the image must still reach the barrier and wave
+    // operations below
+    float counted_error = 0.0;
+    bool counted = false;
+    if (id.x < constants.extent.x && id.y < constants.extent.y)
+    {
+        float4 reference;
+        float2 reference_features;
+        if (constants.outputs & CACHED_REFERENCE)
+        {
+            reference = rwtextures[constants.reference_color][id.xy];
+            reference_features = rwtextures[constants.reference_features][id.xy].xy;
+        }
+        else
+        {
+            reference = csf_filter(0, lds_offset);
+            reference_features = feature_filter(0, lds_offset);
+        }
+        if (constants.outputs & OUTPUT_REFERENCE)
+        {
+            rwtextures[constants.reference_color][id.xy] = reference;
+            rwtextures[constants.reference_features][id.xy] = float4(reference_features, 0.0, 0.0);
+        }
+
+        float4 test = csf_filter(1, lds_offset);
+        if (constants.outputs & OUTPUT_COLORS)
+        {
+            rwtextures[constants.output1][id.xy] = reference;
+            rwtextures[constants.output2][id.xy] = test;
+        }
+
+        // We can now compare features. Differences in edges and points
+        // detected are used to amplify the color error.
+        float2 feature_delta = abs(feature_filter(1, lds_offset) - reference_features);
+        // TODO: make 0.5 configurable to amplify or dampen error due to feature differences
+        float feature_error = pow(max(feature_delta.x, feature_delta.y) / sqrt(2), 0.5);
+
+        // The moment we've all been waiting for
+        float error = pow(color_error(reference.rgb, test.rgb), 1.0 - feature_error);
+
+        if (constants.outputs & OUTPUT_ERROR)
+        {
+            rwerrors[constants.error][id.xy] = error;
+        }
+
+        if (id.y >= constants.first_row && id.y - constants.first_row < constants.row_count)
+        {
+            counted_error = clamp(error, 0.0, 1.0);
+            counted = true;
+        }
+    }
+
+    wave_add(uint(floor(counted_error * (BUCKET_COUNT - 1))), counted);
+
+    // Accumulate the error sum and max across the wave, so that a single lane
+    // updates the statistics buffer
+    RWByteAddressBuffer statistics = rwbuffers[constants.statistics];
+    uint wave_sum = WaveActiveSum(uint(counted_error * STATISTICS_SUM_SCALE + 0.5));
+    uint wave_max = WaveActiveMax(asuint(counted_error));
+    if (WaveIsFirstLane())
+    {
+        uint sum_low;
+        statistics.InterlockedAdd(STATISTICS_SUM_LOW * 4, wave_sum, sum_low);
+        if (sum_low + wave_sum < sum_low)
+        {
+            // Carry into the high word
+            statistics.InterlockedAdd(STATISTICS_SUM_HIGH * 4, 1);
+        }
+        statistics.InterlockedMax(STATISTICS_MAX * 4, wave_max);
+    }
+
+    uint bin = min(uint(counted_error * STATISTICS_BIN_COUNT), STATISTICS_BIN_COUNT - 1);
+    wave_add(constants.statistics, STATISTICS_BINS + bin, counted);
+
+    if (constants.histogram_buckets != 0)
+    {
+        uint bucket = histogram_bucket(counted_error, constants.histogram_buckets, constants.histogram_scale);
+        wave_add(constants.statistics, STATISTICS_HISTOGRAM + bucket, counted);
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (gtid.y < BUCKET_COUNT && histogram[gtid.y] != 0)
+    {
+        rwbuffers[constants.histogram].InterlockedAdd(gtid.y * 4, histogram[gtid.y]);
+    }
+#endif
+}
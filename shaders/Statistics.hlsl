@@ -0,0 +1,230 @@
+#include "Statistics.hlsli"
+
+// Resolves the error statistics accumulated by the vertical filter pass into
+// the mean, max, weighted median and percentiles of the error, along with the
+// configurable histogram and its cumulative distribution. The thresholds of
+// the gate are checked against the resolved statistics. Dispatched as a single
+// group, which scans the error bins in LDS.
+
+struct PushConstants
+{
+    // Bucket count of the configurable histogram, or zero if disabled
+    uint histogram_buckets;
+    uint padding;
+    // Statistics scratch buffer (see Statistics.hlsli)
+    uint input;
+    // Resolved statistics
+    uint output;
+    // Thresholds of the gate, ignored if negative (see FlopGate)
+    float gate_mean_error;
+    float gate_percentile;
+    float gate_percentile_error;
+    float gate_max_error;
+};
+[[vk::push_constant]]
+PushConstants constants;
+
+[[vk::binding(2)]]
+RWByteAddressBuffer rwbuffers[];
+
+#define THREAD_COUNT 256
+#define BINS_PER_THREAD (STATISTICS_BIN_COUNT / THREAD_COUNT)
+#define MAX_BUCKETS_PER_THREAD (STATISTICS_MAX_HISTOGRAM_BUCKETS / THREAD_COUNT)
+
+// Inclusive prefix sums of the pixel count and error-weighted pixel count of
+// the bins of each thread
+groupshared uint counts[THREAD_COUNT];
+groupshared float weights[THREAD_COUNT];
+
+// Hillis-Steele scan of the per-thread count and weight, which are replaced by
+// their inclusive prefix sums
+void scan(uint gtid, inout uint count, inout float weight)
+{
+    counts[gtid] = count;
+    weights[gtid] = weight;
+    GroupMemoryBarrierWithGroupSync();
+
+    for (uint offset = 1; offset != THREAD_COUNT; offset <<= 1)
+    {
+        if (gtid >= offset)
+        {
+            count += counts[gtid - offset];
+            weight += weights[gtid - offset];
+        }
+        GroupMemoryBarrierWithGroupSync();
+        counts[gtid] = count;
+        weights[gtid] = weight;
+        GroupMemoryBarrierWithGroupSync();
+    }
+}
+
+bool exceeds(float error, float threshold)
+{
+    return threshold >= 0.0 && error > threshold;
+}
+
+float bin_center(uint bin)
+{
+    return (bin + 0.5) / STATISTICS_BIN_COUNT;
+}
+
+// Stores the error at bin + fraction, where fraction is the position of the
+// target within the bin
+void store_error(uint bin, float fraction, uint output)
+{
+    float error = (bin + saturate(fraction)) / STATISTICS_BIN_COUNT;
+    rwbuffers[constants.output].Store(output * 4, asuint(error));
+}
+
+// Writes the error at which the cumulative pixel count reaches target, if it
+// falls within the bins of this thread. before is the count of all pixels in
+// preceding bins. Counts are summed as integers, so the bounds of the bins of
+// neighboring threads agree exactly and every target lands in a single bin.
+void resolve_count(float target, uint before, uint bin_counts[BINS_PER_THREAD], uint first_bin, uint output)
+{
+    [unroll]
+    for (uint i = 0; i != BINS_PER_THREAD; ++i)
+    {
+        uint after = before + bin_counts[i];
+        if (float(before) < target && target <= float(after))
+        {
+            // Assume the errors are uniformly distributed within the bin
+            store_error(first_bin + i, (target - before) / bin_counts[i], output);
+        }
+        before = after;
+    }
+}
+
+// Writes the error at which the cumulative weight reaches target, if it falls
+// within the bins of this thread. before and last are the cumulative weights
+// preceding the bins of this thread and including them, as computed by the
+// scan. The bounds shared with neighboring threads are taken from the scan,
+// and the bounds within are clamped to them, so every target lands in a
+// single thread.
+void resolve_weight(float target, float before, float last, float bin_weights[BINS_PER_THREAD], uint first_bin, uint output)
+{
+    [unroll]
+    for (uint i = 0; i != BINS_PER_THREAD; ++i)
+    {
+        float after = i == BINS_PER_THREAD - 1 ? last : min(before + bin_weights[i], last);
+        if (before < target && target <= after)
+        {
+            store_error(first_bin + i, (target - before) / bin_weights[i], output);
+        }
+        before = after;
+    }
+}
+
+[numthreads(THREAD_COUNT, 1, 1)]
+void CSMain(uint gtid : SV_GroupIndex)
+{
+    RWByteAddressBuffer statistics = rwbuffers[constants.input];
+    RWByteAddressBuffer output = rwbuffers[constants.output];
+
+    uint first_bin = gtid * BINS_PER_THREAD;
+    uint bin_counts[BINS_PER_THREAD];
+    float bin_weights[BINS_PER_THREAD];
+    uint count = 0;
+    float weight = 0.0;
+
+    [unroll]
+    for (uint i = 0; i != BINS_PER_THREAD; ++i)
+    {
+        uint bin_count = statistics.Load((STATISTICS_BINS + first_bin + i) * 4);
+        bin_counts[i] = bin_count;
+        bin_weights[i] = bin_count * bin_center(first_bin + i);
+        count += bin_count;
+        weight += bin_weights[i];
+    }
+
+    scan(gtid, count, weight);
+
+    uint total_count = counts[THREAD_COUNT - 1];
+    float total_weight = weights[THREAD_COUNT - 1];
+    uint count_before = gtid == 0 ? 0 : counts[gtid - 1];
+    float weight_before = gtid == 0 ? 0.0 : weights[gtid - 1];
+    float weight_after = weights[gtid];
+
+    if (gtid == 0)
+    {
+        uint low = statistics.Load(STATISTICS_SUM_LOW * 4);
+        uint high = statistics.Load(STATISTICS_SUM_HIGH * 4);
+        float sum = (high * 4294967296.0 + low) / STATISTICS_SUM_SCALE;
+        float mean = total_count == 0 ? 0.0 : sum / total_count;
+
+        output.Store(STATISTICS_OUT_MEAN * 4, asuint(mean));
+        output.Store(STATISTICS_OUT_MAX * 4, statistics.Load(STATISTICS_MAX * 4));
+
+        // Statistics of an empty image are zero, and are otherwise always
+        // overwritten below
+        output.Store(STATISTICS_OUT_WEIGHTED_MEDIAN * 4, 0);
+        output.Store(STATISTICS_OUT_P50 * 4, 0);
+        output.Store(STATISTICS_OUT_P95 * 4, 0);
+        output.Store(STATISTICS_OUT_P99 * 4, 0);
+        output.Store(STATISTICS_OUT_GATE_PERCENTILE * 4, 0);
+    }
+
+    // Order the zero stores above before the stores of the thread that holds
+    // each statistic. This also keeps the prefix sums read above intact until
+    // every thread has read them.
+    AllMemoryBarrierWithGroupSync();
+
+    resolve_count(0.5 * total_count, count_before, bin_counts, first_bin, STATISTICS_OUT_P50);
+    resolve_count(0.95 * total_count, count_before, bin_counts, first_bin, STATISTICS_OUT_P95);
+    resolve_count(0.99 * total_count, count_before, bin_counts, first_bin, STATISTICS_OUT_P99);
+
+    // The weighted median is the error below which half of the total error
+    // lies, so larger errors contribute more than small ones
+    resolve_weight(0.5 * total_weight, weight_before, weight_after, bin_weights, first_bin, STATISTICS_OUT_WEIGHTED_MEDIAN);
+
+    resolve_count(constants.gate_percentile * total_count, count_before, bin_counts, first_bin, STATISTICS_OUT_GATE_PERCENTILE);
+
+    // Check the gate once every statistic has been stored
+    AllMemoryBarrierWithGroupSync();
+    if (gtid == 0)
+    {
+        float mean = asfloat(output.Load(STATISTICS_OUT_MEAN * 4));
+        float max_error = asfloat(output.Load(STATISTICS_OUT_MAX * 4));
+        float percentile_error = asfloat(output.Load(STATISTICS_OUT_GATE_PERCENTILE * 4));
+        bool failed = exceeds(mean, constants.gate_mean_error)
+            || exceeds(percentile_error, constants.gate_percentile_error)
+            || exceeds(max_error, constants.gate_max_error);
+        output.Store(STATISTICS_OUT_GATE_FAILED * 4, failed ? 1 : 0);
+    }
+
+    // Copy the configurable histogram, and emit its cumulative distribution
+    uint bucket_count = constants.histogram_buckets;
+    if (bucket_count == 0)
+    {
+        return;
+    }
+
+    uint buckets_per_thread = (bucket_count + THREAD_COUNT - 1) / THREAD_COUNT;
+    uint first_bucket = gtid * buckets_per_thread;
+    uint bucket_counts[MAX_BUCKETS_PER_THREAD];
+    count = 0;
+    weight = 0.0;
+    for (uint j = 0; j != buckets_per_thread; ++j)
+    {
+        uint bucket = first_bucket + j;
+        bucket_counts[j] = bucket < bucket_count
+            ? statistics.Load((STATISTICS_HISTOGRAM + bucket) * 4)
+            : 0;
+        count += bucket_counts[j];
+    }
+
+    scan(gtid, count, weight);
+
+    uint cumulative = gtid == 0 ? 0 : counts[gtid - 1];
+    float scale = total_count == 0 ? 0.0 : 1.0 / total_count;
+    for (uint k = 0; k != buckets_per_thread; ++k)
+    {
+        uint bucket = first_bucket + k;
+        if (bucket < bucket_count)
+        {
+            cumulative += bucket_counts[k];
+            output.Store((STATISTICS_OUT_HISTOGRAM + bucket) * 4, bucket_counts[k]);
+            output.Store((STATISTICS_OUT_HISTOGRAM + bucket_count + bucket) * 4, asuint(cumulative * scale));
+        }
+    }
+}
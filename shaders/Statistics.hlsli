@@ -0,0 +1,52 @@
+// Layout of the scratch buffer in which the vertical filter pass accumulates
+// error statistics, in 32-bit words. The sum of all errors is accumulated in
+// 64-bit fixed point, split across two words.
+#define STATISTICS_SUM_LOW 0
+#define STATISTICS_SUM_HIGH 1
+// Bit pattern of the largest error, which orders like an unsigned integer
+// because errors are non-negative
+#define STATISTICS_MAX 2
+// Linear bins counting errors e with floor(STATISTICS_BIN_COUNT * e) == i
+#define STATISTICS_BINS 4
+#define STATISTICS_BIN_COUNT 1024
+// Buckets of the configurable histogram (see histogram_bucket)
+#define STATISTICS_HISTOGRAM (STATISTICS_BINS + STATISTICS_BIN_COUNT)
+#define STATISTICS_MAX_HISTOGRAM_BUCKETS 4096
+
+// Scale of the fixed-point error sum. A wave of up to 128 lanes can sum errors
+// in [0, 1] without overflowing 32 bits.
+#define STATISTICS_SUM_SCALE 16777216.0
+
+// Layout of the statistics resolved by Statistics.hlsl, in 32-bit floats
+#define STATISTICS_OUT_MEAN 0
+#define STATISTICS_OUT_MAX 1
+#define STATISTICS_OUT_WEIGHTED_MEDIAN 2
+#define STATISTICS_OUT_P50 3
+#define STATISTICS_OUT_P95 4
+#define STATISTICS_OUT_P99 5
+// Error at the percentile of the gate, and whether the gate failed (as an
+// unsigned integer)
+#define STATISTICS_OUT_GATE_PERCENTILE 6
+#define STATISTICS_OUT_GATE_FAILED 7
+// Followed by the bucket counts of the configurable histogram, and then its
+// cumulative distribution as a fraction of the pixel count
+#define STATISTICS_OUT_HISTOGRAM 8
+
+// Scales of the configurable histogram (see FlopHistogramScale)
+#define HISTOGRAM_LINEAR 0
+#define HISTOGRAM_LOG 1
+// Log-spaced buckets cover errors in [2^-HISTOGRAM_LOG_OCTAVES, 1]
+#define HISTOGRAM_LOG_OCTAVES 16.0
+
+// Bucket of an error in [0, 1]. Linear buckets are evenly spaced, and each
+// log-spaced bucket spans the same number of octaves. Errors below the range
+// of log-spaced buckets (including zero) land in bucket 0.
+uint histogram_bucket(float error, uint bucket_count, uint scale)
+{
+    float position = error;
+    if (scale == HISTOGRAM_LOG)
+    {
+        position = max(log2(max(error, 1e-30)) / HISTOGRAM_LOG_OCTAVES + 1.0, 0.0);
+    }
+    return min(uint(position * bucket_count), bucket_count - 1);
+}
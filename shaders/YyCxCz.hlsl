@@ -5,13 +5,14 @@
 // https://engineering.purdue.edu/~bouman/publications/pdf/ei93.pdf
 // http://users.ece.utexas.edu/~bevans/papers/2003/colorHalftoning/colorHVSspl00282.pdf
 
-// Assumes the input and output image dimensions are the same
+// Assumes the input and output image dimensions are the same. Runs as a
+// compute kernel so that evaluation only needs a compute queue, and writes the
+// output as a storage image in the layout read by the filters.
 struct PushConstants
 {
     uint2 extent;
-    float2 uv_offset;
-    float uv_scale;
     uint input;
+    uint output;
     uint tonemap;
     float exposure;
     // If 1, multiply Yy component by alpha to account for alpha differences
@@ -24,16 +25,20 @@ PushConstants constants;
 [[vk::binding(0)]]
 Texture2D<float4> textures[];
 
-struct VSOutput
-{
-    float4 position : SV_Position;
-    float2 uv : TEXCOORD0;
-};
+[[vk::binding(1)]]
+[[vk::image_format(INTERMEDIATE_FORMAT)]]
+RWTexture2D<float4> rwtextures[];
 
-float4 PSMain(VSOutput IN) : SV_Target0
+[numthreads(8, 8, 1)]
+void CSMain(uint3 id : SV_DispatchThreadID)
 {
+    if (any(id.xy >= constants.extent))
+    {
+        return;
+    }
+
     Texture2D<float4> input_texture = textures[constants.input];
-    float4 color = input_texture.Load(int3(IN.uv * constants.extent, 0));
+    float4 color = input_texture.Load(int3(id.xy, 0));
 
     if (constants.tonemap == 1)
     {
@@ -55,5 +60,5 @@ float4 PSMain(VSOutput IN) : SV_Target0
         YyCxCz.x *= color.a;
     }
 
-    return float4(YyCxCz, 1.f);
+    rwtextures[constants.output][id.xy] = float4(YyCxCz, 1.f);
 }
@@ -43,12 +43,12 @@ PFN_vkVoidFunction load_vulkan_function(char const* function, void*)
 
 double ref_width()
 {
-    return g_reference.source_.width_;
+    return g_context.reference_.source_.width_;
 }
 
 double ref_height()
 {
-    return g_reference.source_.height_;
+    return g_context.reference_.source_.height_;
 }
 
 void on_scroll(GLFWwindow* window, double x_offset, double y_offset)
@@ -424,6 +424,9 @@ int main(int argc, char const* argv[])
     init_render_pass();
     Preview::init(s_render_pass);
 
+    // The viewer previews the filtered and error images after evaluation
+    g_context.retain_images_ = true;
+
     IMGUI_CHECKVERSION();
 
     ImGui::CreateContext();
@@ -11,17 +11,6 @@ using namespace flop;
 static nfdfilteritem_t s_filter_list[] = {{"Images", "png,jpg,jpeg,bmp,exr"}};
 static nfdfilteritem_t s_output_list[]    = {{"PNG", "png"}};
 
-
-extern void flop_init_reference(char const* reference_path);
-extern void flop_init_test(char const* test_path);
-extern int flop_analyze_impl(char const* reference_path,
-                             char const* test_path,
-                             char const* output_path,
-                             float exposure,
-                             int tonemapper,
-                             FlopSummary* out_summary,
-                             bool bypass_initialization);
-
 void UI::set_reference(std::string const& reference)
 {
     if (!reference.empty())
@@ -92,7 +81,9 @@ bool UI::analyze(bool issued_from_gui)
 
     if (issued_from_gui)
     {
-        if (flop_analyze_impl(reference_path_,
+        // Previews of the previous analysis may still be in flight
+        vkDeviceWaitIdle(g_device);
+        if (g_context.analyze(reference_path_,
                               test_path_,
                               output_path_,
                               exposure_,
@@ -100,7 +91,7 @@ bool UI::analyze(bool issued_from_gui)
                               &summary_,
                               true))
         {
-            error_  = flop_get_error();
+            error_  = g_context.error_message_;
             active_ = false;
             return false;
         }
@@ -121,7 +112,7 @@ bool UI::analyze(bool issued_from_gui)
     }
 
     error_ = nullptr;
-    error_preview_.set_image(g_error);
+    error_preview_.set_image(g_context.error_);
     error_preview_.set_quadrant(Preview::Quadrant::TopLeft);
     error_preview_.set_color_map(color_map_);
     viewport_dirty_ = true;
@@ -129,7 +120,8 @@ bool UI::analyze(bool issued_from_gui)
     error_max_      = 0.f;
     for (size_t i = 0; i != 32; ++i)
     {
-        error_histogram_[i] = static_cast<uint32_t*>(g_error_histogram.data_)[i];
+        error_histogram_[i]
+            = static_cast<uint32_t*>(g_context.error_histogram_.data_)[i];
 
         if (error_histogram_[i] > error_max_)
         {
@@ -197,19 +189,23 @@ void UI::update()
             NFD_OpenDialog(&reference_path_, s_filter_list, 1, nullptr);
             if (reference_path_)
             {
-                flop_init_reference(reference_path_);
+                vkDeviceWaitIdle(g_device);
+                g_context.reference_.source_.reset();
+                g_context.load_reference(reference_path_);
                 toggled_ = false;
-                left_preview_.set_image(g_reference.source_);
+                left_preview_.set_image(g_context.reference_.source_);
                 left_preview_.set_quadrant(Preview::Quadrant::BottomLeft);
                 reset_viewports();
                 viewport_dirty_ = true;
                 active_         = false;
 
-                if (g_reference.source_.width_ != g_test.source_.width_
-                    || g_reference.source_.height_ != g_test.source_.height_)
+                Image const& reference = g_context.reference_.source_;
+                Image const& test      = g_context.test_.source_;
+                if (reference.width_ != test.width_
+                    || reference.height_ != test.height_)
                 {
-                    g_test.source_.reset();
-                    g_error.reset();
+                    g_context.test_.source_.reset();
+                    g_context.error_.reset();
                 }
             }
         }
@@ -221,19 +217,23 @@ void UI::update()
             NFD_OpenDialog(&test_path_, s_filter_list, 1, nullptr);
             if (test_path_)
             {
-                flop_init_test(test_path_);
+                vkDeviceWaitIdle(g_device);
+                g_context.test_.source_.reset();
+                g_context.load_test(test_path_);
                 toggled_ = false;
-                right_preview_.set_image(g_test.source_);
+                right_preview_.set_image(g_context.test_.source_);
                 right_preview_.set_quadrant(Preview::Quadrant::BottomRight);
                 reset_viewports();
                 viewport_dirty_ = true;
                 active_         = false;
 
-                if (g_reference.source_.width_ != g_test.source_.width_
-                    || g_reference.source_.height_ != g_test.source_.height_)
+                Image const& reference = g_context.reference_.source_;
+                Image const& test      = g_context.test_.source_;
+                if (reference.width_ != test.width_
+                    || reference.height_ != test.height_)
                 {
-                    g_reference.source_.reset();
-                    g_error.reset();
+                    g_context.reference_.source_.reset();
+                    g_context.error_.reset();
                 }
             }
         }
@@ -251,7 +251,7 @@ void UI::update()
         ImGui::Spacing();
         ImGui::Separator();
 
-        bool hdr = g_reference.source_.hdr_;
+        bool hdr = g_context.reference_.source_.hdr_;
         ImGui::BeginDisabled(!hdr);
 
         if (ImGui::SliderFloat("Exposure", &exposure_, -15.f, 3.f))
@@ -296,7 +296,7 @@ void UI::update()
             }
             else
             {
-                left_preview_.set_image(g_reference.source_);
+                left_preview_.set_image(g_context.reference_.source_);
             }
         }
         ImGui::SameLine();
@@ -308,7 +308,7 @@ void UI::update()
         {
             if (animated_)
             {
-                if (left_preview_.image() == &g_reference.source_)
+                if (left_preview_.image() == &g_context.reference_.source_)
                 {
                     ImGui::Text("Viewing reference image.");
                 }
@@ -415,8 +415,8 @@ void UI::render(GLFWwindow* window, VkCommandBuffer cb)
         {
             right_preview_.render(window, cb);
         }
-        ImagePacket& left  = toggled_ ? g_test : g_reference;
-        ImagePacket& right = toggled_ ? g_reference : g_test;
+        ImagePacket& left  = toggled_ ? g_context.test_ : g_context.reference_;
+        ImagePacket& right = toggled_ ? g_context.reference_ : g_context.test_;
 
         switch (view_mode_)
         {
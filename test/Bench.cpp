@@ -0,0 +1,99 @@
+#include <flop/Flop.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Usage: flop_bench [manifest] or flop_bench [pair count]
+// Without a manifest, the bundled 800x600 test pair is compared repeatedly.
+int main(int argc, char const* argv[])
+{
+    std::filesystem::path base{__FILE__};
+    base = base.parent_path();
+
+    // Cold start: device creation, pipeline creation and the initial uploads,
+    // which dominate short-lived invocations on small images. Pipeline
+    // creation is much faster once a previous run has filled the pipeline
+    // cache, so the first run on a device reports the time without it.
+    if (flop_init(0, nullptr))
+    {
+        std::printf("%s\n", flop_get_error());
+        return 1;
+    }
+    FlopInitSummary init_summary;
+    flop_get_init_summary(&init_summary);
+    std::printf("Cold start in %i ms (pipelines created in %.1f ms %s)\n",
+                init_summary.milliseconds_elapsed,
+                init_summary.pipeline_milliseconds,
+                init_summary.pipeline_cache_loaded ? "with the pipeline cache"
+                                                   : "without the cache");
+
+    FlopBatchSummary batch_summary{};
+    std::vector<FlopSummary> summaries;
+
+    if (argc > 1 && std::filesystem::exists(argv[1]))
+    {
+        if (flop_analyze_manifest(
+                nullptr, argv[1], 1.f, 0, nullptr, 0, &batch_summary))
+        {
+            std::printf("%s\n", flop_get_error());
+        }
+    }
+    else
+    {
+        int pair_count = argc > 1 ? std::atoi(argv[1]) : 256;
+
+        std::string reference_path = (base / "reference2.png").string();
+        std::string test_path      = (base / "test2.png").string();
+
+        std::vector<FlopPair> pairs(pair_count);
+        summaries.resize(pair_count);
+        for (FlopPair& pair : pairs)
+        {
+            pair.reference_path = reference_path.c_str();
+            pair.test_path      = test_path.c_str();
+            pair.output_path    = nullptr;
+        }
+
+        if (flop_analyze_batch(nullptr,
+                               pairs.data(),
+                               pair_count,
+                               1.f,
+                               0,
+                               summaries.data(),
+                               &batch_summary))
+        {
+            std::printf("%s\n", flop_get_error());
+        }
+    }
+
+    std::printf("%i pairs (%i failed) in %i ms: %f pairs/s\n",
+                batch_summary.pair_count,
+                batch_summary.failure_count,
+                batch_summary.milliseconds_elapsed,
+                batch_summary.pairs_per_second);
+
+    // Mean GPU time per stage, which is zero if the device doesn't support
+    // timestamps (or with the CPU backend)
+    if (!summaries.empty())
+    {
+        std::printf("Mean GPU time per pair:");
+        for (int i = 0; i != FLOP_STAGE_COUNT; ++i)
+        {
+            float total = 0.f;
+            for (FlopSummary const& summary : summaries)
+            {
+                total += summary.stage_milliseconds[i];
+            }
+            std::printf("%s %s %.3fms",
+                        i == 0 ? "" : ",",
+                        flop_stage_name(static_cast<FlopStage>(i)),
+                        total / summaries.size());
+        }
+        std::printf("\n");
+    }
+
+    return batch_summary.failure_count == 0 ? 0 : 1;
+}
@@ -1,30 +1,540 @@
 #include <flop/Flop.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <string>
+#include <thread>
+
+// Forward declare STBI calls to avoid including a massive header
+extern "C"
+{
+    unsigned char* stbi_load(char const* filename,
+                             int* x,
+                             int* y,
+                             int* channels_in_file,
+                             int desired_channels);
+    void stbi_image_free(void* retval_from_stbi_load);
+}
 
 int main(int argc, char const* argv[])
 {
     std::filesystem::path base{__FILE__};
     base = base.parent_path();
 
-    std::string reference_path = (base / "reference.png").string();
-    std::string test_path      = (base / "test.png").string();
+    // Only the 800x600 fixtures ship with the repository
+    std::string reference_path = (base / "reference2.png").string();
+    std::string test_path      = (base / "test2.png").string();
     std::string output_path    = (base / "flop_ldr.png").string();
 
+    FlopSummary full_summary{};
+    if (flop_analyze(reference_path.c_str(),
+                     test_path.c_str(),
+                     output_path.c_str(),
+                     &full_summary))
+    {
+        std::printf("Failed to compare images: %s\n", flop_get_error());
+        return 1;
+    }
+
+    // Repeat the LDR comparison with half-precision intermediates
+    std::string full_output_path = output_path;
+    std::string half_output_path = (base / "flop_ldr_half.png").string();
+    FlopSummary half_summary{};
+    flop_config_set_precision(FLOP_PRECISION_HALF);
+    int half_result = flop_analyze(reference_path.c_str(),
+                                   test_path.c_str(),
+                                   half_output_path.c_str(),
+                                   &half_summary);
+    flop_config_set_precision(FLOP_PRECISION_FULL);
+    if (half_result != 0)
+    {
+        std::printf("Failed to compare images in half precision: %s\n",
+                    flop_get_error());
+        return 1;
+    }
+
+    // HDR fixtures are not committed, so the HDR comparison only runs if they
+    // were supplied locally
+    std::string hdr_reference_path = (base / "reference.exr").string();
+    std::string hdr_test_path      = (base / "test.exr").string();
+    std::string hdr_output_path    = (base / "flop_hdr.png").string();
+    if (std::filesystem::exists(hdr_reference_path)
+        && std::filesystem::exists(hdr_test_path)
+        && flop_analyze_hdr(hdr_reference_path.c_str(),
+                            hdr_test_path.c_str(),
+                            hdr_output_path.c_str(),
+                            -2.f,
+                            0,
+                            nullptr))
+    {
+        std::printf("Failed to compare HDR images: %s\n", flop_get_error());
+        return 1;
+    }
+
+    // Independent contexts may evaluate pairs concurrently
+    std::string reference2_path = (base / "reference2.png").string();
+    std::string test2_path      = (base / "test2.png").string();
+    std::string reference3_path = (base / "reference3.png").string();
+
+    FlopContext* contexts[2] = {flop_context_create(), flop_context_create()};
+    if (!contexts[0] || !contexts[1])
+    {
+        std::printf("Failed to create contexts: %s\n", flop_get_error());
+        return 1;
+    }
+    FlopSummary summaries[2];
+    int results[2];
+    std::thread worker{[&] {
+        results[0] = flop_context_analyze(contexts[0],
+                                          reference2_path.c_str(),
+                                          test2_path.c_str(),
+                                          nullptr,
+                                          &summaries[0]);
+    }};
+    results[1] = flop_context_analyze(contexts[1],
+                                      reference3_path.c_str(),
+                                      test2_path.c_str(),
+                                      nullptr,
+                                      &summaries[1]);
+    worker.join();
+    flop_context_destroy(contexts[0]);
+    flop_context_destroy(contexts[1]);
+
+    // Each concurrent evaluation must match a sequential one of the same pair
+    std::string const* concurrent_references[2]
+        = {&reference2_path, &reference3_path};
+    for (int i = 0; i != 2; ++i)
+    {
+        FlopSummary sequential_summary;
+        int sequential_result = flop_analyze(concurrent_references[i]->c_str(),
+                                             test2_path.c_str(),
+                                             nullptr,
+                                             &sequential_summary);
+        if (results[i] != 0 || sequential_result != 0
+            || !std::equal(std::begin(sequential_summary.histogram),
+                           std::end(sequential_summary.histogram),
+                           std::begin(summaries[i].histogram)))
+        {
+            std::printf("Concurrent evaluation %i differs from a sequential "
+                        "one\n",
+                        i);
+            return 1;
+        }
+    }
+
+    // Measure the difference between the half and full-precision results. Each
+    // pixel that lands in a different bucket contributes 2 to moved.
+    uint32_t moved = 0;
+    for (int i = 0; i != 32; ++i)
+    {
+        moved += std::abs(static_cast<int>(half_summary.histogram[i])
+                          - static_cast<int>(full_summary.histogram[i]));
+    }
+    float pixel_count
+        = static_cast<float>(full_summary.width) * full_summary.height;
+    float moved_fraction = moved / (2.f * pixel_count);
+
+    int width;
+    int height;
+    int channels;
+    unsigned char* full
+        = stbi_load(full_output_path.c_str(), &width, &height, &channels, 4);
+    unsigned char* half
+        = stbi_load(half_output_path.c_str(), &width, &height, &channels, 4);
+    if (!full || !half)
+    {
+        std::printf("Failed to load error maps for precision comparison\n");
+        return 1;
+    }
+
+    double total_difference = 0.0;
+    int max_difference      = 0;
+    for (int i = 0; i != width * height * 4; ++i)
+    {
+        int difference = std::abs(static_cast<int>(full[i]) - half[i]);
+        total_difference += difference;
+        max_difference = std::max(max_difference, difference);
+    }
+    stbi_image_free(full);
+    stbi_image_free(half);
+
+    std::printf("Half precision: %.3f%% of pixels changed histogram bucket, "
+                "error map differs by %.4f on average (max %i of 255)\n",
+                moved_fraction * 100.f,
+                total_difference / (width * height * 4.0),
+                max_difference);
+
+    // Runs with the Vulkan backend store their histogram at the path passed as
+    // the first argument, and runs with the CPU backend must match the stored
+    // histogram up to a small fraction of pixels in a neighboring bucket
+    if (argc > 1 && flop_get_backend() == FLOP_BACKEND_VULKAN)
+    {
+        FILE* file = std::fopen(argv[1], "w");
+        if (!file)
+        {
+            std::printf("Failed to store the histogram at %s\n", argv[1]);
+            return 1;
+        }
+        for (uint32_t count : full_summary.histogram)
+        {
+            std::fprintf(file, "%u\n", count);
+        }
+        std::fclose(file);
+    }
+    else if (argc > 1)
+    {
+        FILE* file = std::fopen(argv[1], "r");
+        if (file)
+        {
+            uint32_t backend_moved = 0;
+            for (int i = 0; i != 32; ++i)
+            {
+                unsigned int count = 0;
+                if (std::fscanf(file, "%u", &count) != 1)
+                {
+                    backend_moved = ~0u;
+                    break;
+                }
+                backend_moved += std::abs(
+                    static_cast<int>(count)
+                    - static_cast<int>(full_summary.histogram[i]));
+            }
+            std::fclose(file);
+            float backend_moved_fraction = backend_moved / (2.f * pixel_count);
+            std::printf("CPU backend: %.3f%% of pixels changed histogram "
+                        "bucket\n",
+                        backend_moved_fraction * 100.f);
+            if (backend_moved_fraction > 0.01f)
+            {
+                std::printf("CPU and Vulkan histograms differ\n");
+                return 1;
+            }
+        }
+        else
+        {
+            std::printf("No Vulkan histogram at %s to compare against\n",
+                        argv[1]);
+        }
+    }
+
+    // The GPU-resolved statistics must be ordered, and the median must land in
+    // (or next to) the histogram bucket holding the middle pixel
+    uint32_t cumulative = 0;
+    int median_bucket   = 0;
+    while (cumulative + full_summary.histogram[median_bucket] < pixel_count / 2)
+    {
+        cumulative += full_summary.histogram[median_bucket++];
+    }
+    bool statistics_valid
+        = full_summary.p50_error <= full_summary.p95_error
+          && full_summary.p95_error <= full_summary.p99_error
+          && full_summary.p99_error <= full_summary.max_error
+          && full_summary.mean_error <= full_summary.max_error
+          && std::abs(static_cast<int>(full_summary.p50_error * 31.f)
+                      - median_bucket)
+                 <= 1;
+    if (!statistics_valid)
+    {
+        std::printf("Inconsistent error statistics\n");
+        return 1;
+    }
+
+    // Pixels in memory must produce the same result as the files they were
+    // decoded from
+    unsigned char* reference_pixels
+        = stbi_load(reference_path.c_str(), &width, &height, &channels, 4);
+    unsigned char* test_pixels
+        = stbi_load(test_path.c_str(), &width, &height, &channels, 4);
+    if (!reference_pixels || !test_pixels)
+    {
+        std::printf("Failed to load images for the in-memory comparison\n");
+        return 1;
+    }
+    FlopPixels pixels[2]
+        = {{reference_pixels, width, height, 0, FLOP_PIXEL_FORMAT_RGBA8},
+           {test_pixels, width, height, 0, FLOP_PIXEL_FORMAT_RGBA8}};
+    FlopSummary pixels_summary;
+    int pixels_result = flop_analyze_pixels(nullptr,
+                                            &pixels[0],
+                                            &pixels[1],
+                                            0.f,
+                                            0,
+                                            nullptr,
+                                            0,
+                                            &pixels_summary);
+    stbi_image_free(reference_pixels);
+    stbi_image_free(test_pixels);
+    if (pixels_result != 0
+        || !std::equal(std::begin(full_summary.histogram),
+                       std::end(full_summary.histogram),
+                       std::begin(pixels_summary.histogram)))
+    {
+        std::printf("In-memory and file comparisons differ\n");
+        return 1;
+    }
+
+    // A pair only produces an error image if it fails the gate
+    std::string gate_output_paths[2]
+        = {(base / "flop_gate_pass.png").string(),
+           (base / "flop_gate_fail.png").string()};
+    FlopGate gates[2]
+        = {{-1.f, 0.99f, full_summary.p99_error + 0.01f, -1.f},
+           {full_summary.mean_error * 0.5f, 0.f, -1.f, -1.f}};
+    FlopSummary gate_summaries[2];
+    for (int i = 0; i != 2; ++i)
+    {
+        std::filesystem::remove(gate_output_paths[i]);
+        flop_config_set_gate(&gates[i]);
+        flop_analyze(reference_path.c_str(),
+                     test_path.c_str(),
+                     gate_output_paths[i].c_str(),
+                     &gate_summaries[i]);
+    }
+    flop_config_set_gate(nullptr);
+    if (gate_summaries[0].gate_failed
+        || std::filesystem::exists(gate_output_paths[0])
+        || !gate_summaries[1].gate_failed
+        || !std::filesystem::exists(gate_output_paths[1]))
+    {
+        std::printf("Gate outcome does not match the error statistics\n");
+        return 1;
+    }
+
+    // By now, the reference is cached, which must not change the result
+    FlopSummary cached_summary;
     flop_analyze(
-        reference_path.c_str(), test_path.c_str(), output_path.c_str(), nullptr);
+        reference_path.c_str(), test_path.c_str(), nullptr, &cached_summary);
+    if (!std::equal(std::begin(full_summary.histogram),
+                    std::end(full_summary.histogram),
+                    std::begin(cached_summary.histogram))
+        || cached_summary.max_error != full_summary.max_error)
+    {
+        std::printf("Cached and uncached references differ\n");
+        return 1;
+    }
 
-    reference_path = (base / "reference.exr").string();
-    test_path      = (base / "test.exr").string();
-    output_path    = (base / "flop_hdr.png").string();
+    // Identical files are resolved without evaluation, and results served from
+    // the result cache match the evaluated result
+    FlopSummary identical_summary;
+    flop_analyze(reference_path.c_str(),
+                 reference_path.c_str(),
+                 nullptr,
+                 &identical_summary);
+    if (identical_summary.max_error != 0.f
+        || identical_summary.histogram[0] != pixel_count)
+    {
+        std::printf("Identical images report an error\n");
+        return 1;
+    }
 
-    flop_analyze_hdr(reference_path.c_str(),
+    std::filesystem::path result_cache = base / "result_cache";
+    std::filesystem::remove_all(result_cache);
+    flop_config_set_result_cache(result_cache.string().c_str(), 1);
+    FlopSummary result_summaries[2];
+    for (FlopSummary& result_summary : result_summaries)
+    {
+        flop_analyze(reference_path.c_str(),
                      test_path.c_str(),
-                     output_path.c_str(),
-                     -2.f,
-                     0,
-                     nullptr);
+                     nullptr,
+                     &result_summary);
+    }
+    flop_config_set_result_cache(nullptr, 0);
+    std::filesystem::remove_all(result_cache);
+    if (!std::equal(std::begin(full_summary.histogram),
+                    std::end(full_summary.histogram),
+                    std::begin(result_summaries[1].histogram))
+        || result_summaries[1].mean_error != result_summaries[0].mean_error
+        || result_summaries[1].evaluate_milliseconds != 0.f)
+    {
+        std::printf("Cached result does not match the evaluated result\n");
+        return 1;
+    }
+
+    // Evaluating the image in bands with a filter apron matches evaluating it
+    // at once
+    FlopSummary banded_summary;
+    flop_config_set_band_rows(64);
+    int banded_result = flop_analyze(
+        reference_path.c_str(), test_path.c_str(), nullptr, &banded_summary);
+    flop_config_set_band_rows(0);
+    if (banded_result != 0
+        || !std::equal(std::begin(full_summary.histogram),
+                       std::end(full_summary.histogram),
+                       std::begin(banded_summary.histogram))
+        || banded_summary.max_error != full_summary.max_error)
+    {
+        std::printf("Banded and whole-image evaluations differ\n");
+        return 1;
+    }
+
+    // The configurable histogram counts every pixel once, with a cumulative
+    // distribution ending at 1. With 31 linear buckets, it matches the fixed
+    // histogram, except that errors of 1 share the last bucket.
+    uint32_t counts[256];
+    float cdf[256];
+    float lower_edges[256];
+    flop_config_set_histogram(31, FLOP_HISTOGRAM_LINEAR);
+    if (flop_analyze(
+            reference_path.c_str(), test_path.c_str(), nullptr, nullptr))
+    {
+        std::printf("Failed to compare images: %s\n", flop_get_error());
+        return 1;
+    }
+    int bucket_count = flop_context_get_histogram(
+        nullptr, counts, cdf, lower_edges, 256);
+    bool histogram_valid = bucket_count == 31;
+    uint32_t counted     = 0;
+    for (int i = 0; histogram_valid && i != bucket_count; ++i)
+    {
+        uint32_t expected = full_summary.histogram[i];
+        if (i == 30)
+        {
+            expected += full_summary.histogram[31];
+        }
+        counted += counts[i];
+        histogram_valid = counts[i] == expected
+                          && (i == 0 || cdf[i] >= cdf[i - 1])
+                          && lower_edges[i] == i / 31.f;
+    }
+    histogram_valid = histogram_valid && counted == pixel_count
+                      && std::abs(cdf[30] - 1.f) < 1e-5f;
+
+    // At most capacity buckets are written, and none for a negative capacity
+    counts[4] = counts[5] = ~0u;
+    cdf[0]                = -1.f;
+    histogram_valid
+        = histogram_valid
+          && flop_context_get_histogram(nullptr, counts, nullptr, nullptr, 4)
+                 == 31
+          && flop_context_get_histogram(nullptr, counts + 5, cdf, nullptr, -1)
+                 == 31
+          && counts[4] == ~0u && counts[5] == ~0u && cdf[0] == -1.f
+          && counts[0] == full_summary.histogram[0];
+
+    // Log-spaced buckets resolve the errors below 1/31 that the first bucket
+    // of the fixed histogram lumps together
+    flop_config_set_histogram(256, FLOP_HISTOGRAM_LOG);
+    if (flop_analyze(
+            reference_path.c_str(), test_path.c_str(), nullptr, nullptr))
+    {
+        std::printf("Failed to compare images: %s\n", flop_get_error());
+        return 1;
+    }
+    bucket_count = flop_context_get_histogram(
+        nullptr, counts, cdf, lower_edges, 256);
+    flop_config_set_histogram(0, FLOP_HISTOGRAM_LINEAR);
+    histogram_valid = histogram_valid && bucket_count == 256
+                      && lower_edges[0] == 0.f
+                      && std::abs(lower_edges[128] - 1.f / 256.f) < 1e-9f;
+    counted               = 0;
+    uint32_t below_first  = 0;
+    uint32_t within_first = 0;
+    for (int i = 0; histogram_valid && i != bucket_count; ++i)
+    {
+        counted += counts[i];
+        float upper_edge = i + 1 == bucket_count ? 1.f : lower_edges[i + 1];
+        if (upper_edge <= 1.f / 31.f)
+        {
+            below_first += counts[i];
+        }
+        if (lower_edges[i] < 1.f / 31.f)
+        {
+            within_first += counts[i];
+        }
+        histogram_valid = (i == 0 || cdf[i] >= cdf[i - 1])
+                          && (i == 0 || lower_edges[i] > lower_edges[i - 1]);
+    }
+    if (!histogram_valid || counted != pixel_count
+        || std::abs(cdf[255] - 1.f) >= 1e-5f
+        || below_first > full_summary.histogram[0]
+        || within_first < full_summary.histogram[0])
+    {
+        std::printf("Configurable histogram is inconsistent\n");
+        return 1;
+    }
+
+    // A batch reports and skips a missing file, and evaluates the other pairs
+    // as if they had been analyzed one at a time
+    std::string missing_path = (base / "missing.png").string();
+    FlopPair batch_pairs[3]
+        = {{reference_path.c_str(), test_path.c_str(), nullptr},
+           {reference_path.c_str(), missing_path.c_str(), nullptr},
+           {reference_path.c_str(), test_path.c_str(), nullptr}};
+    FlopSummary batch_summaries[3];
+    FlopBatchSummary batch_summary;
+    int batch_result = flop_analyze_batch(
+        nullptr, batch_pairs, 3, 0.f, 0, batch_summaries, &batch_summary);
+    FlopSummary zeroed{};
+    bool batch_valid = batch_result == 1 && batch_summary.pair_count == 3
+                       && batch_summary.failure_count == 1
+                       && std::memcmp(&batch_summaries[1],
+                                      &zeroed,
+                                      sizeof(FlopSummary))
+                              == 0;
+    for (int i = 0; i != 3; i += 2)
+    {
+        batch_valid = batch_valid
+                      && std::equal(std::begin(full_summary.histogram),
+                                    std::end(full_summary.histogram),
+                                    std::begin(batch_summaries[i].histogram));
+    }
+    if (!batch_valid)
+    {
+        std::printf("Batch does not isolate the failing pair\n");
+        return 1;
+    }
+
+    // Kernels computed for another viewing condition change the result, and
+    // the default kernels are restored afterwards
+    FlopSummary ppd_summaries[2];
+    flop_config_set_pixels_per_degree(
+        2.f * flop_pixels_per_degree(0.7f, 0.7f, 3840));
+    flop_analyze(
+        reference_path.c_str(), test_path.c_str(), nullptr, &ppd_summaries[0]);
+    flop_config_set_pixels_per_degree(0.f);
+    flop_analyze(
+        reference_path.c_str(), test_path.c_str(), nullptr, &ppd_summaries[1]);
+    if (!std::isfinite(ppd_summaries[0].mean_error)
+        || ppd_summaries[0].mean_error == full_summary.mean_error
+        || ppd_summaries[1].mean_error != full_summary.mean_error)
+    {
+        std::printf("Pixels per degree not applied to the filter kernels\n");
+        return 1;
+    }
+
+    // Evaluating several viewing conditions at once matches evaluating them
+    // one at a time
+    float conditions[2]
+        = {0.f, 2.f * flop_pixels_per_degree(0.7f, 0.7f, 3840)};
+    FlopSummary condition_summaries[2];
+    flop_analyze_viewing_conditions(nullptr,
+                                    reference_path.c_str(),
+                                    test_path.c_str(),
+                                    conditions,
+                                    2,
+                                    nullptr,
+                                    0.f,
+                                    0,
+                                    condition_summaries);
+    for (int i = 0; i != 2; ++i)
+    {
+        FlopSummary const& expected = i == 0 ? full_summary : ppd_summaries[0];
+        if (!std::equal(std::begin(expected.histogram),
+                        std::end(expected.histogram),
+                        std::begin(condition_summaries[i].histogram))
+            || condition_summaries[i].mean_error != expected.mean_error)
+        {
+            std::printf("Viewing condition %i differs from its evaluation\n",
+                        i);
+            return 1;
+        }
+    }
 
-    return 0;
+    // Half precision is expected to move at most a small fraction of pixels to
+    // a neighboring bucket
+    return moved_fraction > 0.01f ? 1 : 0;
 }
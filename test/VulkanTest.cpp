@@ -0,0 +1,517 @@
+// Compares images exported by a second Vulkan instance, as a renderer in
+// another process would, with flop_analyze_vulkan_images. Exits with 77
+// (skipped) if the Vulkan backend or external memory is unavailable.
+#include <volk.h>
+
+#include <flop/FlopVulkan.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+// Forward declare STBI calls to avoid including a massive header
+extern "C"
+{
+    unsigned char* stbi_load(char const* filename,
+                             int* x,
+                             int* y,
+                             int* channels_in_file,
+                             int desired_channels);
+    void stbi_image_free(void* retval_from_stbi_load);
+}
+
+static constexpr int s_skipped = 77;
+
+// Device of the exporting instance. Instance-level commands dispatch through
+// the loader, but device-level commands are loaded into a table so that the
+// commands volk loaded for the flop device are left untouched.
+struct Exporter
+{
+    VkInstance instance_ = VK_NULL_HANDLE;
+    VkPhysicalDevice physical_device_;
+    VkDevice device_ = VK_NULL_HANDLE;
+    VolkDeviceTable table_;
+    VkQueue queue_;
+    uint32_t queue_family_;
+    VkCommandPool command_pool_ = VK_NULL_HANDLE;
+};
+
+struct ExportedImage
+{
+    VkImage image_         = VK_NULL_HANDLE;
+    VkDeviceMemory memory_ = VK_NULL_HANDLE;
+    FlopVulkanImage flop_image_{};
+};
+
+static VkImageUsageFlags const s_usage
+    = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+static uint32_t find_memory_type(Exporter const& exporter,
+                                 uint32_t type_bits,
+                                 VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties memory_props;
+    vkGetPhysicalDeviceMemoryProperties(exporter.physical_device_,
+                                        &memory_props);
+    for (uint32_t i = 0; i != memory_props.memoryTypeCount; ++i)
+    {
+        if ((type_bits & (1u << i))
+            && (memory_props.memoryTypes[i].propertyFlags & properties)
+                   == properties)
+        {
+            return i;
+        }
+    }
+    return ~0u;
+}
+
+// Create a device on the physical device with the given UUID, which is
+// required for its memory to be importable by the flop device
+static int create_exporter(uint8_t const* device_uuid, Exporter& exporter)
+{
+    VkApplicationInfo app_info{
+        .sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .pApplicationName   = "flop_vulkan_tests",
+        .applicationVersion = 0,
+        .apiVersion         = VK_API_VERSION_1_2,
+    };
+    VkInstanceCreateInfo instance_info{
+        .sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo = &app_info,
+    };
+    if (vkCreateInstance(&instance_info, nullptr, &exporter.instance_)
+        != VK_SUCCESS)
+    {
+        std::printf("Failed to create the exporting instance\n");
+        return 1;
+    }
+
+    uint32_t physical_device_count = 0;
+    vkEnumeratePhysicalDevices(
+        exporter.instance_, &physical_device_count, nullptr);
+    VkPhysicalDevice physical_devices[16];
+    physical_device_count = std::min(physical_device_count, 16u);
+    vkEnumeratePhysicalDevices(
+        exporter.instance_, &physical_device_count, physical_devices);
+    exporter.physical_device_ = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i != physical_device_count; ++i)
+    {
+        VkPhysicalDeviceIDProperties id_props{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+        };
+        VkPhysicalDeviceProperties2 props{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &id_props,
+        };
+        vkGetPhysicalDeviceProperties2(physical_devices[i], &props);
+        if (std::memcmp(id_props.deviceUUID, device_uuid, VK_UUID_SIZE) == 0)
+        {
+            exporter.physical_device_ = physical_devices[i];
+            break;
+        }
+    }
+    if (exporter.physical_device_ == VK_NULL_HANDLE)
+    {
+        std::printf("The exporting instance does not expose the flop device\n");
+        return 1;
+    }
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        exporter.physical_device_, &family_count, nullptr);
+    VkQueueFamilyProperties families[16];
+    family_count = std::min(family_count, 16u);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        exporter.physical_device_, &family_count, families);
+    exporter.queue_family_ = ~0u;
+    for (uint32_t i = 0; i != family_count; ++i)
+    {
+        if (families[i].queueFlags
+            & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+        {
+            exporter.queue_family_ = i;
+            break;
+        }
+    }
+    if (exporter.queue_family_ == ~0u)
+    {
+        std::printf("No queue available to the exporting instance\n");
+        return 1;
+    }
+
+    float priority = 1.f;
+    VkDeviceQueueCreateInfo queue_info{
+        .sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .queueFamilyIndex = exporter.queue_family_,
+        .queueCount       = 1,
+        .pQueuePriorities = &priority,
+    };
+    char const* extensions[] = {VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME};
+    VkDeviceCreateInfo device_info{
+        .sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .queueCreateInfoCount    = 1,
+        .pQueueCreateInfos       = &queue_info,
+        .enabledExtensionCount   = 1,
+        .ppEnabledExtensionNames = extensions,
+    };
+    if (vkCreateDevice(
+            exporter.physical_device_, &device_info, nullptr, &exporter.device_)
+        != VK_SUCCESS)
+    {
+        std::printf("Failed to create the exporting device\n");
+        return 1;
+    }
+    volkLoadDeviceTable(&exporter.table_, exporter.device_);
+    exporter.table_.vkGetDeviceQueue(
+        exporter.device_, exporter.queue_family_, 0, &exporter.queue_);
+
+    VkCommandPoolCreateInfo pool_info{
+        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .queueFamilyIndex = exporter.queue_family_,
+    };
+    if (exporter.table_.vkCreateCommandPool(
+            exporter.device_, &pool_info, nullptr, &exporter.command_pool_)
+        != VK_SUCCESS)
+    {
+        std::printf("Failed to create the exporting command pool\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void destroy_exporter(Exporter& exporter)
+{
+    if (exporter.device_ != VK_NULL_HANDLE)
+    {
+        exporter.table_.vkDestroyCommandPool(
+            exporter.device_, exporter.command_pool_, nullptr);
+        exporter.table_.vkDestroyDevice(exporter.device_, nullptr);
+    }
+    if (exporter.instance_ != VK_NULL_HANDLE)
+    {
+        vkDestroyInstance(exporter.instance_, nullptr);
+    }
+}
+
+static void destroy_image(Exporter const& exporter, ExportedImage& image)
+{
+    VolkDeviceTable const& table = exporter.table_;
+    table.vkDestroyImage(exporter.device_, image.image_, nullptr);
+    table.vkFreeMemory(exporter.device_, image.memory_, nullptr);
+    image = {};
+}
+
+// Upload RGBA8 pixels to an sRGB image in exportable memory, and release it to
+// the external queue family in the shader read-only layout
+static int export_image(Exporter const& exporter,
+                        unsigned char const* pixels,
+                        int width,
+                        int height,
+                        ExportedImage& image)
+{
+    VolkDeviceTable const& table = exporter.table_;
+    VkDevice device              = exporter.device_;
+
+    VkExternalMemoryImageCreateInfo external_info{
+        .sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    VkImageCreateInfo image_info{
+        .sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext         = &external_info,
+        .imageType     = VK_IMAGE_TYPE_2D,
+        .format        = VK_FORMAT_R8G8B8A8_SRGB,
+        .extent        = {static_cast<uint32_t>(width),
+                          static_cast<uint32_t>(height),
+                          1},
+        .mipLevels     = 1,
+        .arrayLayers   = 1,
+        .samples       = VK_SAMPLE_COUNT_1_BIT,
+        .tiling        = VK_IMAGE_TILING_OPTIMAL,
+        .usage         = s_usage,
+        .sharingMode   = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    if (table.vkCreateImage(device, &image_info, nullptr, &image.image_)
+        != VK_SUCCESS)
+    {
+        return 1;
+    }
+
+    VkMemoryRequirements requirements;
+    table.vkGetImageMemoryRequirements(device, image.image_, &requirements);
+    VkMemoryDedicatedAllocateInfo dedicated_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = image.image_,
+    };
+    VkExportMemoryAllocateInfo export_info{
+        .sType       = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+        .pNext       = &dedicated_info,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    VkMemoryAllocateInfo allocate_info{
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext           = &export_info,
+        .allocationSize  = requirements.size,
+        .memoryTypeIndex = find_memory_type(
+            exporter,
+            requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+    };
+    if (allocate_info.memoryTypeIndex == ~0u)
+    {
+        allocate_info.memoryTypeIndex
+            = find_memory_type(exporter, requirements.memoryTypeBits, 0);
+    }
+    if (table.vkAllocateMemory(device, &allocate_info, nullptr, &image.memory_)
+            != VK_SUCCESS
+        || table.vkBindImageMemory(device, image.image_, image.memory_, 0)
+               != VK_SUCCESS)
+    {
+        return 1;
+    }
+
+    // Stage the pixels in host-visible memory
+    VkDeviceSize staging_size = static_cast<VkDeviceSize>(width) * height * 4;
+    VkBufferCreateInfo buffer_info{
+        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size        = staging_size,
+        .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkBuffer staging;
+    if (table.vkCreateBuffer(device, &buffer_info, nullptr, &staging)
+        != VK_SUCCESS)
+    {
+        return 1;
+    }
+    VkMemoryRequirements staging_requirements;
+    table.vkGetBufferMemoryRequirements(
+        device, staging, &staging_requirements);
+    VkMemoryAllocateInfo staging_allocate_info{
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize  = staging_requirements.size,
+        .memoryTypeIndex = find_memory_type(
+            exporter,
+            staging_requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+    };
+    VkDeviceMemory staging_memory;
+    void* mapped = nullptr;
+    if (table.vkAllocateMemory(
+            device, &staging_allocate_info, nullptr, &staging_memory)
+        != VK_SUCCESS)
+    {
+        table.vkDestroyBuffer(device, staging, nullptr);
+        return 1;
+    }
+    table.vkBindBufferMemory(device, staging, staging_memory, 0);
+    table.vkMapMemory(device, staging_memory, 0, staging_size, 0, &mapped);
+    std::memcpy(mapped, pixels, staging_size);
+    table.vkUnmapMemory(device, staging_memory);
+
+    VkCommandBufferAllocateInfo cb_info{
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool        = exporter.command_pool_,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VkCommandBuffer cb;
+    table.vkAllocateCommandBuffers(device, &cb_info, &cb);
+    VkCommandBufferBeginInfo begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    table.vkBeginCommandBuffer(cb, &begin_info);
+
+    VkImageMemoryBarrier barrier{
+        .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask       = 0,
+        .dstAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image               = image.image_,
+        .subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+    table.vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               0,
+                               0,
+                               nullptr,
+                               0,
+                               nullptr,
+                               1,
+                               &barrier);
+
+    VkBufferImageCopy region{
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageExtent      = image_info.extent,
+    };
+    table.vkCmdCopyBufferToImage(cb,
+                                 staging,
+                                 image.image_,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 1,
+                                 &region);
+
+    barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask       = 0;
+    barrier.oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = exporter.queue_family_;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_EXTERNAL;
+    table.vkCmdPipelineBarrier(cb,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                               0,
+                               0,
+                               nullptr,
+                               0,
+                               nullptr,
+                               1,
+                               &barrier);
+    table.vkEndCommandBuffer(cb);
+
+    VkSubmitInfo submit_info{
+        .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers    = &cb,
+    };
+    VkResult result
+        = table.vkQueueSubmit(exporter.queue_, 1, &submit_info, VK_NULL_HANDLE);
+    table.vkQueueWaitIdle(exporter.queue_);
+    table.vkFreeCommandBuffers(device, exporter.command_pool_, 1, &cb);
+    table.vkDestroyBuffer(device, staging, nullptr);
+    table.vkFreeMemory(device, staging_memory, nullptr);
+    if (result != VK_SUCCESS)
+    {
+        return 1;
+    }
+
+    int fd = -1;
+    VkMemoryGetFdInfoKHR fd_info{
+        .sType      = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+        .memory     = image.memory_,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    if (table.vkGetMemoryFdKHR(device, &fd_info, &fd) != VK_SUCCESS)
+    {
+        return 1;
+    }
+
+    image.flop_image_ = {
+        .image             = VK_NULL_HANDLE,
+        .memory_fd         = fd,
+        .memory_size       = allocate_info.allocationSize,
+        .memory_type_index = allocate_info.memoryTypeIndex,
+        .usage             = s_usage,
+        .dedicated         = 1,
+        .format            = VK_FORMAT_R8G8B8A8_SRGB,
+        .width             = static_cast<uint32_t>(width),
+        .height            = static_cast<uint32_t>(height),
+        .layout            = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    return 0;
+}
+
+int main(int argc, char const* argv[])
+{
+    std::filesystem::path base{__FILE__};
+    base = base.parent_path();
+
+    std::string reference_path = (base / "reference2.png").string();
+    std::string test_path      = (base / "test2.png").string();
+
+    FlopVulkanDevice flop_device;
+    if (flop_get_vulkan_device(&flop_device) || !flop_device.external_memory_fd)
+    {
+        std::printf("Vulkan backend with external memory unavailable, "
+                    "skipping\n");
+        return s_skipped;
+    }
+
+    FlopSummary file_summary;
+    if (flop_analyze(
+            reference_path.c_str(), test_path.c_str(), nullptr, &file_summary))
+    {
+        std::printf("Failed to compare files: %s\n", flop_get_error());
+        return 1;
+    }
+
+    VkPhysicalDeviceIDProperties id_props{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 props{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &id_props,
+    };
+    vkGetPhysicalDeviceProperties2(flop_device.physical_device, &props);
+
+    Exporter exporter;
+    if (create_exporter(id_props.deviceUUID, exporter))
+    {
+        destroy_exporter(exporter);
+        return 1;
+    }
+
+    std::string const* paths[2] = {&reference_path, &test_path};
+    ExportedImage images[2];
+    int result = 0;
+    for (int i = 0; result == 0 && i != 2; ++i)
+    {
+        int width;
+        int height;
+        int channels;
+        unsigned char* pixels
+            = stbi_load(paths[i]->c_str(), &width, &height, &channels, 4);
+        if (!pixels
+            || export_image(exporter, pixels, width, height, images[i]))
+        {
+            std::printf("Failed to export %s\n", paths[i]->c_str());
+            result = 1;
+        }
+        stbi_image_free(pixels);
+    }
+
+    FlopSummary summary;
+    if (result == 0
+        && flop_analyze_vulkan_images(nullptr,
+                                      &images[0].flop_image_,
+                                      &images[1].flop_image_,
+                                      0.f,
+                                      0,
+                                      &summary))
+    {
+        std::printf("Failed to compare exported images: %s\n",
+                    flop_get_error());
+        result = 1;
+    }
+
+    for (ExportedImage& image : images)
+    {
+        destroy_image(exporter, image);
+    }
+    destroy_exporter(exporter);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // Images imported from another instance must produce the same result as
+    // the files they were decoded from
+    if (!std::equal(std::begin(file_summary.histogram),
+                    std::end(file_summary.histogram),
+                    std::begin(summary.histogram))
+        || summary.max_error != file_summary.max_error)
+    {
+        std::printf("Imported images and file comparisons differ\n");
+        return 1;
+    }
+    return 0;
+}